@@ -0,0 +1,88 @@
+#pragma once
+
+#include "include/roomClass.h"
+#include "include/camera.h"
+#include "include/tracer.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <random>
+#include <optional>
+
+/*
+* Helpers shared by the benchmark executables
+*/
+
+// Milliseconds spent in a callable
+template<typename F>
+double timeMs(F&& f) {
+	auto t1 = std::chrono::high_resolution_clock::now();
+	f();
+	auto t2 = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(t2 - t1).count();
+}
+
+// Render a small frame on the calling thread with the same tracer the renderer uses, returns the number of camera
+// rays traced. Single threaded so timings are comparable between runs
+inline long long renderFrame(const Scene& scene, const Camera& cam, int width, int height, int spp,
+	ShadingMethod shadingMethod = ShadingMethod::MC, int maxDepth = 8) {
+	Tracer tracer;
+	long long rays = 0;
+
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			for (const Ray& ray : cam.generateRandomViewRays(x, y, width, height, spp)) {
+				Vec3 sampleColor;
+				tracer.trace(ray, scene, sampleColor, 0, maxDepth, shadingMethod);
+				++rays;
+			}
+		}
+	}
+	return rays;
+}
+
+// Sphere that aimed random rays point at, see randomRays
+struct RayTarget {
+	Vec3 centre;
+	double radius;
+};
+
+// Rays from random points in a box in random directions, or towards random points on the surface of target. The
+// same seed gives the same rays, so runs and builds trace the same set
+inline std::vector<Ray> randomRays(const AABB& box, int numRays, unsigned seed, std::optional<RayTarget> target = {}) {
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> x(box.min.x, box.max.x), y(box.min.y, box.max.y), z(box.min.z, box.max.z);
+	std::normal_distribution<double> direction(0.0, 1.0);
+	std::vector<Ray> rays;
+	rays.reserve(numRays);
+	for (int i = 0; i < numRays; ++i) {
+		if (target) {
+			Vec3 aim = target->centre + Vec3(direction(rng), direction(rng), direction(rng)).normalize() * target->radius;
+			Vec3 origin(x(rng), y(rng), z(rng));
+			rays.emplace_back(origin, aim - origin);
+		}
+		else {
+			Vec3 origin(x(rng), y(rng), z(rng));
+			rays.emplace_back(origin, Vec3(direction(rng), direction(rng), direction(rng)));
+		}
+	}
+	return rays;
+}
+
+// Random rays from points in the room at least 0.05 from its walls
+inline std::vector<Ray> randomRoomRays(int numRays, unsigned seed, std::optional<RayTarget> target = {}) {
+	AABB room;
+	room.expand(Vec3(0.05, 0.05, 0.05));
+	room.expand(Vec3(3.95, 3.95, 3.95));
+	return randomRays(room, numRays, seed, target);
+}
+
+// Cornell box scene with a tessellated sphere of roughly the given number of triangles in front of the camera
+inline void addMeshToScene(Scene& scene, int targetTriangles) {
+	int rings = std::max(2, (int)std::sqrt(targetTriangles / 4.0));
+	auto mesh = std::make_shared<TriObj>();
+	mesh->createSphereMesh(Vec3(2.5, 1.5, 1.2), 0.6, rings, Vec3(0.7, 0.6, 0.5));
+	mesh->setMat("DIFFUSE");
+	scene.addTriObj(mesh);
+}
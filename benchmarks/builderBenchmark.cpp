@@ -0,0 +1,50 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "benchmarks/benchmarkUtils.h"
+
+// Compares build time against render time of the BVH builders for growing triangle counts. Throughput is given in
+// thousands of camera paths (one camera ray with all its bounces) per second.
+// Usage: BuilderBenchmark [maxTriangles] [imageSize] [spp]
+int main(int argc, char** argv) {
+	int maxTriangles = argc > 1 ? std::atoi(argv[1]) : 1000000;
+	int size = argc > 2 ? std::atoi(argv[2]) : 64;
+	int spp = argc > 3 ? std::atoi(argv[3]) : 4;
+
+	struct BuilderInfo {
+		BVHBuilder builder;
+		const char* name;
+	};
+	const BuilderInfo builders[] = {
+		{ BVHBuilder::SAH, "SAH" },
+		{ BVHBuilder::BinnedSAH, "BinnedSAH" },
+		{ BVHBuilder::LBVH, "LBVH" },
+	};
+
+	Camera cam;
+
+	std::cout << "Image " << size << "x" << size << ", " << spp << " spp\n";
+	std::cout << std::left << std::setw(12) << "triangles" << std::setw(12) << "builder" << std::right
+		<< std::setw(12) << "build ms" << std::setw(12) << "render ms" << std::setw(12) << "total ms"
+		<< std::setw(14) << "Kpaths/s" << "\n";
+
+	for (int triangles = 1000; triangles <= maxTriangles; triangles *= 10) {
+		for (const BuilderInfo& info : builders) {
+			Scene scene;
+			addMeshToScene(scene, triangles);
+			scene.bvhBuilder = info.builder;
+
+			double buildMs = timeMs([&]() { scene.buildBVH(); });
+
+			long long rays = 0;
+			double renderMs = timeMs([&]() { rays = renderFrame(scene, cam, size, size, spp); });
+
+			std::cout << std::left << std::setw(12) << triangles << std::setw(12) << info.name << std::right
+				<< std::fixed << std::setprecision(1)
+				<< std::setw(12) << buildMs << std::setw(12) << renderMs << std::setw(12) << buildMs + renderMs
+				<< std::setprecision(3) << std::setw(14) << rays / renderMs << "\n";
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,272 @@
+// The analyzer always counts the nodes visited by its rays
+#ifndef TRAVERSAL_STATS
+#define TRAVERSAL_STATS
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <filesystem>
+
+#include "benchmarks/benchmarkUtils.h"
+#include "include/objLoader.h"
+#include "include/plyLoader.h"
+#include "include/sceneFile.h"
+
+// Offline quality report of the BVH builders on a scene, without rendering it. Every builder builds the whole scene,
+// then the trees are measured (SAH cost, leaf depth and size histograms, node count and memory) and a fixed set of
+// random rays is traced to count the nodes and primitive tests per ray actually needed. The histograms are taken over
+// the binary nodes of all bottom-level trees, node counts, memory and the traced rays use the selected layout.
+// The scene is the room with a model loaded from an .obj, .ply or .scene file, or with a tessellated sphere of the
+// given number of triangles if no file is given. Stored BVHs of a scene file are rebuilt by every builder.
+// Usage: BVHAnalyzer [meshTriangles | model.obj | model.ply | model.scene] [numRays] [binary|wide|quant16|quant8]
+
+struct BuilderReport {
+	const char* name;
+	double buildMs = 0.0;
+	double sahCost = 0.0;
+	size_t nodes = 0;
+	size_t leaves = 0;
+	size_t references = 0;
+	size_t memoryBytes = 0;
+	double nodesPerRay = 0.0;
+	double testsPerRay = 0.0;
+	std::vector<size_t> depthHistogram;
+	std::vector<size_t> leafSizeHistogram = std::vector<size_t>(BVH::maxLeafSize + 1, 0);
+};
+
+// Depth bucket width of the leaf depth histogram
+static const int depthBucket = 4;
+
+// Add the leaf depths and sizes of one tree to the report
+static void addTreeShape(const BVH& bvh, BuilderReport& report) {
+	if (bvh.empty()) {
+		return;
+	}
+
+	std::vector<std::pair<int, int>> stack = { { 0, 0 } };
+	while (!stack.empty()) {
+		auto [index, depth] = stack.back();
+		stack.pop_back();
+
+		const BVHNode& node = bvh.nodes[index];
+		if (node.isLeaf()) {
+			size_t bucket = depth / depthBucket;
+			if (report.depthHistogram.size() <= bucket) {
+				report.depthHistogram.resize(bucket + 1, 0);
+			}
+			++report.depthHistogram[bucket];
+			++report.leafSizeHistogram[std::min(node.count, BVH::maxLeafSize)];
+			++report.leaves;
+			continue;
+		}
+		stack.push_back({ node.leftFirst, depth + 1 });
+		stack.push_back({ node.leftFirst + 1, depth + 1 });
+	}
+}
+
+static size_t layoutNodeCount(const BVH& bvh) {
+	if (!bvh.wide.empty()) return bvh.wide.nodes.size();
+	if (!bvh.wide16.empty()) return bvh.wide16.nodes.size();
+	if (!bvh.wide8.empty()) return bvh.wide8.nodes.size();
+	return bvh.nodes.size();
+}
+
+// Expected cost of a ray through the scene bounds, the top-level tree plus every bottom-level tree weighted by the
+// probability of the ray hitting its object
+static double sceneSAHCost(const Scene& scene) {
+	double cost = scene.tlas.sahCost();
+	double sceneArea = scene.tlas.empty() ? 0.0 : scene.tlas.nodes[0].bounds.surfaceArea();
+	if (sceneArea <= 0.0) {
+		return cost;
+	}
+	for (const auto& obj : scene.objs) {
+		cost += obj->bounds().surfaceArea() / sceneArea * obj->bvh().sahCost();
+	}
+	return cost;
+}
+
+// Add the model at path to the scene, picking the loader by the file extension. Returns false with a message on error
+static bool loadModel(const std::string& path, Scene& scene, std::string& error) {
+	std::string extension = std::filesystem::path(path).extension().string();
+	if (extension == ".scene") {
+		SceneFile file;
+		bool loaded = file.load(path, scene);
+		error = file.error;
+		return loaded;
+	}
+
+	auto model = std::make_shared<TriObj>();
+	if (extension == ".obj") {
+		ObjLoader loader;
+		if (!loader.load(path, *model)) {
+			error = loader.error;
+			return false;
+		}
+	}
+	else if (extension == ".ply") {
+		PlyLoader loader;
+		if (!loader.load(path, *model)) {
+			error = loader.error;
+			return false;
+		}
+	}
+	else {
+		error = "Unknown model format " + path + ", expected .obj, .ply or .scene";
+		return false;
+	}
+	scene.addTriObj(model);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	std::string input = argc > 1 ? argv[1] : "100000";
+	bool synthetic = !input.empty() && input.find_first_not_of("0123456789") == std::string::npos;
+	int meshTriangles = synthetic ? std::atoi(input.c_str()) : 0;
+	int numRays = argc > 2 ? std::atoi(argv[2]) : 1000000;
+	const char* layoutName = argc > 3 ? argv[3] : "wide";
+
+	struct LayoutInfo {
+		BVHLayout layout;
+		const char* name;
+	};
+	const LayoutInfo layouts[] = {
+		{ BVHLayout::Binary, "binary" },
+		{ BVHLayout::Wide, "wide" },
+		{ BVHLayout::Quantized16, "quant16" },
+		{ BVHLayout::Quantized8, "quant8" },
+	};
+	const LayoutInfo* layout = nullptr;
+	for (const LayoutInfo& info : layouts) {
+		if (std::strcmp(info.name, layoutName) == 0) {
+			layout = &info;
+		}
+	}
+	if (!layout) {
+		std::cerr << "Unknown layout " << layoutName << ", expected binary, wide, quant16 or quant8\n";
+		return 1;
+	}
+
+	struct BuilderInfo {
+		BVHBuilder builder;
+		const char* name;
+	};
+	const BuilderInfo builders[] = {
+		{ BVHBuilder::SAH, "SAH" },
+		{ BVHBuilder::BinnedSAH, "BinnedSAH" },
+		{ BVHBuilder::LBVH, "LBVH" },
+		{ BVHBuilder::SBVH, "SBVH" },
+	};
+
+	// The scene is loaded once, every builder rebuilds all of its trees
+	Scene scene;
+	if (!synthetic) {
+		// A scene file adds to the top level, which needs the room's trees
+		scene.buildBVH();
+		std::string error;
+		if (!loadModel(input, scene, error)) {
+			std::cerr << error << "\n";
+			return 1;
+		}
+	}
+	else if (meshTriangles > 0) {
+		addMeshToScene(scene, meshTriangles);
+	}
+	scene.buildBVH();
+	AABB sceneBounds = scene.tlas.nodes[0].bounds;
+
+	// Same rays for every builder, from random points in the scene bounds less 0.05 on every side in random
+	// directions. In the room alone these are the random room rays
+	AABB rayBox;
+	rayBox.expand(sceneBounds.min + Vec3(0.05, 0.05, 0.05));
+	rayBox.expand(sceneBounds.max - Vec3(0.05, 0.05, 0.05));
+	std::vector<Ray> rays = randomRays(rayBox, numRays, 7);
+
+	std::vector<BuilderReport> reports;
+	size_t numTriangles = 0, numObjs = 0, numSpheres = 0;
+
+	for (const BuilderInfo& info : builders) {
+		scene.bvhBuilder = info.builder;
+		scene.bvhLayout = layout->layout;
+
+		BuilderReport report;
+		report.name = info.name;
+		report.buildMs = timeMs([&]() { scene.buildBVH(); });
+		report.sahCost = sceneSAHCost(scene);
+
+		numTriangles = 0;
+		for (const auto& obj : scene.objs) {
+			const BVH& bvh = obj->bvh();
+			addTreeShape(bvh, report);
+			report.nodes += layoutNodeCount(bvh);
+			report.references += bvh.primIndices.size();
+			report.memoryBytes += bvh.nodeMemory() + bvh.primIndices.size() * sizeof(int);
+			numTriangles += obj->triangleCount();
+		}
+		report.nodes += layoutNodeCount(scene.tlas);
+		report.memoryBytes += scene.tlas.nodeMemory() + scene.tlas.primIndices.size() * sizeof(int);
+		numObjs = scene.objs.size();
+		numSpheres = scene.spheres.size();
+
+		TraversalStats before = TraversalStats::local();
+		for (const Ray& ray : rays) {
+			SceneHit hit;
+			scene.intersect(ray, hit);
+		}
+		TraversalStats traced = TraversalStats::local() - before;
+		report.nodesPerRay = (double)traced.nodes / std::max(1, numRays);
+		report.testsPerRay = (double)(traced.triangleTests + traced.sphereTests) / std::max(1, numRays);
+
+		reports.push_back(report);
+	}
+
+	std::cout << (!synthetic ? input : meshTriangles > 0 ? "Room with a " + input + " triangle sphere" : "Room") << "\n" << numObjs << " objects, " << numTriangles << " triangles, " << numSpheres << " spheres, "
+		<< layout->name << " layout, BVH width " << BVH_WIDTH << ", " << numRays << " random rays\n\n";
+
+	std::cout << std::left << std::setw(12) << "builder" << std::right << std::setw(12) << "build ms"
+		<< std::setw(12) << "SAH cost" << std::setw(10) << "nodes" << std::setw(10) << "leaves"
+		<< std::setw(10) << "refs" << std::setw(10) << "MB" << std::setw(12) << "nodes/ray"
+		<< std::setw(12) << "tests/ray" << "\n";
+	for (const BuilderReport& r : reports) {
+		std::cout << std::left << std::setw(12) << r.name << std::right << std::fixed
+			<< std::setprecision(1) << std::setw(12) << r.buildMs << std::setprecision(2) << std::setw(12) << r.sahCost
+			<< std::setw(10) << r.nodes << std::setw(10) << r.leaves << std::setw(10) << r.references
+			<< std::setw(10) << r.memoryBytes / (1024.0 * 1024.0) << std::setw(12) << r.nodesPerRay
+			<< std::setw(12) << r.testsPerRay << "\n";
+	}
+
+	size_t numBuckets = 0;
+	for (const BuilderReport& r : reports) {
+		numBuckets = std::max(numBuckets, r.depthHistogram.size());
+	}
+
+	std::cout << "\nLeaves per depth\n" << std::left << std::setw(12) << "builder" << std::right;
+	for (size_t b = 0; b < numBuckets; ++b) {
+		std::string range = std::to_string(b * depthBucket) + "-" + std::to_string((b + 1) * depthBucket - 1);
+		std::cout << std::setw(9) << range;
+	}
+	std::cout << "\n";
+	for (const BuilderReport& r : reports) {
+		std::cout << std::left << std::setw(12) << r.name << std::right;
+		for (size_t b = 0; b < numBuckets; ++b) {
+			std::cout << std::setw(9) << (b < r.depthHistogram.size() ? r.depthHistogram[b] : 0);
+		}
+		std::cout << "\n";
+	}
+
+	std::cout << "\nLeaves per size\n" << std::left << std::setw(12) << "builder" << std::right;
+	for (int size = 0; size <= BVH::maxLeafSize; ++size) {
+		std::cout << std::setw(9) << size;
+	}
+	std::cout << "\n";
+	for (const BuilderReport& r : reports) {
+		std::cout << std::left << std::setw(12) << r.name << std::right;
+		for (size_t count : r.leafSizeHistogram) {
+			std::cout << std::setw(9) << count;
+		}
+		std::cout << "\n";
+	}
+	return 0;
+}
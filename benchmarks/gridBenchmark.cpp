@@ -0,0 +1,102 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <random>
+
+#include "benchmarks/benchmarkUtils.h"
+
+// Compares the grid and BVH top-level structures on the Cornell box filled with small spheres, once spread evenly
+// through the room and once mostly packed into a few tight clusters. Throughput is given for random closest-hit
+// rays from inside the room and in thousands of camera paths per second for a rendered frame.
+// Usage: GridBenchmark [numSpheres] [numRays] [imageSize] [spp]
+
+// Add numSpheres spheres, a clustered fraction of them around a few random centres and the rest anywhere in the room
+static void addSpheres(Scene& scene, int numSpheres, double clusteredFraction, std::mt19937& rng) {
+	std::uniform_real_distribution<double> room(0.2, 3.8);
+	std::uniform_real_distribution<double> unit(-1.0, 1.0);
+	const int numClusters = 4;
+	const double clusterRadius = 0.15;
+	const double sphereRadius = 0.6 / std::cbrt((double)numSpheres);
+
+	Vec3 centres[numClusters];
+	for (Vec3& c : centres) {
+		c = Vec3(room(rng), room(rng), room(rng));
+	}
+
+	for (int i = 0; i < numSpheres; ++i) {
+		Vec3 p;
+		if (i < numSpheres * clusteredFraction) {
+			const Vec3& c = centres[i % numClusters];
+			p = c + Vec3(unit(rng), unit(rng), unit(rng)) * clusterRadius;
+		}
+		else {
+			p = Vec3(room(rng), room(rng), room(rng));
+		}
+		scene.addSphere(std::make_shared<Sphere>(p, sphereRadius * 0.5, Vec3(0.6, 0.6, 0.6), "DIFFUSE"));
+	}
+}
+
+int main(int argc, char** argv) {
+	int numSpheres = argc > 1 ? std::atoi(argv[1]) : 20000;
+	int numRays = argc > 2 ? std::atoi(argv[2]) : 500000;
+	int size = argc > 3 ? std::atoi(argv[3]) : 48;
+	int spp = argc > 4 ? std::atoi(argv[4]) : 2;
+
+	struct SceneInfo {
+		const char* name;
+		double clusteredFraction;
+	};
+	const SceneInfo scenes[] = {
+		{ "uniform", 0.0 },
+		{ "clustered", 0.95 },
+	};
+
+	struct AcceleratorInfo {
+		SceneAccelerator accelerator;
+		const char* name;
+	};
+	const AcceleratorInfo accelerators[] = {
+		{ SceneAccelerator::BVH, "BVH" },
+		{ SceneAccelerator::Grid, "Grid" },
+	};
+
+	std::vector<Ray> rays = randomRoomRays(numRays, 99);
+
+	Camera cam;
+
+	std::cout << numSpheres << " spheres, " << numRays << " random rays, image " << size << "x" << size << ", " << spp << " spp\n";
+	std::cout << std::left << std::setw(12) << "scene" << std::setw(8) << "accel" << std::right
+		<< std::setw(12) << "build ms" << std::setw(12) << "Mrays/s" << std::setw(12) << "Kpaths/s"
+		<< std::setw(10) << "hits" << "\n";
+
+	for (const SceneInfo& sceneInfo : scenes) {
+		std::mt19937 rng(1234);
+		Scene scene;
+		addSpheres(scene, numSpheres, sceneInfo.clusteredFraction, rng);
+		scene.buildBVH();
+
+		for (const AcceleratorInfo& info : accelerators) {
+			scene.accelerator = info.accelerator;
+			double buildMs = timeMs([&]() { scene.buildTLAS(); });
+
+			int hits = 0;
+			double traceMs = timeMs([&]() {
+				for (const Ray& ray : rays) {
+					SceneHit hit;
+					if (scene.intersect(ray, hit)) {
+						++hits;
+					}
+				}
+				});
+
+			long long paths = 0;
+			double renderMs = timeMs([&]() { paths = renderFrame(scene, cam, size, size, spp); });
+
+			std::cout << std::left << std::setw(12) << sceneInfo.name << std::setw(8) << info.name << std::right
+				<< std::fixed << std::setprecision(2) << std::setw(12) << buildMs
+				<< std::setprecision(3) << std::setw(12) << numRays / traceMs / 1000.0
+				<< std::setw(12) << paths / renderMs << std::setw(10) << hits << "\n";
+		}
+	}
+	return 0;
+}
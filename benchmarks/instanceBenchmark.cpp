@@ -0,0 +1,109 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <random>
+
+#include "benchmarks/benchmarkUtils.h"
+
+// A room of furniture, copies of one tessellated sphere mesh placed with random rotations, scales and positions.
+// The scene is built once with instances sharing the mesh and once with a transformed TriObj per copy, as before
+// instancing. Compares the geometry memory, the build time and the closest-hit and shadow ray throughput, and counts
+// rays where the two scenes disagree.
+// Usage: InstanceBenchmark [maxCopies] [meshTriangles] [numRays]
+int main(int argc, char** argv) {
+	int maxCopies = argc > 1 ? std::atoi(argv[1]) : 1000;
+	int meshTriangles = argc > 2 ? std::atoi(argv[2]) : 2000;
+	int numRays = argc > 3 ? std::atoi(argv[3]) : 200000;
+
+	auto furniture = std::make_shared<TriObj>();
+	furniture->createSphereMesh(Vec3(0.0, 0.0, 0.0), 1.0, std::max(2, (int)std::sqrt(meshTriangles / 4.0)), Vec3(0.7, 0.6, 0.5));
+	furniture->setMat("DIFFUSE");
+
+	std::vector<Ray> rays = randomRoomRays(numRays, 11);
+
+	// Shadow rays between random points, and the placements of the copies
+	std::mt19937 rng(12);
+	std::uniform_real_distribution<double> position(0.2, 3.8), unit(0.0, 1.0);
+	std::normal_distribution<double> direction(0.0, 1.0);
+	std::vector<std::pair<Ray, double>> shadowRays;
+	for (int i = 0; i < numRays; ++i) {
+		Vec3 from(position(rng), position(rng), position(rng)), to(position(rng), position(rng), position(rng));
+		shadowRays.emplace_back(Ray(from, to - from), (to - from).getLength());
+	}
+
+	std::cout << furniture->triangleCount() << " triangle mesh, " << numRays << " rays\n";
+	std::cout << std::left << std::setw(8) << "copies" << std::setw(11) << "scene" << std::right << std::setw(12) << "geometry MB"
+		<< std::setw(12) << "build ms" << std::setw(10) << "Mrays/s" << std::setw(12) << "shadow/s M" << std::setw(12) << "mismatches" << "\n";
+
+	for (int copies = 10; copies <= maxCopies; copies *= 10) {
+		// Placements shrink with the number of copies so they stay apart in the room
+		std::vector<Transform> placements;
+		double size = 0.5 / std::cbrt((double)copies);
+		for (int i = 0; i < copies; ++i) {
+			Vec3 axis(direction(rng), direction(rng), direction(rng));
+			Vec3 scale(size * (0.5 + unit(rng)), size * (0.5 + unit(rng)), size * (0.5 + unit(rng)));
+			placements.push_back(Transform::translation(Vec3(position(rng), position(rng), position(rng)))
+				* Transform::rotation(axis, 2.0 * M_PI * unit(rng)) * Transform::scaling(scale));
+		}
+
+		Scene instanced, duplicated;
+		for (const Transform& placement : placements) {
+			instanced.addInstance(std::make_shared<Instance>(furniture, placement));
+
+			auto copy = std::make_shared<TriObj>(*furniture);
+			for (auto& v : copy->mesh.vertices) {
+				v = placement.applyPoint(v);
+			}
+			duplicated.addTriObj(copy);
+		}
+
+		double instancedBuildMs = timeMs([&]() { instanced.buildBVH(); });
+		double duplicatedBuildMs = timeMs([&]() { duplicated.buildBVH(); });
+
+		// Mesh and packed triangles of every placed object, the room walls are in both scenes
+		size_t instancedBytes = furniture->memoryBytes() + instanced.instances.size() * (sizeof(Instance) + sizeof(std::shared_ptr<Instance>));
+		size_t duplicatedBytes = 0;
+		for (size_t i = duplicated.objs.size() - copies; i < duplicated.objs.size(); ++i) {
+			duplicatedBytes += duplicated.objs[i]->memoryBytes() + sizeof(TriObj);
+		}
+
+		std::vector<double> tInstanced(rays.size()), tDuplicated(rays.size());
+		int blockedInstanced = 0, blockedDuplicated = 0;
+		auto run = [&](const Scene& scene, std::vector<double>& tOut, int& blocked, double& ms, double& shadowMs) {
+			ms = timeMs([&]() {
+				for (size_t i = 0; i < rays.size(); ++i) {
+					SceneHit hit;
+					scene.intersect(rays[i], hit);
+					tOut[i] = hit.t;
+				}
+				});
+			shadowMs = timeMs([&]() {
+				for (const auto& s : shadowRays) {
+					blocked += scene.occluded(s.first, s.second);
+				}
+				});
+		};
+		double instancedMs, instancedShadowMs, duplicatedMs, duplicatedShadowMs;
+		run(instanced, tInstanced, blockedInstanced, instancedMs, instancedShadowMs);
+		run(duplicated, tDuplicated, blockedDuplicated, duplicatedMs, duplicatedShadowMs);
+
+		// Triangle distances come from the single precision kernel, in object space for the instances and in world
+		// space for the copies, so they only agree up to float rounding
+		int mismatches = std::abs(blockedInstanced - blockedDuplicated);
+		for (size_t i = 0; i < rays.size(); ++i) {
+			if (std::abs(tInstanced[i] - tDuplicated[i]) > 1e-4 * std::max(1.0, tDuplicated[i])) {
+				++mismatches;
+			}
+		}
+
+		auto row = [&](const char* name, size_t bytes, double buildMs, double ms, double shadowMs, const std::string& errors) {
+			std::cout << std::left << std::setw(8) << copies << std::setw(11) << name << std::right << std::fixed
+				<< std::setprecision(2) << std::setw(12) << bytes / (1024.0 * 1024.0) << std::setw(12) << buildMs
+				<< std::setprecision(3) << std::setw(10) << numRays / ms / 1000.0 << std::setw(12) << numRays / shadowMs / 1000.0
+				<< std::setw(12) << errors << "\n";
+		};
+		row("instanced", instancedBytes, instancedBuildMs, instancedMs, instancedShadowMs, std::to_string(mismatches));
+		row("duplicated", duplicatedBytes, duplicatedBuildMs, duplicatedMs, duplicatedShadowMs, "");
+	}
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <filesystem>
+
+#include "benchmarks/benchmarkUtils.h"
+#include "include/objLoader.h"
+#include "include/sceneFile.h"
+
+// Converts an OBJ model to the binary scene format, with its BVH built by the scene's default builder so loading the
+// file needs no build. Afterwards it compares the startup of both paths, loading the OBJ and building its BVH
+// against loading the scene file, and traces random rays through both scenes to check they are the same.
+// Usage: ObjConverter input.obj output.scene [material]
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		std::cerr << "Usage: ObjConverter input.obj output.scene [material]\n";
+		return 1;
+	}
+	std::string objPath = argv[1], scenePath = argv[2];
+
+	// Both scenes hold the room and the model
+	Scene fromObj, fromFile;
+
+	auto model = std::make_shared<TriObj>();
+	if (argc > 3) {
+		model->setMat(argv[3]);
+	}
+	ObjLoader loader;
+	bool loaded = false;
+	double parseMs = timeMs([&]() { loaded = loader.load(objPath, *model); });
+	if (!loaded) {
+		std::cerr << loader.error << "\n";
+		return 1;
+	}
+	fromObj.addTriObj(model);
+	double buildMs = timeMs([&]() { fromObj.buildBVH(); });
+
+	// Only the model is written, the room comes with every Scene
+	SceneFile sceneFile;
+	if (!sceneFile.write(scenePath, { model })) {
+		std::cerr << sceneFile.error << "\n";
+		return 1;
+	}
+
+	fromFile.buildBVH();
+	double loadMs = timeMs([&]() { loaded = sceneFile.load(scenePath, fromFile); });
+	if (!loaded) {
+		std::cerr << sceneFile.error << "\n";
+		return 1;
+	}
+
+	// Every ray has to find the same hit in both scenes
+	int numRays = 100000, mismatches = 0;
+	for (const Ray& ray : randomRoomRays(numRays, 3)) {
+		SceneHit a, b;
+		fromObj.intersect(ray, a);
+		fromFile.intersect(ray, b);
+		mismatches += a.t != b.t || a.objIndex != b.objIndex || a.primIndex != b.primIndex;
+	}
+
+	const TriObj& mapped = *fromFile.objs.back();
+	std::cout << model->triangleCount() << " triangles, " << model->mesh.vertices.size() << " vertices, "
+		<< model->mesh.materials.size() << " materials\n" << std::fixed << std::setprecision(1)
+		<< "  OBJ file:          " << std::filesystem::file_size(objPath) / (1024.0 * 1024.0) << " MB\n"
+		<< "  Scene file:        " << std::filesystem::file_size(scenePath) / (1024.0 * 1024.0) << " MB"
+		<< (mapped.mesh.vertices.isView() ? ", mesh mapped in place\n" : ", mesh converted\n")
+		<< "  OBJ parse + build: " << parseMs << " + " << buildMs << " ms\n"
+		<< "  Scene file load:   " << loadMs << " ms\n"
+		<< "  Mismatched rays:   " << mismatches << " of " << numRays << "\n";
+	return mismatches == 0 ? 0 : 1;
+}
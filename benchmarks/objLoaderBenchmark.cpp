@@ -0,0 +1,136 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+#include "benchmarks/benchmarkUtils.h"
+#include "include/objLoader.h"
+
+// Writes a tessellated sphere of about the given number of triangles as an OBJ file with an MTL library and four
+// material groups, then loads it with ObjLoader on one thread and on all hardware threads. A getline and
+// stringstream loader, as OBJ readers are usually written, is timed as reference. The loaded mesh is checked against
+// the written one.
+// Usage: ObjLoaderBenchmark [triangles] [directory]
+
+// Reference loader, one std::string per line and a stringstream per line, no materials
+static void loadReference(const std::string& path, IndexedMesh& mesh) {
+	std::ifstream ifs(path);
+	std::string line, keyword, corner;
+	std::vector<uint32_t> face;
+	uint16_t color = mesh.colorID(Vec3(0.8, 0.8, 0.8));
+	while (std::getline(ifs, line)) {
+		std::istringstream ss(line);
+		ss >> keyword;
+		if (keyword == "v") {
+			double x, y, z;
+			ss >> x >> y >> z;
+			mesh.addVertex(Vec3(x, y, z));
+		}
+		else if (keyword == "f") {
+			face.clear();
+			while (ss >> corner) {
+				face.push_back((uint32_t)std::stol(corner) - 1);
+			}
+			for (size_t i = 2; i < face.size(); ++i) {
+				mesh.addFace(face[0], face[i - 1], face[i], color);
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	int targetTriangles = argc > 1 ? std::atoi(argv[1]) : 1000000;
+	std::filesystem::path directory = argc > 2 ? std::filesystem::path(argv[2]) : std::filesystem::temp_directory_path();
+	std::string objPath = (directory / "objLoaderBenchmark.obj").string();
+	std::string mtlPath = (directory / "objLoaderBenchmark.mtl").string();
+
+	TriObj source;
+	source.createSphereMesh(Vec3(2.0, 2.0, 2.0), 1.0, std::max(2, (int)std::sqrt(targetTriangles / 4.0)), Vec3(0.8, 0.8, 0.8));
+	const IndexedMesh& written = source.mesh;
+
+	// Four quarters of the faces use the four materials, which map to these tracer materials
+	const char* materialNames[] = { "red", "chrome", "glass", "lamp" };
+	const MaterialType expectedMaterials[] = { MaterialType::Diffuse, MaterialType::Mirror, MaterialType::Glass, MaterialType::Emissive };
+	{
+		std::ofstream mtl(mtlPath);
+		mtl << "newmtl red\nKd 0.8 0.2 0.2\nillum 2\n\n"
+			<< "newmtl chrome\nKd 0 0 0\nKs 0.9 0.9 0.9\nillum 3\n\n"
+			<< "newmtl glass\nKd 0.9 0.9 0.9\nd 0.1\nillum 4\n\n"
+			<< "newmtl lamp\nKd 1 1 1\nKe 5 5 5\n";
+
+		FILE* obj = std::fopen(objPath.c_str(), "w");
+		std::fprintf(obj, "# ObjLoaderBenchmark\nmtllib objLoaderBenchmark.mtl\no sphere\n");
+		for (const Vec3& v : written.vertices) {
+			std::fprintf(obj, "v %.6f %.6f %.6f\n", (double)v.x, (double)v.y, (double)v.z);
+		}
+		size_t numFaces = written.faceCount();
+		for (size_t f = 0; f < numFaces; ++f) {
+			if (f % ((numFaces + 3) / 4) == 0) {
+				std::fprintf(obj, "usemtl %s\n", materialNames[f / ((numFaces + 3) / 4)]);
+			}
+			std::fprintf(obj, "f %u//%u %u//%u %u//%u\n", written.indices[f * 3] + 1, written.indices[f * 3] + 1,
+				written.indices[f * 3 + 1] + 1, written.indices[f * 3 + 1] + 1, written.indices[f * 3 + 2] + 1, written.indices[f * 3 + 2] + 1);
+		}
+		std::fclose(obj);
+	}
+	double fileMB = std::filesystem::file_size(objPath) / (1024.0 * 1024.0);
+	unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	std::cout << written.faceCount() << " triangles, " << written.vertices.size() << " vertices, "
+		<< std::fixed << std::setprecision(1) << fileMB << " MB OBJ file\n";
+	std::cout << std::left << std::setw(26) << "loader" << std::right << std::setw(12) << "ms" << std::setw(12) << "MB/s"
+		<< std::setw(14) << "Mtris/s" << std::setw(12) << "errors" << "\n";
+
+	auto row = [&](const std::string& name, double ms, const std::string& errors) {
+		std::cout << std::left << std::setw(26) << name << std::right << std::fixed << std::setprecision(1) << std::setw(12) << ms
+			<< std::setw(12) << fileMB / ms * 1000.0 << std::setprecision(2) << std::setw(14) << written.faceCount() / ms / 1000.0
+			<< std::setw(12) << errors << "\n";
+	};
+
+	IndexedMesh reference;
+	row("getline + stringstream", timeMs([&]() { loadReference(objPath, reference); }), "");
+
+	for (unsigned int threads : { 1u, hardwareThreads }) {
+		TriObj loaded;
+		ObjLoader loader;
+		loader.numThreads = (int)threads;
+		bool ok = false;
+		double ms = timeMs([&]() { ok = loader.load(objPath, loaded); });
+		if (!ok) {
+			std::cerr << loader.error << "\n";
+			return 1;
+		}
+
+		// Vertices went through six decimals, faces and materials have to match exactly
+		const IndexedMesh& mesh = loaded.mesh;
+		size_t errors = (mesh.vertices.size() != written.vertices.size()) + (mesh.faceCount() != written.faceCount());
+		for (size_t i = 0; errors == 0 && i < mesh.vertices.size(); ++i) {
+			Vec3 d = mesh.vertices[i] - written.vertices[i];
+			errors += std::abs(d.x) + std::abs(d.y) + std::abs(d.z) > 1e-5;
+		}
+		for (size_t f = 0; errors == 0 && f < mesh.faceCount(); ++f) {
+			errors += mesh.indices[f * 3] != written.indices[f * 3] || mesh.indices[f * 3 + 1] != written.indices[f * 3 + 1]
+				|| mesh.indices[f * 3 + 2] != written.indices[f * 3 + 2]
+				|| Materials::get(loaded.getMat((int)f)).type != expectedMaterials[f / ((written.faceCount() + 3) / 4)];
+		}
+		row("ObjLoader, " + std::to_string(threads) + (threads == 1 ? " thread" : " threads"), ms, std::to_string(errors));
+		if (threads == hardwareThreads) {
+			break;
+		}
+	}
+
+	// An empty file is a valid OBJ without faces
+	std::ofstream(objPath, std::ios::trunc).close();
+	ObjLoader emptyLoader;
+	TriObj empty;
+	empty.addParallelogram(Vec3(0.0), Vec3(1.0, 0.0, 0.0), Vec3(0.0, 1.0, 0.0), Vec3(1.0));
+	bool loaded = emptyLoader.load(objPath, empty);
+	std::cout << "Empty file loaded " << loaded << " of 1, " << empty.triangleCount() << " faces of 0 " << emptyLoader.error << "\n";
+
+	std::remove(objPath.c_str());
+	std::remove(mtlPath.c_str());
+	return 0;
+}
@@ -0,0 +1,223 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <new>
+#include <atomic>
+#include <filesystem>
+
+#include "benchmarks/benchmarkUtils.h"
+#include "include/plyLoader.h"
+
+// Writes a scanned-looking height field of about the given number of triangles as binary PLY files in two layouts,
+// then loads them with PlyLoader. The scan layout is little endian triangles with float positions, normals, 8 bit
+// colors and a quality value, after a camera element the loader has to skip. The quad layout is big endian quads
+// with double positions and 16 bit colors. Every load reports its time, its heap peak against the size of the loaded
+// mesh, and the mesh is checked against the written one.
+// Usage: PlyLoaderBenchmark [triangles] [directory]
+
+// Heap in use and its peak, counted by the replaced global operator new
+static std::atomic<size_t> heapBytes{ 0 };
+static std::atomic<size_t> heapPeak{ 0 };
+
+// Every allocation carries its size in front, padded so the returned pointer stays aligned for any type
+static constexpr size_t sizeHeader = alignof(std::max_align_t);
+
+void* operator new(size_t size) {
+	unsigned char* block = (unsigned char*)std::malloc(size + sizeHeader);
+	if (!block) {
+		throw std::bad_alloc();
+	}
+	*(size_t*)block = size;
+	size_t now = heapBytes += size;
+	size_t peak = heapPeak.load();
+	while (now > peak && !heapPeak.compare_exchange_weak(peak, now)) {
+	}
+	return block + sizeHeader;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+	if (p) {
+		unsigned char* block = (unsigned char*)p - sizeHeader;
+		heapBytes -= *(size_t*)block;
+		std::free(block);
+	}
+}
+
+void operator delete[](void* p) noexcept {
+	operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	operator delete(p);
+}
+
+struct Layout {
+	const char* name;
+	bool bigEndian;
+	bool quads;
+};
+
+// Height field vertex and its color, the same for both layouts
+static Vec3 gridVertex(int n, int i, int j) {
+	double x = (double)i / (n - 1), z = (double)j / (n - 1);
+	return Vec3(x * 4.0, 1.0 + 0.2 * std::sin(x * 17.0) * std::cos(z * 13.0), z * 4.0);
+}
+
+static Vec3 gridColor(int n, int i, int j) {
+	return Vec3((double)i / (n - 1), (double)j / (n - 1), 0.5);
+}
+
+// Writes values in the file's byte order
+class PlyWriter {
+public:
+	PlyWriter(std::FILE* file, bool bigEndian) : file(file), swap(bigEndian) {}
+
+	template<typename T>
+	void put(T value) {
+		unsigned char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		if (swap) {
+			std::reverse(bytes, bytes + sizeof(T));
+		}
+		std::fwrite(bytes, 1, sizeof(T), file);
+	}
+
+private:
+	std::FILE* file;
+	bool swap;
+};
+
+static void writePly(const std::string& path, const Layout& layout, int n) {
+	std::FILE* file = std::fopen(path.c_str(), "wb");
+	size_t numQuads = (size_t)(n - 1) * (n - 1);
+	std::fprintf(file, "ply\nformat %s 1.0\ncomment PlyLoaderBenchmark %s\n", layout.bigEndian ? "binary_big_endian" : "binary_little_endian", layout.name);
+	if (layout.quads) {
+		std::fprintf(file, "element vertex %d\nproperty double x\nproperty double y\nproperty double z\n"
+			"property ushort red\nproperty ushort green\nproperty ushort blue\n"
+			"element face %zu\nproperty list uint8 uint32 vertex_index\n", n * n, numQuads);
+	}
+	else {
+		std::fprintf(file, "element camera 1\nproperty float view_px\nproperty float view_py\nproperty float view_pz\n"
+			"element vertex %d\nproperty float x\nproperty float y\nproperty float z\n"
+			"property float nx\nproperty float ny\nproperty float nz\n"
+			"property uchar red\nproperty uchar green\nproperty uchar blue\nproperty uchar alpha\nproperty float quality\n"
+			"element face %zu\nproperty list uchar int vertex_indices\nproperty uchar flags\n", n * n, numQuads * 2);
+	}
+	std::fprintf(file, "end_header\n");
+
+	PlyWriter out(file, layout.bigEndian);
+	if (!layout.quads) {
+		out.put(2.0f), out.put(2.0f), out.put(8.0f);
+	}
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j < n; ++j) {
+			Vec3 v = gridVertex(n, i, j);
+			uint32_t color = IndexedMesh::packColor(gridColor(n, i, j));
+			if (layout.quads) {
+				out.put((double)v.x), out.put((double)v.y), out.put((double)v.z);
+				for (int c = 0; c < 3; ++c) {
+					out.put((uint16_t)((color >> (8 * c) & 0xff) * 257));
+				}
+			}
+			else {
+				out.put((float)v.x), out.put((float)v.y), out.put((float)v.z);
+				out.put(0.0f), out.put(1.0f), out.put(0.0f);
+				for (int c = 0; c < 3; ++c) {
+					out.put((uint8_t)(color >> (8 * c) & 0xff));
+				}
+				out.put((uint8_t)255), out.put(0.9f);
+			}
+		}
+	}
+	for (int i = 0; i + 1 < n; ++i) {
+		for (int j = 0; j + 1 < n; ++j) {
+			int32_t a = i * n + j, b = a + 1, c = a + n + 1, d = a + n;
+			if (layout.quads) {
+				out.put((uint8_t)4), out.put((uint32_t)a), out.put((uint32_t)b), out.put((uint32_t)c), out.put((uint32_t)d);
+			}
+			else {
+				out.put((uint8_t)3), out.put(a), out.put(b), out.put(c), out.put((uint8_t)0);
+				out.put((uint8_t)3), out.put(a), out.put(c), out.put(d), out.put((uint8_t)0);
+			}
+		}
+	}
+	std::fclose(file);
+}
+
+// Mismatches between the loaded mesh and the written grid, quads come back as the same two triangles
+static size_t checkMesh(const IndexedMesh& mesh, int n) {
+	size_t numQuads = (size_t)(n - 1) * (n - 1);
+	if (mesh.vertices.size() != (size_t)n * n || mesh.vertexColors.size() != (size_t)n * n || mesh.faceCount() != numQuads * 2) {
+		return 1;
+	}
+	size_t errors = 0;
+	for (int i = 0; i < n; ++i) {
+		for (int j = 0; j < n; ++j) {
+			Vec3 d = mesh.vertices[i * n + j] - gridVertex(n, i, j);
+			errors += std::abs(d.x) + std::abs(d.y) + std::abs(d.z) > 1e-5;
+			errors += mesh.vertexColors[i * n + j] != IndexedMesh::packColor(gridColor(n, i, j));
+		}
+	}
+	size_t f = 0;
+	for (int i = 0; i + 1 < n; ++i) {
+		for (int j = 0; j + 1 < n; ++j, f += 2) {
+			uint32_t a = i * n + j, b = a + 1, c = a + n + 1, d = a + n;
+			const uint32_t* t = &mesh.indices[f * 3];
+			errors += t[0] != a || t[1] != b || t[2] != c || t[3] != a || t[4] != c || t[5] != d;
+		}
+	}
+	return errors;
+}
+
+int main(int argc, char** argv) {
+	int targetTriangles = argc > 1 ? std::atoi(argv[1]) : 2000000;
+	std::filesystem::path directory = argc > 2 ? std::filesystem::path(argv[2]) : std::filesystem::temp_directory_path();
+	int n = std::max(2, (int)std::sqrt(targetTriangles / 2.0) + 1);
+
+	std::cout << 2 * (size_t)(n - 1) * (n - 1) << " triangles, " << (size_t)n * n << " vertices\n";
+	std::cout << std::left << std::setw(24) << "layout" << std::right << std::setw(10) << "file MB" << std::setw(10) << "ms"
+		<< std::setw(10) << "MB/s" << std::setw(10) << "mesh MB" << std::setw(10) << "peak MB" << std::setw(8) << "peak"
+		<< std::setw(8) << "errors" << "\n";
+
+	for (const Layout& layout : { Layout{ "scan, little endian", false, false }, Layout{ "quads, big endian", true, true } }) {
+		std::string path = (directory / "plyLoaderBenchmark.ply").string();
+		writePly(path, layout, n);
+		double fileMB = std::filesystem::file_size(path) / (1024.0 * 1024.0);
+
+		TriObj loaded;
+		PlyLoader loader;
+		bool ok = false;
+		size_t heapBefore = heapBytes;
+		heapPeak = heapBefore;
+		double ms = timeMs([&]() { ok = loader.load(path, loaded); });
+		if (!ok) {
+			std::cerr << loader.error << "\n";
+			return 1;
+		}
+
+		// Peak of what the load allocated, against the mesh it produced
+		double meshMB = loaded.mesh.memoryBytes() / (1024.0 * 1024.0);
+		double peakMB = (heapPeak - heapBefore) / (1024.0 * 1024.0);
+
+		// Geometry added after the load has to extend the vertex colors too
+		size_t errors = checkMesh(loaded.mesh, n);
+		loaded.createCube(Vec3(0, 0, 2), 0.5, Vec3(1, 0, 0));
+		errors += !loaded.mesh.consistent();
+		std::cout << std::left << std::setw(24) << layout.name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(10) << fileMB << std::setw(10) << ms << std::setw(10) << fileMB / ms * 1000.0 << std::setw(10) << meshMB
+			<< std::setw(10) << peakMB << std::setprecision(2) << std::setw(7) << peakMB / meshMB << "x" << std::setw(8)
+			<< errors << "\n";
+		std::remove(path.c_str());
+	}
+	return 0;
+}
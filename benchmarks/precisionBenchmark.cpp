@@ -0,0 +1,135 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdlib>
+
+#include "benchmarks/benchmarkUtils.h"
+
+// Throughput and image difference of the double and float render modes. The benchmark is built twice, as
+// PrecisionBenchmark and as PrecisionBenchmarkFloat with RENDER_FLOAT. Each run writes its image as precision_double.pfm
+// or precision_float.pfm and compares it to the other mode's image if that exists, so run both from the same
+// directory. The renders are noisy, so the difference between two renders of the same mode is given as noise floor.
+// Usage: PrecisionBenchmark[Float] [meshTriangles] [numRays] [imageSize] [spp]
+
+// Render on the calling thread, accumulating in double like the renderer
+static std::vector<Vec3d> renderImage(const Scene& scene, const Camera& cam, int size, int spp) {
+	Tracer tracer;
+	std::vector<Vec3d> image(size * size);
+	for (int y = 0; y < size; ++y) {
+		for (int x = 0; x < size; ++x) {
+			Vec3d sum;
+			for (const Ray& ray : cam.generateRandomViewRays(x, y, size, size, spp)) {
+				Vec3 sampleColor;
+				tracer.trace(ray, scene, sampleColor, 0, 8, ShadingMethod::MC);
+				sum += Vec3d(sampleColor);
+			}
+			image[y * size + x] = sum / (double)spp;
+		}
+	}
+	return image;
+}
+
+// Root mean square difference relative to the mean pixel value of b
+static double relativeRMSE(const std::vector<Vec3d>& a, const std::vector<Vec3d>& b) {
+	double squared = 0.0, mean = 0.0;
+	for (size_t i = 0; i < a.size(); ++i) {
+		Vec3d d = a[i] - b[i];
+		squared += d.dotProduct(d);
+		mean += b[i].x + b[i].y + b[i].z;
+	}
+	return mean > 0.0 ? std::sqrt(squared / (3.0 * a.size())) / (mean / (3.0 * a.size())) : 0.0;
+}
+
+// Portable float map, little endian, rows stored bottom to top
+static void writePFM(const std::string& filename, const std::vector<Vec3d>& image, int size) {
+	std::ofstream ofs(filename, std::ios::binary);
+	ofs << "PF\n" << size << " " << size << "\n-1.0\n";
+	for (int y = size - 1; y >= 0; --y) {
+		for (int x = 0; x < size; ++x) {
+			const Vec3d& c = image[y * size + x];
+			float rgb[3] = { (float)c.x, (float)c.y, (float)c.z };
+			ofs.write(reinterpret_cast<const char*>(rgb), sizeof(rgb));
+		}
+	}
+}
+
+static bool readPFM(const std::string& filename, std::vector<Vec3d>& image, int size) {
+	std::ifstream ifs(filename, std::ios::binary);
+	std::string magic;
+	int w = 0, h = 0;
+	double scale = 0.0;
+	if (!(ifs >> magic >> w >> h >> scale) || magic != "PF" || w != size || h != size || scale >= 0.0) {
+		return false;
+	}
+	ifs.get();
+
+	image.assign(size * size, Vec3d());
+	for (int y = size - 1; y >= 0; --y) {
+		for (int x = 0; x < size; ++x) {
+			float rgb[3];
+			if (!ifs.read(reinterpret_cast<char*>(rgb), sizeof(rgb))) {
+				return false;
+			}
+			image[y * size + x] = Vec3d(rgb[0], rgb[1], rgb[2]);
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	int meshTriangles = argc > 1 ? std::atoi(argv[1]) : 200000;
+	int numRays = argc > 2 ? std::atoi(argv[2]) : 1000000;
+	int size = argc > 3 ? std::atoi(argv[3]) : 64;
+	int spp = argc > 4 ? std::atoi(argv[4]) : 16;
+
+	const bool isFloat = sizeof(Real) == sizeof(float);
+	const std::string mode = isFloat ? "float" : "double";
+	const std::string otherMode = isFloat ? "double" : "float";
+
+	Scene scene;
+	addMeshToScene(scene, meshTriangles);
+	double buildMs = timeMs([&]() { scene.buildBVH(); });
+
+	size_t geometryBytes = 0, numTriangles = 0;
+	for (const auto& obj : scene.objs) {
+		geometryBytes += obj->mesh.memoryBytes();
+		numTriangles += obj->triangleCount();
+	}
+
+	// Random closest hit rays from inside the room
+	std::vector<Ray> rays = randomRoomRays(numRays, 11);
+
+	int hits = 0;
+	double traceMs = timeMs([&]() {
+		for (const Ray& ray : rays) {
+			SceneHit hit;
+			if (scene.intersect(ray, hit)) {
+				++hits;
+			}
+		}
+		});
+
+	Camera cam;
+	std::vector<Vec3d> image;
+	double renderMs = timeMs([&]() { image = renderImage(scene, cam, size, spp); });
+	std::vector<Vec3d> secondImage = renderImage(scene, cam, size, spp);
+
+	std::cout << mode << " mode, " << meshTriangles << " mesh triangles, image " << size << "x" << size << ", " << spp << " spp\n";
+	std::cout << std::fixed << std::setprecision(3)
+		<< "  Mesh size:         " << (double)geometryBytes / numTriangles << " bytes per triangle (" << geometryBytes / (1024.0 * 1024.0) << " MB in the scene)\n"
+		<< "  BVH build:         " << buildMs << " ms\n"
+		<< "  Random rays:       " << numRays / traceMs / 1000.0 << " Mrays/s (" << hits << " hits)\n"
+		<< "  Render:            " << (double)size * size * spp / renderMs << " Kpaths/s\n"
+		<< "  Noise floor:       " << relativeRMSE(secondImage, image) << " relative RMSE between two " << mode << " renders\n";
+
+	writePFM("precision_" + mode + ".pfm", image, size);
+
+	std::vector<Vec3d> other;
+	if (readPFM("precision_" + otherMode + ".pfm", other, size)) {
+		std::cout << "  Difference:        " << relativeRMSE(image, other) << " relative RMSE against precision_" << otherMode << ".pfm\n";
+	}
+	else {
+		std::cout << "  Run the " << otherMode << " build with the same image size to compare the images\n";
+	}
+	return 0;
+}
@@ -0,0 +1,147 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <random>
+
+#include "benchmarks/benchmarkUtils.h"
+
+// Parallelogram faces against the same faces as triangle pairs. Two scenes are tested, the Cornell box, whose walls,
+// light and cube are parallelograms, and the box with a city of boxes on its floor. Each is traced with random
+// closest-hit rays from inside the room once as built and once with every parallelogram split into two triangles,
+// reporting the memory of the objects and their BVHs, the throughput, the BVH nodes and primitive tests per ray and
+// the rays that found a different hit. The light's area sampling is checked for uniformity over its two halves.
+// Built with TRAVERSAL_STATS so the primitive tests are counted, the counters cost the same in both variants.
+// Usage: QuadBenchmark [numBoxes] [numRays]
+
+// Copy of an object with every parallelogram split into two triangles
+static std::shared_ptr<TriObj> triangulated(const TriObj& obj) {
+	std::vector<Triangle> triangles;
+	for (size_t f = 0; f < obj.triangleCount(); ++f) {
+		obj.mesh.appendTriangles(f, triangles);
+	}
+	auto copy = std::make_shared<TriObj>();
+	for (const Triangle& tri : triangles) {
+		copy->addTriangle(tri);
+	}
+	copy->setMat(obj.getMat());
+	return copy;
+}
+
+static void addBoxCity(Scene& scene, int numBoxes) {
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<double> position(0.3, 3.7), size(0.05, 0.25);
+	auto city = std::make_shared<TriObj>();
+	for (int i = 0; i < numBoxes; ++i) {
+		double length = size(rng);
+		city->createCube(Vec3(position(rng), position(rng), length / 2), length, Vec3(0.7, 0.7, 0.7));
+	}
+	city->setMat("DIFFUSE");
+	scene.addTriObj(city);
+}
+
+struct TraceResult {
+	double ms = 0.0;
+	uint64_t primitiveTests = 0;
+	uint64_t nodes = 0;
+	std::vector<SceneHit> hits;
+};
+
+static TraceResult trace(const Scene& scene, const std::vector<Ray>& rays) {
+	TraceResult result;
+	result.hits.resize(rays.size());
+	TraversalStats before = TraversalStats::local();
+	result.ms = timeMs([&]() {
+		for (size_t i = 0; i < rays.size(); ++i) {
+			scene.intersect(rays[i], result.hits[i]);
+		}
+		});
+	TraversalStats counted = TraversalStats::local() - before;
+	result.primitiveTests = counted.triangleTests;
+	result.nodes = counted.nodes;
+	return result;
+}
+
+int main(int argc, char** argv) {
+	int numBoxes = argc > 1 ? std::atoi(argv[1]) : 20000;
+	int numRays = argc > 2 ? std::atoi(argv[2]) : 500000;
+
+	std::vector<Ray> rays = randomRoomRays(numRays, 5);
+
+	std::cout << "BVH width " << BVH_WIDTH << ", " << numRays << " rays\n";
+	std::cout << std::left << std::setw(24) << "scene" << std::setw(16) << "faces" << std::right << std::setw(10) << "count"
+		<< std::setw(10) << "MB" << std::setw(10) << "Mrays/s" << std::setw(12) << "nodes/ray" << std::setw(12) << "tests/ray"
+		<< std::setw(12) << "mismatches" << "\n";
+
+	for (int boxes : { 0, numBoxes }) {
+		Scene quads, triangles;
+		if (boxes > 0) {
+			addBoxCity(quads, boxes);
+			addBoxCity(triangles, boxes);
+		}
+		for (auto& obj : triangles.objs) {
+			obj = triangulated(*obj);
+		}
+		quads.buildBVH();
+		triangles.buildBVH();
+
+		TraceResult reference = trace(triangles, rays);
+		TraceResult tested = trace(quads, rays);
+		size_t mismatches = 0;
+		for (size_t i = 0; i < rays.size(); ++i) {
+			const SceneHit& a = reference.hits[i];
+			const SceneHit& b = tested.hits[i];
+			mismatches += a.objIndex != b.objIndex || a.isSphere != b.isSphere || std::abs(a.t - b.t) > 1e-4;
+		}
+
+		std::string name = boxes > 0 ? "box city, " + std::to_string(boxes) + " boxes" : "Cornell box";
+		auto row = [&](const char* faces, const Scene& scene, const TraceResult& result, const std::string& errors) {
+			size_t count = 0, bytes = 0;
+			for (const auto& obj : scene.objs) {
+				count += obj->triangleCount();
+				bytes += obj->memoryBytes() + obj->bvh().nodes.size() * sizeof(BVHNode);
+			}
+			std::cout << std::left << std::setw(24) << name << std::setw(16) << faces << std::right << std::setw(10) << count
+				<< std::fixed << std::setprecision(2) << std::setw(10) << bytes / (1024.0 * 1024.0) << std::setw(10)
+				<< numRays / result.ms / 1000.0 << std::setw(12) << (double)result.nodes / numRays << std::setw(12)
+				<< (double)result.primitiveTests / numRays << std::setw(12) << errors << "\n";
+		};
+		row("triangle pairs", triangles, reference, "");
+		row("parallelograms", quads, tested, std::to_string(mismatches));
+	}
+
+	// Samples of the area light have to be spread evenly over it, each half of the light gets half of them
+	Scene scene;
+	scene.buildBVH();
+	const TriObj& light = *scene.lightSources.front();
+	std::mt19937 rng(5);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	int numSamples = 1000000, firstHalf = 0, outside = 0;
+	AABB lightBounds = light.bounds();
+	for (int i = 0; i < numSamples; ++i) {
+		int prim;
+		Vec3 p = light.sampleSurface(uniform(rng), uniform(rng), uniform(rng), prim);
+		firstHalf += p.x - lightBounds.min.x < p.y - lightBounds.min.y;
+		outside += p.x < lightBounds.min.x || p.x > lightBounds.max.x || p.y < lightBounds.min.y || p.y > lightBounds.max.y;
+	}
+	std::cout << "Light area " << light.surfaceArea() << ", " << numSamples << " samples, " << std::setprecision(4)
+		<< (double)firstHalf / numSamples << " in the first half, " << outside << " outside\n";
+
+	// Only the emissive faces of a light count, and an object made emissive after its build becomes one
+	TriObj panel;
+	panel.mesh.addParallelogram(Vec3(0, 0, 0), Vec3(1, 0, 0), Vec3(0, 2, 0), Vec3(1, 1, 1), panel.mesh.materialID(Materials::emissive));
+	panel.addParallelogram(Vec3(0, 0, 1), Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(1, 1, 1));
+	panel.buildBVH();
+	double faceArea = panel.surfaceArea();
+	panel.setMat(Materials::emissive);
+	std::cout << "Emissive face area " << faceArea << " of 2, after setMat " << panel.surfaceArea() << " of 3\n";
+
+	// Shadow rays pass through a glass face of an opaque object and stop at the face behind it
+	TriObj pane;
+	pane.addParallelogram(Vec3(0, 0, 0), Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(1, 1, 1));
+	pane.mesh.addParallelogram(Vec3(0, 0, 1), Vec3(1, 0, 0), Vec3(0, 1, 0), Vec3(1, 1, 1), pane.mesh.materialID(Materials::glass));
+	pane.buildBVH();
+	Ray down(Vec3(0.5, 0.5, 2.0), Vec3(0.0, 0.0, -1.0));
+	std::cout << "Shadow ray blocked by the glass face " << pane.occluded(down, 1.5) << " of 0, by the face behind it "
+		<< pane.occluded(down, 3.0) << " of 1\n";
+	return 0;
+}
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "benchmarks/benchmarkUtils.h"
+
+// Node memory and traversal throughput of the BVH layouts on large tessellated meshes. Rays start at random points in
+// the room and aim at random points on the mesh's bounding sphere, so nearly all of them traverse the mesh's tree.
+// Usage: QuantizedBenchmark [maxTriangles] [numRays]
+int main(int argc, char** argv) {
+	int maxTriangles = argc > 1 ? std::atoi(argv[1]) : 4000000;
+	int numRays = argc > 2 ? std::atoi(argv[2]) : 1000000;
+
+	struct LayoutInfo {
+		BVHLayout layout;
+		const char* name;
+		int boxesPerNode;
+	};
+	const LayoutInfo layouts[] = {
+		{ BVHLayout::Binary, "Binary", 1 },
+		{ BVHLayout::Wide, "Wide", BVH_WIDTH },
+		{ BVHLayout::Quantized16, "Quant16", BVH_WIDTH },
+		{ BVHLayout::Quantized8, "Quant8", BVH_WIDTH },
+	};
+
+	const Vec3 centre(2.0, 2.0, 2.0);
+	const double radius = 1.2;
+
+	std::vector<Ray> rays = randomRoomRays(numRays, 42, RayTarget{ centre, radius });
+
+	std::cout << "BVH width " << BVH_WIDTH << ", " << numRays << " rays\n";
+	std::cout << std::left << std::setw(12) << "triangles" << std::setw(10) << "layout" << std::right
+		<< std::setw(10) << "nodes" << std::setw(12) << "B/node" << std::setw(12) << "B/box"
+		<< std::setw(12) << "nodes MB" << std::setw(12) << "Mrays/s" << "\n";
+
+	for (int triangles = 100000; triangles <= maxTriangles; triangles *= 4) {
+		TriObj mesh;
+		mesh.createSphereMesh(centre, radius, std::max(2, (int)std::sqrt(triangles / 4.0)), Vec3(0.5, 0.5, 0.5));
+
+		for (const LayoutInfo& info : layouts) {
+			mesh.buildBVH(BVHBuilder::BinnedSAH, info.layout);
+			const BVH& bvh = mesh.bvh();
+
+			size_t numNodes = info.layout == BVHLayout::Binary ? bvh.nodes.size()
+				: info.layout == BVHLayout::Wide ? bvh.wide.nodes.size()
+				: info.layout == BVHLayout::Quantized16 ? bvh.wide16.nodes.size() : bvh.wide8.nodes.size();
+			double bytesPerNode = (double)bvh.nodeMemory() / numNodes;
+
+			int hits = 0;
+			double traceMs = timeMs([&]() {
+				for (const Ray& ray : rays) {
+					double t; Vec3 n, c;
+					if (mesh.intersect(ray, t, n, c)) {
+						++hits;
+					}
+				}
+				});
+
+			std::cout << std::left << std::setw(12) << mesh.triangleCount() << std::setw(10) << info.name << std::right
+				<< std::setw(10) << numNodes << std::fixed << std::setprecision(1)
+				<< std::setw(12) << bytesPerNode << std::setw(12) << bytesPerNode / info.boxesPerNode
+				<< std::setw(12) << bvh.nodeMemory() / (1024.0 * 1024.0)
+				<< std::setprecision(3) << std::setw(12) << numRays / traceMs / 1000.0
+				<< "  (" << hits << " hits)\n";
+		}
+	}
+	return 0;
+}
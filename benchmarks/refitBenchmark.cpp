@@ -0,0 +1,86 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "benchmarks/benchmarkUtils.h"
+
+// Animated sequence in the Cornell box, a tessellated sphere is twisted and moved across the room while the scene
+// sphere moves with it. Compares rebuilding all BVHs every frame against refitting them, where a BVH is only rebuilt
+// once its SAH cost grew past BVH::maxRefitCostGrowth.
+// Usage: RefitBenchmark [meshTriangles] [frames] [imageSize]
+
+// Twist the mesh around the vertical axis through centre, by angle radians per unit of height, and move it by offset
+static Vec3 animateVertex(const Vec3& v, const Vec3& centre, double angle, const Vec3& offset) {
+	Vec3 d = v - centre;
+	double a = angle * d.z;
+	double c = std::cos(a);
+	double s = std::sin(a);
+	return centre + Vec3(c * d.x - s * d.y, s * d.x + c * d.y, d.z) + offset;
+}
+
+int main(int argc, char** argv) {
+	int meshTriangles = argc > 1 ? std::atoi(argv[1]) : 200000;
+	int frames = argc > 2 ? std::atoi(argv[2]) : 30;
+	int size = argc > 3 ? std::atoi(argv[3]) : 32;
+
+	Camera cam;
+	const char* modes[] = { "rebuild", "refit" };
+
+	std::cout << "Image " << size << "x" << size << ", 1 spp, " << frames << " frames\n";
+	std::cout << std::left << std::setw(10) << "mode" << std::right << std::setw(14) << "update ms"
+		<< std::setw(14) << "max update" << std::setw(14) << "render ms" << std::setw(14) << "frame ms"
+		<< std::setw(10) << "rebuilds" << "\n";
+
+	for (int mode = 0; mode < 2; ++mode) {
+		Scene scene;
+		addMeshToScene(scene, meshTriangles);
+		scene.buildBVH();
+
+		TriObj& mesh = *scene.objs.back();
+		Sphere& sphere = *scene.spheres[0];
+		const MeshBuffer<Vec3> restPose = mesh.mesh.vertices;
+		const Vec3 sphereRest = sphere.centerPoint;
+		const Vec3 centre(2.5, 1.5, 1.2);
+
+		double updateTotal = 0.0, updateMax = 0.0, renderTotal = 0.0;
+		int rebuilds = 0;
+
+		for (int frame = 1; frame <= frames; ++frame) {
+			double time = (double)frame / frames;
+			double angle = 2.0 * time;
+			Vec3 offset(0.0, 1.2 * time, 0.8 * std::sin(3.14159 * time));
+
+			for (size_t i = 0; i < restPose.size(); ++i) {
+				mesh.mesh.vertices[i] = animateVertex(restPose[i], centre, angle, offset);
+			}
+			sphere.centerPoint = sphereRest - offset * 0.5;
+
+			double updateMs = timeMs([&]() {
+				if (mode == 0) {
+					scene.buildBVH();
+					++rebuilds;
+				}
+				else if (mesh.updateBVH(scene.bvhBuilder, scene.bvhLayout)) {
+					scene.updateTLAS();
+					++rebuilds;
+				}
+				else {
+					scene.updateTLAS();
+				}
+				});
+			double renderMs = timeMs([&]() { renderFrame(scene, cam, size, size, 1); });
+
+			updateTotal += updateMs;
+			updateMax = std::max(updateMax, updateMs);
+			renderTotal += renderMs;
+		}
+
+		std::cout << std::left << std::setw(10) << modes[mode] << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(14) << updateTotal / frames << std::setw(14) << updateMax
+			<< std::setw(14) << renderTotal / frames << std::setw(14) << (updateTotal + renderTotal) / frames
+			<< std::setw(10) << rebuilds << "\n";
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "benchmarks/benchmarkUtils.h"
+
+// Compares plain SAH against spatial splits (SBVH) on the Cornell box with inserted meshes. All triangles of the scene
+// are put in one BVH, in the renderer every object has its own BVH and the large wall triangles never share a tree
+// with the meshes. Two mesh sets are tested, finely tessellated spheres where all triangles are small, and a sphere
+// with a tilted panel of long thin triangles, the case spatial splits are meant for. Throughput is measured with
+// random closest-hit rays from inside the room.
+// Usage: SpatialSplitBenchmark [meshTriangles] [numRays]
+
+// Panel of long thin triangles running diagonally through the room
+static std::shared_ptr<TriObj> createSliverPanel(int numStrips) {
+	auto panel = std::make_shared<TriObj>();
+	for (int i = 0; i < numStrips; ++i) {
+		double a = 0.3 + 3.4 * i / numStrips;
+		double b = 0.3 + 3.4 * (i + 1) / numStrips;
+		Vec3 p0(a, 0.3, 0.4), p1(b, 0.3, 0.4), q0(a, 3.7, 3.0), q1(b, 3.7, 3.0);
+		panel->addTriangle(Triangle(p0, p1, q1, Vec3(0.6, 0.6, 0.6)));
+		panel->addTriangle(Triangle(p0, q1, q0, Vec3(0.6, 0.6, 0.6)));
+	}
+	return panel;
+}
+
+static void benchmarkScene(const char* name, const Scene& scene, const std::vector<Ray>& rays) {
+	std::vector<Triangle> triangles;
+	for (const auto& obj : scene.objs) {
+		for (size_t f = 0; f < obj->triangleCount(); ++f) {
+			obj->mesh.appendTriangles(f, triangles);
+		}
+	}
+
+	std::vector<AABB> triBounds;
+	triBounds.reserve(triangles.size());
+	for (const Triangle& tri : triangles) {
+		triBounds.push_back(tri.bounds());
+	}
+
+	BVH::SplitFunction splitTriangle = [&](int prim, int axis, double pos, AABB& left, AABB& right) {
+		triangles[prim].splitBounds(axis, pos, left, right);
+	};
+
+	struct BuilderInfo {
+		BVHBuilder builder;
+		const char* name;
+	};
+	const BuilderInfo builders[] = {
+		{ BVHBuilder::SAH, "SAH" },
+		{ BVHBuilder::SBVH, "SBVH" },
+	};
+
+	std::cout << "\n" << name << ", " << triangles.size() << " triangles, " << rays.size() << " random rays\n";
+	std::cout << std::left << std::setw(10) << "builder" << std::right << std::setw(12) << "build ms"
+		<< std::setw(10) << "nodes" << std::setw(12) << "refs/prim" << std::setw(12) << "SAH cost"
+		<< std::setw(12) << "trace ms" << std::setw(12) << "Mrays/s" << "\n";
+
+	for (const BuilderInfo& info : builders) {
+		BVH bvh;
+		double buildMs = timeMs([&]() { bvh.build(triBounds, info.builder, BVHLayout::Wide, splitTriangle); });
+
+		int hits = 0;
+		double traceMs = timeMs([&]() {
+			for (const Ray& ray : rays) {
+				double tClosest = std::numeric_limits<double>::infinity();
+				if (bvh.intersect(ray, tClosest, [&](int triIndex, double& tMax) {
+					double t = Triangle::RayTriangleIntersect(ray.origin, ray.direction, triangles[triIndex]);
+					if (t > 0.0 && t < tMax) {
+						tMax = t;
+						return true;
+					}
+					return false;
+					})) {
+					++hits;
+				}
+			}
+			});
+
+		std::cout << std::left << std::setw(10) << info.name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(12) << buildMs << std::setw(10) << bvh.nodes.size()
+			<< std::setprecision(3) << std::setw(12) << (double)bvh.primIndices.size() / triangles.size()
+			<< std::setprecision(2) << std::setw(12) << bvh.sahCost()
+			<< std::setprecision(1) << std::setw(12) << traceMs
+			<< std::setprecision(3) << std::setw(12) << rays.size() / traceMs / 1000.0
+			<< "  (" << hits << " hits)\n";
+	}
+}
+
+int main(int argc, char** argv) {
+	int meshTriangles = argc > 1 ? std::atoi(argv[1]) : 100000;
+	int numRays = argc > 2 ? std::atoi(argv[2]) : 1000000;
+
+	std::vector<Ray> rays = randomRoomRays(numRays, 1234);
+
+	{
+		Scene scene;
+		addMeshToScene(scene, meshTriangles);
+		auto mesh = std::make_shared<TriObj>();
+		mesh->createSphereMesh(Vec3(1.2, 2.8, 0.8), 0.8, std::max(2, (int)std::sqrt(meshTriangles / 4.0)), Vec3(0.5, 0.6, 0.7));
+		scene.addTriObj(mesh);
+		benchmarkScene("Sphere meshes", scene, rays);
+	}
+	{
+		Scene scene;
+		addMeshToScene(scene, meshTriangles);
+		scene.addTriObj(createSliverPanel(1000));
+		benchmarkScene("Sphere mesh and sliver panel", scene, rays);
+	}
+	return 0;
+}
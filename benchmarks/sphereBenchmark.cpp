@@ -0,0 +1,116 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <random>
+
+#include "benchmarks/benchmarkUtils.h"
+
+// Particle stress test, the Cornell box filled with up to maxSpheres small spheres spread through the room. Compares
+// the packed sphere kernel in Scene::intersect and Scene::occluded against testing the same top-level BVH one Sphere
+// at a time, as before the packed store, for random closest-hit rays and shadow rays between random points.
+// Usage: SphereBenchmark [maxSpheres] [numRays]
+
+// Closest hit through the top-level BVH with one RaySphereIntersection per sphere reference
+static bool intersectScalar(const Scene& scene, const Ray& ray, double& tHit) {
+	int numObjs = (int)scene.objs.size();
+	tHit = std::numeric_limits<double>::infinity();
+	return scene.tlas.intersect(ray, tHit, [&](int prim, double& tMax) {
+		if (prim < numObjs) {
+			PackedTriangles::Hit hit;
+			return scene.objs[prim]->intersect(ray, tMax, hit);
+		}
+		double t = scene.spheres[prim - numObjs]->RaySphereIntersection(ray);
+		if (t > 0.0 && t < tMax) {
+			tMax = t;
+			return true;
+		}
+		return false;
+		});
+}
+
+static bool occludedScalar(const Scene& scene, const Ray& ray, double tMax) {
+	int numObjs = (int)scene.objs.size();
+	return scene.tlas.occluded(ray, tMax, [&](int prim) {
+		if (prim < numObjs) {
+			return !scene.objs[prim]->isTransparent() && scene.objs[prim]->occluded(ray, tMax);
+		}
+		const Sphere& sphere = *scene.spheres[prim - numObjs];
+		double t = sphere.RaySphereIntersection(ray);
+		return !sphere.isTransparent() && t > 0.0 && t < tMax;
+		});
+}
+
+int main(int argc, char** argv) {
+	int maxSpheres = argc > 1 ? std::atoi(argv[1]) : 100000;
+	int numRays = argc > 2 ? std::atoi(argv[2]) : 500000;
+
+	std::vector<Ray> rays = randomRoomRays(numRays, 5);
+
+	// Shadow rays between random points, and the sphere positions
+	std::mt19937 rng(6);
+	std::uniform_real_distribution<double> position(0.05, 3.95);
+	std::vector<std::pair<Ray, double>> shadowRays;
+	shadowRays.reserve(numRays);
+	for (int i = 0; i < numRays; ++i) {
+		Vec3 from(position(rng), position(rng), position(rng)), to(position(rng), position(rng), position(rng));
+		shadowRays.emplace_back(Ray(from, to - from), (to - from).getLength());
+	}
+
+	std::cout << PackedSpheres::laneWidth << " lane kernel, BVH width " << BVH_WIDTH << ", " << numRays << " rays\n";
+	std::cout << std::left << std::setw(10) << "spheres" << std::right << std::setw(12) << "packed MB"
+		<< std::setw(16) << "scalar Mrays/s" << std::setw(16) << "packed Mrays/s" << std::setw(10) << "speedup"
+		<< std::setw(16) << "scalar shadow" << std::setw(16) << "packed shadow" << std::setw(10) << "speedup"
+		<< std::setw(12) << "mismatches" << "\n";
+
+	for (int numSpheres = 1000; numSpheres <= maxSpheres; numSpheres *= 10) {
+		Scene scene;
+		const double radius = 0.3 / std::cbrt((double)numSpheres);
+		for (int i = 0; i < numSpheres; ++i) {
+			Vec3 p(position(rng), position(rng), position(rng));
+			scene.addSphere(std::make_shared<Sphere>(p, radius, Vec3(0.6, 0.6, 0.6), i % 10 == 0 ? "GLASS" : "DIFFUSE"));
+		}
+		scene.buildBVH();
+
+		std::vector<double> scalarT(rays.size()), packedT(rays.size());
+		double scalarMs = timeMs([&]() {
+			for (size_t i = 0; i < rays.size(); ++i) {
+				intersectScalar(scene, rays[i], scalarT[i]);
+			}
+			});
+		double packedMs = timeMs([&]() {
+			for (size_t i = 0; i < rays.size(); ++i) {
+				SceneHit hit;
+				scene.intersect(rays[i], hit);
+				packedT[i] = hit.t;
+			}
+			});
+
+		int scalarBlocked = 0, packedBlocked = 0;
+		double scalarShadowMs = timeMs([&]() {
+			for (const auto& s : shadowRays) {
+				scalarBlocked += occludedScalar(scene, s.first, s.second);
+			}
+			});
+		double packedShadowMs = timeMs([&]() {
+			for (const auto& s : shadowRays) {
+				packedBlocked += scene.occluded(s.first, s.second);
+			}
+			});
+
+		// Single precision only decides which sphere is hit, the final distance is exact, so count changed hits
+		int mismatches = std::abs(scalarBlocked - packedBlocked);
+		for (size_t i = 0; i < rays.size(); ++i) {
+			if (std::abs(scalarT[i] - packedT[i]) > 1e-9 * std::max(1.0, scalarT[i])) {
+				++mismatches;
+			}
+		}
+
+		std::cout << std::left << std::setw(10) << numSpheres << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(12) << scene.packedSpheres.memoryBytes() / (1024.0 * 1024.0)
+			<< std::setw(16) << numRays / scalarMs / 1000.0 << std::setw(16) << numRays / packedMs / 1000.0
+			<< std::setprecision(2) << std::setw(10) << scalarMs / packedMs << std::setprecision(3)
+			<< std::setw(16) << numRays / scalarShadowMs / 1000.0 << std::setw(16) << numRays / packedShadowMs / 1000.0
+			<< std::setprecision(2) << std::setw(10) << scalarShadowMs / packedShadowMs << std::setw(12) << mismatches << "\n";
+	}
+	return 0;
+}
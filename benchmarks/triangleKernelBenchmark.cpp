@@ -0,0 +1,101 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "benchmarks/benchmarkUtils.h"
+
+// Closest hit throughput of the packed leaf kernel against the scalar double precision Triangle::RayTriangleIntersect
+// over the same BVH. Rays start at random points in the room and aim at the mesh, as in QuantizedBenchmark. The
+// mesh is closed, so a ray the reference hits but the packed kernel misses went through a crack between triangles,
+// the benchmark fails if there is any. Rays that only the packed kernel hits graze the silhouette, rays with a
+// different distance took the neighbouring triangle at an edge or start on the surface, closer to it than single
+// precision resolves
+// Usage: TriangleKernelBenchmark [maxTriangles] [numRays]
+int main(int argc, char** argv) {
+	int maxTriangles = argc > 1 ? std::atoi(argv[1]) : 1600000;
+	int numRays = argc > 2 ? std::atoi(argv[2]) : 1000000;
+
+	const Vec3 centre(2.0, 2.0, 2.0);
+	const double radius = 1.2;
+
+	std::vector<Ray> rays = randomRoomRays(numRays, 42, RayTarget{ centre, radius });
+
+	std::cout << PackedTriangles::laneWidth << " lane kernel, BVH width " << BVH_WIDTH << ", " << numRays << " rays\n";
+	std::cout << std::left << std::setw(12) << "triangles" << std::right << std::setw(16) << "scalar Mrays/s"
+		<< std::setw(16) << "packed Mrays/s" << std::setw(10) << "speedup" << std::setw(12) << "lost hits" << std::setw(12)
+		<< "extra hits" << std::setw(12) << "other hit" << "\n";
+
+	size_t totalLost = 0;
+
+	for (int triangles = 100000; triangles <= maxTriangles; triangles *= 4) {
+		TriObj mesh;
+		mesh.createSphereMesh(centre, radius, std::max(2, (int)std::sqrt(triangles / 4.0)), Vec3(0.5, 0.5, 0.5));
+		mesh.buildBVH(BVHBuilder::BinnedSAH, BVHLayout::Wide);
+
+		// The scalar test gets a tree built for one triangle per test, the packed kernel the object's own tree with
+		// leaves filled to its lane width
+		BVH bvh;
+		bvh.build(mesh.mesh.faceBounds(), BVHBuilder::BinnedSAH, BVHLayout::Wide);
+
+		// Reference, one double precision test per triangle as before the packed store
+		std::vector<Triangle> reference;
+		for (size_t f = 0; f < mesh.triangleCount(); ++f) {
+			reference.push_back(mesh.mesh.triangle(f));
+		}
+		std::vector<double> scalarT(rays.size(), -1.0);
+		double scalarMs = timeMs([&]() {
+			for (size_t i = 0; i < rays.size(); ++i) {
+				const Ray& ray = rays[i];
+				double tClosest = std::numeric_limits<double>::infinity();
+				if (bvh.intersect(ray, tClosest, [&](int triIndex, double& tMax) {
+					double t = Triangle::RayTriangleIntersect(ray.origin, ray.direction, reference[triIndex]);
+					if (t > 0.0 && t < tMax) {
+						tMax = t;
+						return true;
+					}
+					return false;
+					})) {
+					scalarT[i] = tClosest;
+				}
+			}
+			});
+
+		std::vector<double> packedT(rays.size(), -1.0);
+		double packedMs = timeMs([&]() {
+			for (size_t i = 0; i < rays.size(); ++i) {
+				double t; Vec3 n, c;
+				if (mesh.intersect(rays[i], t, n, c)) {
+					packedT[i] = t;
+				}
+			}
+			});
+
+		// Single precision distances differ slightly (about 1e-7 in the room), only count rays whose hit changed. A hit
+		// closer to the origin than originResolution can't be told from the origin in single precision
+		const double originResolution = 1e-5;
+		size_t lost = 0, extra = 0, other = 0;
+		for (size_t i = 0; i < rays.size(); ++i) {
+			if (scalarT[i] > originResolution && packedT[i] <= 0.0) {
+				++lost;
+			}
+			else if (scalarT[i] <= 0.0 && packedT[i] > 0.0) {
+				++extra;
+			}
+			else if (std::abs(scalarT[i] - packedT[i]) > 1e-5 + 1e-4 * std::abs(scalarT[i])) {
+				++other;
+			}
+		}
+		totalLost += lost;
+
+		std::cout << std::left << std::setw(12) << mesh.triangleCount() << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(16) << numRays / scalarMs / 1000.0 << std::setw(16) << numRays / packedMs / 1000.0
+			<< std::setprecision(2) << std::setw(10) << scalarMs / packedMs << std::setw(12) << lost << std::setw(12) << extra
+			<< std::setw(12) << other << "\n";
+	}
+
+	if (totalLost > 0) {
+		std::cerr << totalLost << " rays went through cracks the reference doesn't have\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "benchmarks/benchmarkUtils.h"
+
+// Throughput of the hot paths that use ShadeVec3. The benchmark is built twice, as Vec3Benchmark with the SIMD vector
+// and as Vec3BenchmarkScalar with VEC3_SCALAR, which puts the plain Vec3 back, so run both and compare the rows.
+// Camera rays times Camera::generateRandomViewRays over a frame, MC shading traces those rays through the empty room
+// so the time is dominated by the hemisphere sampler and the light combination rather than by traversal. Vector ops is
+// the image plane and basis math of both without the random number generation, its checksum should match between
+// the two builds up to rounding.
+// Usage: Vec3Benchmark[Scalar] [imageSize] [spp]
+int main(int argc, char** argv) {
+	int size = argc > 1 ? std::atoi(argv[1]) : 256;
+	int spp = argc > 2 ? std::atoi(argv[2]) : 16;
+
+	const bool isSIMD = sizeof(ShadeVec3) != sizeof(Vec3);
+	std::cout << (isSIMD ? "SIMD" : "scalar") << " shading vector (" << sizeof(ShadeVec3) << " bytes), "
+		<< (sizeof(Real) == sizeof(float) ? "float" : "double") << " mode, image " << size << "x" << size << ", "
+		<< spp << " spp\n";
+
+	Scene scene;
+	scene.buildBVH();
+	Camera cam;
+
+	// Camera rays, kept so the shading pass traces the same rays
+	std::vector<Ray> cameraRays;
+	cameraRays.reserve((size_t)size * size * spp);
+	double cameraMs = timeMs([&]() {
+		for (int y = 0; y < size; ++y) {
+			for (int x = 0; x < size; ++x) {
+				for (const Ray& ray : cam.generateRandomViewRays(x, y, size, size, spp)) {
+					cameraRays.push_back(ray);
+				}
+			}
+		}
+		});
+
+	Tracer tracer;
+	double shadeMs = timeMs([&]() {
+		for (const Ray& ray : cameraRays) {
+			Vec3 sampleColor;
+			tracer.trace(ray, scene, sampleColor, 0, 8, ShadingMethod::MC);
+		}
+		});
+
+	// Image plane point, direction and tangent frame per sample, the vector part of the two paths above
+	const ShadeVec3 lowerLeft(cam.ll), eye(cam.eyePos);
+	const ShadeVec3 horizontal = ShadeVec3(cam.lr) - lowerLeft;
+	const ShadeVec3 vertical = ShadeVec3(cam.ul) - lowerLeft;
+	const ShadeVec3 up(0.0, 1.0, 0.0);
+	const long long samples = (long long)size * size * spp;
+	ShadeVec3 checksum;
+	double opsMs = timeMs([&]() {
+		for (long long i = 0; i < samples; ++i) {
+			Real u = (Real)(i % 997) / 997, v = (Real)(i % 991) / 991;
+			ShadeVec3 dir = (lowerLeft + horizontal * u + vertical * v - eye).normalize();
+			ShadeVec3 tangent = up.crossProduct(dir).normalize();
+			ShadeVec3 bitangent = dir.crossProduct(tangent);
+			checksum += (tangent * u + bitangent * v + dir * dir.dotProduct(up)).normalize();
+		}
+		});
+
+	std::cout << std::fixed << std::setprecision(3)
+		<< "  Camera rays:       " << samples / cameraMs / 1000.0 << " Mrays/s\n"
+		<< "  MC shading:        " << samples / shadeMs / 1000.0 << " Mpaths/s\n"
+		<< "  Vector ops:        " << samples / opsMs / 1000.0 << " Msamples/s (checksum "
+		<< checksum.x + checksum.y + checksum.z << ")\n";
+	return 0;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "vec3.h"
+
+#include <algorithm>
+#include <limits>
+
+/// Axis aligned bounding box, used by the acceleration structures to bound scene geometry
+struct AABB {
+	Vec3 min, max;
+
+	// Constructor creates an empty (inverted) box that grows when points or boxes are added
+	AABB() {
+		const double inf = std::numeric_limits<double>::infinity();
+		min = Vec3(inf, inf, inf);
+		max = Vec3(-inf, -inf, -inf);
+	}
+	AABB(const Vec3& mn, const Vec3& mx) : min(mn), max(mx) {}
+
+	// Grow the box to include a point
+	void expand(const Vec3& p) {
+		min = Vec3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+		max = Vec3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+	}
+
+	// Grow the box to include another box
+	void expand(const AABB& b) {
+		min = Vec3(std::min(min.x, b.min.x), std::min(min.y, b.min.y), std::min(min.z, b.min.z));
+		max = Vec3(std::max(max.x, b.max.x), std::max(max.y, b.max.y), std::max(max.z, b.max.z));
+	}
+
+	// Overlap of the two boxes, empty if they don't overlap
+	AABB overlap(const AABB& b) const {
+		return AABB(Vec3(std::max(min.x, b.min.x), std::max(min.y, b.min.y), std::max(min.z, b.min.z)),
+			Vec3(std::min(max.x, b.max.x), std::min(max.y, b.max.y), std::min(max.z, b.max.z)));
+	}
+
+	bool isEmpty() const {
+		return min.x > max.x || min.y > max.y || min.z > max.z;
+	}
+
+	Vec3 centroid() const {
+		return (min + max) * 0.5;
+	}
+
+	Vec3 extent() const {
+		return max - min;
+	}
+
+	// Surface area, the measure used by the surface area heuristic (SAH)
+	double surfaceArea() const {
+		if (isEmpty()) {
+			return 0.0;
+		}
+		Vec3 e = extent();
+		return 2.0 * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
+	// Index of the axis with the largest extent, 0 = x, 1 = y, 2 = z
+	int longestAxis() const {
+		Vec3 e = extent();
+		if (e.x > e.y && e.x > e.z) return 0;
+		return e.y > e.z ? 1 : 2;
+	}
+
+	/// Slab test, invDir is the componentwise inverse of the ray direction. tEntry is the distance where the ray
+	/// enters the box. The slab distances are passed as second argument to min/max so NaNs (0 * inf) are ignored
+	bool intersect(const Vec3& origin, const Vec3& invDir, double tMax, double& tEntry) const {
+		double tNear = -std::numeric_limits<double>::infinity();
+		double tFar = tMax;
+
+		double tx0 = (min.x - origin.x) * invDir.x;
+		double tx1 = (max.x - origin.x) * invDir.x;
+		tNear = std::max(tNear, std::min(tx0, tx1));
+		tFar = std::min(tFar, std::max(tx0, tx1));
+
+		double ty0 = (min.y - origin.y) * invDir.y;
+		double ty1 = (max.y - origin.y) * invDir.y;
+		tNear = std::max(tNear, std::min(ty0, ty1));
+		tFar = std::min(tFar, std::max(ty0, ty1));
+
+		double tz0 = (min.z - origin.z) * invDir.z;
+		double tz1 = (max.z - origin.z) * invDir.z;
+		tNear = std::max(tNear, std::min(tz0, tz1));
+		tFar = std::min(tFar, std::max(tz0, tz1));
+
+		tEntry = tNear;
+		return tNear <= tFar && tFar > 0.0;
+	}
+};
+
+// Get a vector component by axis index, 0 = x, 1 = y, 2 = z
+inline double axisValue(const Vec3& v, int axis) {
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
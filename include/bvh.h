@@ -0,0 +1,1068 @@
+#pragma once
+
+#include "aabb.h"
+#include "ray.h"
+#include "wideBVH.h"
+#include "traversalStats.h"
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <functional>
+
+/// Memory layout used for traversal. Binary traverses the BVH nodes directly, Wide collapses them into BVH_WIDTH-ary
+/// nodes whose children are slab tested together with SIMD. The quantized layouts are wide nodes with the child
+/// bounds stored in 16 or 8 bits relative to the node, for meshes whose tree doesn't fit in cache otherwise
+enum class BVHLayout {
+	Binary,
+	Wide,
+	Quantized16,
+	Quantized8
+};
+
+/// Node of a binary bounding volume hierarchy. Leaves (count > 0) reference primitives [leftFirst, leftFirst + count)
+/// in BVH::primIndices, interior nodes store their two children at leftFirst and leftFirst + 1
+struct BVHNode {
+	AABB bounds;
+	int leftFirst = 0;
+	int count = 0;
+
+	bool isLeaf() const {
+		return count > 0;
+	}
+};
+
+/// Available BVH build algorithms. SAH evaluates every split candidate on a single thread, BinnedSAH evaluates a fixed
+/// number of bins per axis and builds large subtrees on worker threads. LBVH sorts primitives along a Morton curve
+/// and builds in linear time, much faster to build but with a lower quality tree, meant for per-frame rebuilds.
+/// SBVH adds spatial splits to SAH, large primitives are clipped at the split plane and referenced from both children
+enum class BVHBuilder {
+	SAH,
+	BinnedSAH,
+	LBVH,
+	SBVH
+};
+
+/// Bounding volume hierarchy built over primitive bounding boxes with the surface area heuristic (SAH). The BVH only
+/// knows primitive indices, the intersection of the primitives themselves is done by the caller in a leaf callback
+class BVH {
+public:
+	std::vector<BVHNode> nodes;
+	std::vector<int> primIndices;
+
+	// Wide copy of the nodes, only built for BVHLayout::Wide. The binary nodes are kept for refits and statistics
+	WideBVH<BVH_WIDTH> wide;
+
+	// Quantized wide copies for the BVHLayout::Quantized16 and Quantized8 layouts
+	WideBVH<BVH_WIDTH, uint16_t> wide16;
+	WideBVH<BVH_WIDTH, uint8_t> wide8;
+
+	// SAH cost of the tree right after it was built or loaded, refits are measured against it
+	double builtCost = 0.0;
+
+	// SAH cost constants, relative cost of visiting a node and testing a primitive
+	static constexpr double traversalCost = 1.0;
+	static constexpr double intersectionCost = 1.0;
+
+	// Leaves are never larger than this, even if SAH would prefer it
+	static constexpr int maxLeafSize = 8;
+
+	// Primitives a leaf test handles at once, the SAH charges intersectionCost per started batch. Set it to the lane
+	// width before building a tree whose leaves go through a packed SIMD kernel, so the builder makes fuller leaves
+	int leafBatchSize = 1;
+
+	// Past this depth the builder falls back to median splits, which keeps the tree depth and traversal stack bounded
+	static constexpr int maxSAHDepth = 64;
+	static constexpr int maxStackSize = 128;
+
+	// Number of bins per axis for the binned builder
+	static constexpr int numBins = 16;
+
+	// Subtrees with more primitives than this are handed to a new worker thread by the binned builder
+	static constexpr int parallelThreshold = 4096;
+
+	// Leaf size of the LBVH builder, which has no cost model to decide when to stop splitting
+	static constexpr int lbvhLeafSize = 4;
+
+	// Spatial splits are only tried where the children of the best object split overlap by more than this fraction of
+	// the root surface area, and only while the number of primitive references is within the memory budget, given as
+	// allowed growth over the primitive count
+	static constexpr double spatialSplitAlpha = 1e-5;
+	static constexpr double spatialSplitBudget = 0.3;
+
+	// A refitted tree whose SAH cost grew by more than this factor over the built tree should be rebuilt
+	static constexpr double maxRefitCostGrowth = 1.5;
+
+	/// Splits primitive prim at the plane pos along axis and returns the bounds of the parts on each side
+	using SplitFunction = std::function<void(int prim, int axis, double pos, AABB& left, AABB& right)>;
+
+	// Build the hierarchy from one bounding box per primitive. The SBVH builder needs splitPrim to clip primitives,
+	// without it only object splits are made. With spatial splits a primitive can be referenced by several leaves
+	void build(const std::vector<AABB>& primBounds, BVHBuilder builder = BVHBuilder::SAH,
+		BVHLayout layout = BVHLayout::Binary, const SplitFunction& splitPrim = nullptr) {
+		buildBinary(primBounds, builder, splitPrim);
+		setLayout(layout);
+		builtCost = sahCost();
+	}
+
+	// Update the node bounds after the primitives moved, the topology stays the same so this is linear in the node
+	// count. primBounds has to hold the same primitives the tree was built from. Returns the SAH cost growth over
+	// the built tree, the caller rebuilds once it passes maxRefitCostGrowth
+	double refit(const std::vector<AABB>& primBounds) {
+		if (nodes.empty()) {
+			return 1.0;
+		}
+
+		// Children are stored after their parent, so a reverse sweep visits them first
+		for (int i = (int)nodes.size() - 1; i >= 0; --i) {
+			BVHNode& node = nodes[i];
+			AABB box;
+			if (node.isLeaf()) {
+				for (int j = node.leftFirst; j < node.leftFirst + node.count; ++j) {
+					box.expand(primBounds[primIndices[j]]);
+				}
+			}
+			else {
+				box.expand(nodes[node.leftFirst].bounds);
+				box.expand(nodes[node.leftFirst + 1].bounds);
+			}
+			node.bounds = box;
+		}
+
+		if (!wide.empty()) {
+			wide.refit(primIndices, primBounds);
+		}
+		if (!wide16.empty()) {
+			wide16.refit(primIndices, primBounds);
+		}
+		if (!wide8.empty()) {
+			wide8.refit(primIndices, primBounds);
+		}
+
+		return builtCost > 0.0 ? sahCost() / builtCost : 1.0;
+	}
+
+	// Create or drop the wide copies of the binary nodes, used after the nodes were built, loaded or refitted
+	void setLayout(BVHLayout layout) {
+		wide.clear();
+		wide16.clear();
+		wide8.clear();
+
+		if (layout == BVHLayout::Wide) {
+			wide.collapse(nodes);
+		}
+		else if (layout == BVHLayout::Quantized16) {
+			wide16.collapse(nodes);
+		}
+		else if (layout == BVHLayout::Quantized8) {
+			wide8.collapse(nodes);
+		}
+	}
+
+	// Bytes of the nodes traversed in the current layout, the binary nodes are counted for the binary layout only
+	size_t nodeMemory() const {
+		if (!wide.empty()) return wide.memoryBytes();
+		if (!wide16.empty()) return wide16.memoryBytes();
+		if (!wide8.empty()) return wide8.memoryBytes();
+		return nodes.size() * sizeof(BVHNode);
+	}
+
+	bool empty() const {
+		return nodes.empty();
+	}
+
+	// SAH cost of testing a leaf of count primitives
+	double leafCost(int count) const {
+		return intersectionCost * ((count + leafBatchSize - 1) / leafBatchSize);
+	}
+
+	// Expected cost of a ray traversing the tree according to the SAH, the node surface areas relative to the root
+	// are the probabilities of a random ray hitting them
+	double sahCost() const {
+		if (nodes.empty()) {
+			return 0.0;
+		}
+
+		double rootArea = nodes[0].bounds.surfaceArea();
+		if (rootArea <= 0.0) {
+			return leafCost(nodes[0].count);
+		}
+
+		double cost = 0.0;
+		for (const BVHNode& node : nodes) {
+			double probability = node.bounds.surfaceArea() / rootArea;
+			cost += node.isLeaf() ? probability * leafCost(node.count) : probability * traversalCost;
+		}
+		return cost;
+	}
+
+	/// Closest hit traversal. leafTest(primIndex, tMax) is called for every primitive in a visited leaf and returns
+	/// true if it found a hit closer than tMax, in which case it must also shrink tMax to the new hit distance.
+	/// Children are visited near to far so distant subtrees get culled by the shrinking tMax
+	template<typename LeafTest>
+	bool intersect(const Ray& ray, double& tMax, LeafTest&& leafTest) const {
+		return intersectLeaves(ray, tMax, [&](int first, int count, double& leafTMax) {
+			bool hit = false;
+			for (int i = first; i < first + count; ++i) {
+				if (leafTest(primIndices[i], leafTMax)) {
+					hit = true;
+				}
+			}
+			return hit;
+			});
+	}
+
+	/// Any hit traversal for occlusion queries, stops as soon as anyHit(primIndex) reports a primitive blocking the
+	/// ray before tMax. Nothing is sorted and no hit data is kept
+	template<typename AnyHitTest>
+	bool occluded(const Ray& ray, double tMax, AnyHitTest&& anyHit) const {
+		return occludedLeaves(ray, tMax, [&](int first, int count) {
+			for (int i = first; i < first + count; ++i) {
+				if (anyHit(primIndices[i])) {
+					return true;
+				}
+			}
+			return false;
+			});
+	}
+
+	/// Closest hit traversal that hands whole leaves to the caller, for callers that test the primitives of a leaf
+	/// together. leafTest(first, count, tMax) covers primIndices[first, first + count) and has the same contract as
+	/// the leafTest of intersect
+	template<typename LeafTest>
+	bool intersectLeaves(const Ray& ray, double& tMax, LeafTest&& leafTest) const {
+		if (!wide.empty()) {
+			return wide.intersect(ray, tMax, leafTest);
+		}
+		if (!wide16.empty()) {
+			return wide16.intersect(ray, tMax, leafTest);
+		}
+		if (!wide8.empty()) {
+			return wide8.intersect(ray, tMax, leafTest);
+		}
+		if (nodes.empty()) {
+			return false;
+		}
+
+		Vec3 invDir(1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z);
+
+		double tEntry;
+		if (!nodes[0].bounds.intersect(ray.origin, invDir, tMax, tEntry)) {
+			return false;
+		}
+
+		bool hit = false;
+
+		// Explicit stack of nodes still to visit
+		int stack[maxStackSize];
+		int stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize > 0) {
+			const BVHNode& node = nodes[stack[--stackSize]];
+			TRAVERSAL_STAT(nodes);
+
+			if (node.isLeaf()) {
+				if (leafTest(node.leftFirst, node.count, tMax)) {
+					hit = true;
+				}
+				continue;
+			}
+
+			// Test both children, tMax may have shrunk since the parent was pushed
+			int left = node.leftFirst;
+			int right = node.leftFirst + 1;
+			double tLeft, tRight;
+			bool hitLeft = nodes[left].bounds.intersect(ray.origin, invDir, tMax, tLeft);
+			bool hitRight = nodes[right].bounds.intersect(ray.origin, invDir, tMax, tRight);
+
+			// Push the far child first so the near child is popped first
+			if (hitLeft && hitRight) {
+				if (tLeft > tRight) {
+					std::swap(left, right);
+				}
+				stack[stackSize++] = right;
+				stack[stackSize++] = left;
+			}
+			else if (hitLeft) {
+				stack[stackSize++] = left;
+			}
+			else if (hitRight) {
+				stack[stackSize++] = right;
+			}
+		}
+
+		return hit;
+	}
+
+	/// Any hit traversal over whole leaves, anyHit(first, count) returns true if one of primIndices[first, first +
+	/// count) blocks the ray before tMax
+	template<typename AnyHitTest>
+	bool occludedLeaves(const Ray& ray, double tMax, AnyHitTest&& anyHit) const {
+		if (!wide.empty()) {
+			return wide.occluded(ray, tMax, anyHit);
+		}
+		if (!wide16.empty()) {
+			return wide16.occluded(ray, tMax, anyHit);
+		}
+		if (!wide8.empty()) {
+			return wide8.occluded(ray, tMax, anyHit);
+		}
+		if (nodes.empty()) {
+			return false;
+		}
+
+		Vec3 invDir(1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z);
+
+		int stack[maxStackSize];
+		int stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize > 0) {
+			const BVHNode& node = nodes[stack[--stackSize]];
+			TRAVERSAL_STAT(nodes);
+
+			double tEntry;
+			if (!node.bounds.intersect(ray.origin, invDir, tMax, tEntry)) {
+				continue;
+			}
+
+			if (node.isLeaf()) {
+				if (anyHit(node.leftFirst, node.count)) {
+					return true;
+				}
+				continue;
+			}
+
+			stack[stackSize++] = node.leftFirst + 1;
+			stack[stackSize++] = node.leftFirst;
+		}
+
+		return false;
+	}
+
+private:
+	void buildBinary(const std::vector<AABB>& primBounds, BVHBuilder builder, const SplitFunction& splitPrim) {
+		nodes.clear();
+		primIndices.clear();
+
+		if (primBounds.empty()) {
+			return;
+		}
+
+		int n = (int)primBounds.size();
+		primIndices.resize(n);
+		std::vector<Vec3> centroids(n);
+		for (int i = 0; i < n; ++i) {
+			primIndices[i] = i;
+			centroids[i] = primBounds[i].centroid();
+		}
+
+		if (builder == BVHBuilder::BinnedSAH) {
+			buildBinned(primBounds, centroids);
+			return;
+		}
+		if (builder == BVHBuilder::LBVH) {
+			buildLinear(primBounds, centroids);
+			return;
+		}
+		if (builder == BVHBuilder::SBVH) {
+			buildSpatial(primBounds, splitPrim);
+			return;
+		}
+
+		// A binary tree with n leaves has at most 2n - 1 nodes
+		nodes.reserve(2 * n - 1);
+		nodes.emplace_back();
+		nodes[0].leftFirst = 0;
+		nodes[0].count = n;
+		updateNodeBounds(0, primBounds);
+		subdivide(0, primBounds, centroids, 0);
+		nodes.shrink_to_fit();
+	}
+
+	void updateNodeBounds(int nodeIdx, const std::vector<AABB>& primBounds) {
+		BVHNode& node = nodes[nodeIdx];
+		node.bounds = AABB();
+		for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i) {
+			node.bounds.expand(primBounds[primIndices[i]]);
+		}
+	}
+
+	// Full SAH sweep, evaluates a split between every pair of neighbouring primitives along all three axes.
+	// Returns the best cost and writes the split axis and the number of primitives going to the left child
+	double findBestSplit(const BVHNode& node, const std::vector<AABB>& primBounds, const std::vector<Vec3>& centroids,
+		int& bestAxis, int& bestLeftCount) {
+		int n = node.count;
+		double bestCost = std::numeric_limits<double>::infinity();
+		double parentArea = node.bounds.surfaceArea();
+
+		std::vector<int> sorted(primIndices.begin() + node.leftFirst, primIndices.begin() + node.leftFirst + n);
+		std::vector<double> rightAreas(n);
+
+		for (int axis = 0; axis < 3; ++axis) {
+			std::sort(sorted.begin(), sorted.end(), [&](int a, int b) {
+				return axisValue(centroids[a], axis) < axisValue(centroids[b], axis);
+				});
+
+			// Sweep from the right to get the area of every possible right side
+			AABB rightBox;
+			for (int i = n - 1; i > 0; --i) {
+				rightBox.expand(primBounds[sorted[i]]);
+				rightAreas[i] = rightBox.surfaceArea();
+			}
+
+			// Sweep from the left and evaluate the SAH cost of each split
+			AABB leftBox;
+			for (int i = 0; i < n - 1; ++i) {
+				leftBox.expand(primBounds[sorted[i]]);
+				int leftCount = i + 1;
+				double cost = traversalCost + (leftBox.surfaceArea() * leafCost(leftCount) +
+					rightAreas[i + 1] * leafCost(n - leftCount)) / parentArea;
+
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestLeftCount = leftCount;
+				}
+			}
+		}
+		return bestCost;
+	}
+
+	void subdivide(int nodeIdx, const std::vector<AABB>& primBounds, const std::vector<Vec3>& centroids, int depth) {
+		int first = nodes[nodeIdx].leftFirst;
+		int count = nodes[nodeIdx].count;
+
+		if (count <= 1) {
+			return;
+		}
+
+		// Degenerate (flat or empty) parents have no area to divide, keep them as leaves if they fit
+		if (nodes[nodeIdx].bounds.surfaceArea() <= 0.0 && count <= maxLeafSize) {
+			return;
+		}
+
+		int axis = nodes[nodeIdx].bounds.longestAxis();
+		int leftCount = count / 2;
+
+		if (depth < maxSAHDepth) {
+			double splitCost = findBestSplit(nodes[nodeIdx], primBounds, centroids, axis, leftCount);
+			if (splitCost >= leafCost(count) && count <= maxLeafSize) {
+				return;
+			}
+		}
+
+		// Partition the primitives so the leftCount smallest centroids along the split axis come first
+		std::nth_element(primIndices.begin() + first, primIndices.begin() + first + leftCount,
+			primIndices.begin() + first + count, [&](int a, int b) {
+				return axisValue(centroids[a], axis) < axisValue(centroids[b], axis);
+			});
+
+		// Children are allocated next to each other, the node itself becomes an interior node
+		int leftIdx = (int)nodes.size();
+		nodes.emplace_back();
+		nodes.emplace_back();
+
+		nodes[leftIdx].leftFirst = first;
+		nodes[leftIdx].count = leftCount;
+		nodes[leftIdx + 1].leftFirst = first + leftCount;
+		nodes[leftIdx + 1].count = count - leftCount;
+		updateNodeBounds(leftIdx, primBounds);
+		updateNodeBounds(leftIdx + 1, primBounds);
+
+		nodes[nodeIdx].leftFirst = leftIdx;
+		nodes[nodeIdx].count = 0;
+
+		subdivide(leftIdx, primBounds, centroids, depth + 1);
+		subdivide(leftIdx + 1, primBounds, centroids, depth + 1);
+	}
+
+	/// Shared state of a parallel binned build. Nodes are preallocated so worker threads can claim child pairs with
+	/// an atomic counter without the vector ever reallocating
+	struct BinnedBuildContext {
+		const std::vector<AABB>& primBounds;
+		const std::vector<Vec3>& centroids;
+		std::atomic<int> nextNode;
+		std::atomic<int> freeThreads;
+
+		BinnedBuildContext(const std::vector<AABB>& b, const std::vector<Vec3>& c, int threads)
+			: primBounds(b), centroids(c), nextNode(1), freeThreads(threads) {}
+	};
+
+	void buildBinned(const std::vector<AABB>& primBounds, const std::vector<Vec3>& centroids) {
+		int n = (int)primBounds.size();
+
+		// Use the same number of threads as the renderer, the calling thread counts as one of them
+		unsigned int requestedThreads = std::thread::hardware_concurrency();
+		int numThreads = requestedThreads > 0 ? (int)requestedThreads : 4;
+
+		BinnedBuildContext ctx(primBounds, centroids, numThreads - 1);
+
+		nodes.assign(2 * n - 1, BVHNode());
+		nodes[0].leftFirst = 0;
+		nodes[0].count = n;
+		updateNodeBounds(0, primBounds);
+		subdivideBinned(0, ctx, 0);
+
+		nodes.resize(ctx.nextNode.load());
+		nodes.shrink_to_fit();
+	}
+
+	// Binned SAH, primitives are sorted into numBins buckets by centroid along each axis and only the bucket
+	// boundaries are evaluated. Returns the best cost and writes the split axis and the bin where the right child starts
+	double findBestBinnedSplit(const BVHNode& node, const AABB& centroidBounds, const BinnedBuildContext& ctx,
+		int& bestAxis, int& bestBin) const {
+		double bestCost = std::numeric_limits<double>::infinity();
+		double parentArea = node.bounds.surfaceArea();
+
+		for (int axis = 0; axis < 3; ++axis) {
+			double axisMin = axisValue(centroidBounds.min, axis);
+			double axisExtent = axisValue(centroidBounds.max, axis) - axisMin;
+			double scale = numBins / axisExtent;
+			if (axisExtent <= 0.0 || !std::isfinite(scale)) {
+				continue; // all centroids on the same plane, or too close to it to bin, nothing to split along this axis
+			}
+
+			AABB binBounds[numBins];
+			int binCounts[numBins] = {};
+
+			for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i) {
+				int prim = primIndices[i];
+				int bin = std::min(numBins - 1, (int)((axisValue(ctx.centroids[prim], axis) - axisMin) * scale));
+				binCounts[bin]++;
+				binBounds[bin].expand(ctx.primBounds[prim]);
+			}
+
+			// Sweep from the right to get the area and count of every possible right side
+			double rightAreas[numBins];
+			int rightCounts[numBins];
+			AABB rightBox;
+			int rightCount = 0;
+			for (int b = numBins - 1; b > 0; --b) {
+				rightBox.expand(binBounds[b]);
+				rightCount += binCounts[b];
+				rightAreas[b] = rightBox.surfaceArea();
+				rightCounts[b] = rightCount;
+			}
+
+			// Sweep from the left and evaluate the SAH cost at every bin boundary
+			AABB leftBox;
+			int leftCount = 0;
+			for (int b = 1; b < numBins; ++b) {
+				leftBox.expand(binBounds[b - 1]);
+				leftCount += binCounts[b - 1];
+				if (leftCount == 0 || rightCounts[b] == 0) {
+					continue;
+				}
+
+				double cost = traversalCost + (leftBox.surfaceArea() * leafCost(leftCount) +
+					rightAreas[b] * leafCost(rightCounts[b])) / parentArea;
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+		return bestCost;
+	}
+
+	void subdivideBinned(int nodeIdx, BinnedBuildContext& ctx, int depth) {
+		int first = nodes[nodeIdx].leftFirst;
+		int count = nodes[nodeIdx].count;
+
+		if (count <= 1) {
+			return;
+		}
+
+		AABB centroidBounds;
+		for (int i = first; i < first + count; ++i) {
+			centroidBounds.expand(ctx.centroids[primIndices[i]]);
+		}
+
+		int axis = centroidBounds.longestAxis();
+		int bin = -1;
+		double splitCost = std::numeric_limits<double>::infinity();
+
+		if (depth < maxSAHDepth) {
+			splitCost = findBestBinnedSplit(nodes[nodeIdx], centroidBounds, ctx, axis, bin);
+		}
+
+		if (splitCost >= leafCost(count) && count <= maxLeafSize) {
+			return;
+		}
+
+		int leftCount;
+		if (bin >= 0) {
+			// Move the primitives in bins left of the split to the front of the range
+			double axisMin = axisValue(centroidBounds.min, axis);
+			double scale = numBins / (axisValue(centroidBounds.max, axis) - axisMin);
+			auto mid = std::partition(primIndices.begin() + first, primIndices.begin() + first + count, [&](int prim) {
+				return std::min(numBins - 1, (int)((axisValue(ctx.centroids[prim], axis) - axisMin) * scale)) < bin;
+				});
+			leftCount = (int)(mid - (primIndices.begin() + first));
+		}
+		else {
+			// No usable binned split (too deep or coincident centroids), fall back to a median split
+			leftCount = count / 2;
+			std::nth_element(primIndices.begin() + first, primIndices.begin() + first + leftCount,
+				primIndices.begin() + first + count, [&](int a, int b) {
+					return axisValue(ctx.centroids[a], axis) < axisValue(ctx.centroids[b], axis);
+				});
+		}
+
+		// Claim two adjacent nodes for the children
+		int leftIdx = ctx.nextNode.fetch_add(2);
+
+		nodes[leftIdx].leftFirst = first;
+		nodes[leftIdx].count = leftCount;
+		nodes[leftIdx + 1].leftFirst = first + leftCount;
+		nodes[leftIdx + 1].count = count - leftCount;
+		updateNodeBounds(leftIdx, ctx.primBounds);
+		updateNodeBounds(leftIdx + 1, ctx.primBounds);
+
+		nodes[nodeIdx].leftFirst = leftIdx;
+		nodes[nodeIdx].count = 0;
+
+		// Hand the left subtree to a worker thread if it is large and a thread is free, the children work on disjoint
+		// ranges of primIndices and nodes so no further synchronization is needed
+		if (leftCount > parallelThreshold && ctx.freeThreads.fetch_sub(1) > 0) {
+			std::thread worker([this, &ctx, leftIdx, depth]() {
+				subdivideBinned(leftIdx, ctx, depth + 1);
+				});
+			subdivideBinned(leftIdx + 1, ctx, depth + 1);
+			worker.join();
+			ctx.freeThreads.fetch_add(1);
+		}
+		else {
+			if (leftCount > parallelThreshold) {
+				ctx.freeThreads.fetch_add(1); // no thread was free, give back the claim
+			}
+			subdivideBinned(leftIdx, ctx, depth + 1);
+			subdivideBinned(leftIdx + 1, ctx, depth + 1);
+		}
+	}
+
+	// Spread the lower 10 bits of v so there are two zero bits between each of them
+	static uint32_t expandBits(uint32_t v) {
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	// 30 bit Morton code of a point with coordinates in [0,1]
+	static uint32_t mortonCode(double x, double y, double z) {
+		auto quantize = [](double c) {
+			return (uint32_t)std::min(1023.0, std::max(0.0, c * 1024.0));
+		};
+		return (expandBits(quantize(x)) << 2) | (expandBits(quantize(y)) << 1) | expandBits(quantize(z));
+	}
+
+	static int countLeadingZeros(uint32_t v) {
+		if (v == 0) {
+			return 32;
+		}
+		int n = 0;
+		while (!(v & 0x80000000u)) {
+			v <<= 1;
+			++n;
+		}
+		return n;
+	}
+
+	// Linear BVH (Karras 2012 style). Centroids are quantized to Morton codes and radix sorted, then every node is
+	// split where the highest bit of the codes in its range changes
+	void buildLinear(const std::vector<AABB>& primBounds, const std::vector<Vec3>& centroids) {
+		int n = (int)primBounds.size();
+
+		AABB centroidBounds;
+		for (const Vec3& c : centroids) {
+			centroidBounds.expand(c);
+		}
+		Vec3 extent = centroidBounds.extent();
+		Vec3 scale(extent.x > 0.0 ? 1.0 / extent.x : 0.0, extent.y > 0.0 ? 1.0 / extent.y : 0.0,
+			extent.z > 0.0 ? 1.0 / extent.z : 0.0);
+
+		std::vector<uint32_t> codes(n);
+		for (int i = 0; i < n; ++i) {
+			Vec3 p = (centroids[i] - centroidBounds.min) * scale;
+			codes[i] = mortonCode(p.x, p.y, p.z);
+		}
+
+		// LSD radix sort of (code, primitive) pairs, 8 bits per pass
+		std::vector<uint32_t> sortedCodes(n);
+		std::vector<int> tmpIndices(n);
+		for (int shift = 0; shift < 32; shift += 8) {
+			int histogram[257] = {};
+			for (int i = 0; i < n; ++i) {
+				histogram[((codes[i] >> shift) & 0xFF) + 1]++;
+			}
+			for (int b = 0; b < 256; ++b) {
+				histogram[b + 1] += histogram[b];
+			}
+			for (int i = 0; i < n; ++i) {
+				int dst = histogram[(codes[i] >> shift) & 0xFF]++;
+				sortedCodes[dst] = codes[i];
+				tmpIndices[dst] = primIndices[i];
+			}
+			codes.swap(sortedCodes);
+			primIndices.swap(tmpIndices);
+		}
+
+		nodes.reserve(2 * n - 1);
+		nodes.emplace_back();
+		nodes[0].leftFirst = 0;
+		nodes[0].count = n;
+		emitLinear(0, codes);
+
+		// Children are always stored after their parent, so a reverse sweep computes the bounds bottom-up
+		for (int i = (int)nodes.size() - 1; i >= 0; --i) {
+			BVHNode& node = nodes[i];
+			if (node.isLeaf()) {
+				updateNodeBounds(i, primBounds);
+			}
+			else {
+				node.bounds = nodes[node.leftFirst].bounds;
+				node.bounds.expand(nodes[node.leftFirst + 1].bounds);
+			}
+		}
+		nodes.shrink_to_fit();
+	}
+
+	void emitLinear(int nodeIdx, const std::vector<uint32_t>& codes) {
+		int first = nodes[nodeIdx].leftFirst;
+		int count = nodes[nodeIdx].count;
+
+		if (count <= lbvhLeafSize) {
+			return;
+		}
+
+		int last = first + count - 1;
+		int split;
+		if (codes[first] == codes[last]) {
+			// Identical codes carry no spatial information, split the range in the middle
+			split = first + count / 2 - 1;
+		}
+		else {
+			// Binary search for the last code that shares more than the common prefix with the first code
+			int commonPrefix = countLeadingZeros(codes[first] ^ codes[last]);
+			split = first;
+			int step = last - first;
+			do {
+				step = (step + 1) >> 1;
+				int candidate = split + step;
+				if (candidate < last && countLeadingZeros(codes[first] ^ codes[candidate]) > commonPrefix) {
+					split = candidate;
+				}
+			} while (step > 1);
+		}
+
+		int leftCount = split - first + 1;
+		int leftIdx = (int)nodes.size();
+		nodes.emplace_back();
+		nodes.emplace_back();
+
+		nodes[leftIdx].leftFirst = first;
+		nodes[leftIdx].count = leftCount;
+		nodes[leftIdx + 1].leftFirst = split + 1;
+		nodes[leftIdx + 1].count = count - leftCount;
+
+		nodes[nodeIdx].leftFirst = leftIdx;
+		nodes[nodeIdx].count = 0;
+
+		emitLinear(leftIdx, codes);
+		emitLinear(leftIdx + 1, codes);
+	}
+
+	/// Primitive reference of the spatial split builder, box is the part of the primitive's bounds inside the node
+	struct SpatialRef {
+		int prim;
+		AABB box;
+	};
+
+	struct SpatialBuildState {
+		const SplitFunction& splitPrim;
+		double rootArea;
+		size_t refBudget;
+		size_t numRefs;
+	};
+
+	// Spatial split BVH (Stich et al. 2009). Every node compares the best object split with the best spatial split,
+	// which cuts the node into bins and clips the primitives straddling a bin boundary
+	void buildSpatial(const std::vector<AABB>& primBounds, const SplitFunction& splitPrim) {
+		int n = (int)primBounds.size();
+
+		std::vector<SpatialRef> refs(n);
+		AABB rootBounds;
+		for (int i = 0; i < n; ++i) {
+			refs[i] = { i, primBounds[i] };
+			rootBounds.expand(primBounds[i]);
+		}
+
+		SpatialBuildState state = { splitPrim, rootBounds.surfaceArea(), (size_t)(n * (1.0 + spatialSplitBudget)), (size_t)n };
+
+		primIndices.clear();
+		primIndices.reserve(state.refBudget);
+		nodes.reserve(2 * state.refBudget);
+		nodes.emplace_back();
+		nodes[0].bounds = rootBounds;
+		subdivideSpatial(0, refs, state, 0);
+		nodes.shrink_to_fit();
+		primIndices.shrink_to_fit();
+	}
+
+	// Centroid order along an axis, ties are broken by primitive index so the partition matches the evaluated sweep
+	static bool spatialRefLess(const SpatialRef& a, const SpatialRef& b, int axis) {
+		double ca = axisValue(a.box.centroid(), axis);
+		double cb = axisValue(b.box.centroid(), axis);
+		return ca < cb || (ca == cb && a.prim < b.prim);
+	}
+
+	// Bin of a coordinate in a spatial split, the split itself uses the same binning so it matches the evaluated cost
+	static int spatialBin(double v, double axisMin, double binWidth) {
+		return std::max(0, std::min(numBins - 1, (int)((v - axisMin) / binWidth)));
+	}
+
+	// Best object split of a reference list, full sweep like findBestSplit. Also returns the overlap area of the two
+	// children, which decides whether a spatial split is worth trying
+	double findBestObjectSplit(std::vector<SpatialRef>& refs, double parentArea, int& bestAxis, int& bestLeftCount,
+		double& bestOverlap) {
+		int n = (int)refs.size();
+		double bestCost = std::numeric_limits<double>::infinity();
+		std::vector<AABB> rightBoxes(n);
+
+		for (int axis = 0; axis < 3; ++axis) {
+			std::sort(refs.begin(), refs.end(), [axis](const SpatialRef& a, const SpatialRef& b) {
+				return spatialRefLess(a, b, axis);
+				});
+
+			AABB rightBox;
+			for (int i = n - 1; i > 0; --i) {
+				rightBox.expand(refs[i].box);
+				rightBoxes[i] = rightBox;
+			}
+
+			AABB leftBox;
+			for (int i = 0; i < n - 1; ++i) {
+				leftBox.expand(refs[i].box);
+				int leftCount = i + 1;
+				double cost = traversalCost + (leftBox.surfaceArea() * leafCost(leftCount) +
+					rightBoxes[i + 1].surfaceArea() * leafCost(n - leftCount)) / parentArea;
+
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestLeftCount = leftCount;
+					bestOverlap = leftBox.overlap(rightBoxes[i + 1]).surfaceArea();
+				}
+			}
+		}
+		return bestCost;
+	}
+
+	// Best spatial split, references are chopped into numBins equally wide bins per axis. A reference is counted as
+	// entering its first bin and leaving its last, the bin bounds only get the clipped part of the primitive
+	double findBestSpatialSplit(const std::vector<SpatialRef>& refs, const AABB& bounds, double parentArea,
+		const SplitFunction& splitPrim, int& bestAxis, int& bestBin) const {
+		double bestCost = std::numeric_limits<double>::infinity();
+
+		for (int axis = 0; axis < 3; ++axis) {
+			double axisMin = axisValue(bounds.min, axis);
+			double binWidth = (axisValue(bounds.max, axis) - axisMin) / numBins;
+			if (binWidth <= 0.0) {
+				continue;
+			}
+
+			AABB binBounds[numBins];
+			int enter[numBins] = {};
+			int exit[numBins] = {};
+
+			for (const SpatialRef& ref : refs) {
+				int firstBin = spatialBin(axisValue(ref.box.min, axis), axisMin, binWidth);
+				int lastBin = spatialBin(axisValue(ref.box.max, axis), axisMin, binWidth);
+				enter[firstBin]++;
+				exit[lastBin]++;
+
+				// Clip the reference at every bin boundary it crosses
+				AABB rest = ref.box;
+				for (int b = firstBin; b < lastBin; ++b) {
+					AABB left, right;
+					splitPrim(ref.prim, axis, axisMin + binWidth * (b + 1), left, right);
+					binBounds[b].expand(left.overlap(rest));
+					rest = right.overlap(rest);
+				}
+				binBounds[lastBin].expand(rest);
+			}
+
+			double rightAreas[numBins];
+			int rightCounts[numBins];
+			AABB rightBox;
+			int rightCount = 0;
+			for (int b = numBins - 1; b > 0; --b) {
+				rightBox.expand(binBounds[b]);
+				rightCount += exit[b];
+				rightAreas[b] = rightBox.surfaceArea();
+				rightCounts[b] = rightCount;
+			}
+
+			AABB leftBox;
+			int leftCount = 0;
+			for (int b = 1; b < numBins; ++b) {
+				leftBox.expand(binBounds[b - 1]);
+				leftCount += enter[b - 1];
+				if (leftCount == 0 || rightCounts[b] == 0) {
+					continue;
+				}
+
+				double cost = traversalCost + (leftBox.surfaceArea() * leafCost(leftCount) +
+					rightAreas[b] * leafCost(rightCounts[b])) / parentArea;
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+		return bestCost;
+	}
+
+	void makeSpatialLeaf(int nodeIdx, const std::vector<SpatialRef>& refs) {
+		nodes[nodeIdx].leftFirst = (int)primIndices.size();
+		nodes[nodeIdx].count = (int)refs.size();
+		for (const SpatialRef& ref : refs) {
+			primIndices.push_back(ref.prim);
+		}
+	}
+
+	void subdivideSpatial(int nodeIdx, std::vector<SpatialRef>& refs, SpatialBuildState& state, int depth) {
+		int count = (int)refs.size();
+		AABB bounds = nodes[nodeIdx].bounds;
+		double parentArea = bounds.surfaceArea();
+
+		if (count <= 1 || (parentArea <= 0.0 && count <= maxLeafSize)) {
+			makeSpatialLeaf(nodeIdx, refs);
+			return;
+		}
+
+		int objectAxis = bounds.longestAxis();
+		int objectLeftCount = count / 2;
+		double overlap = 0.0;
+		double objectCost = std::numeric_limits<double>::infinity();
+		double spatialCost = std::numeric_limits<double>::infinity();
+		int spatialAxis = 0;
+		int spatialSplitBin = 0;
+
+		if (depth < maxSAHDepth) {
+			objectCost = findBestObjectSplit(refs, parentArea, objectAxis, objectLeftCount, overlap);
+
+			if (state.splitPrim && overlap / state.rootArea > spatialSplitAlpha && state.numRefs < state.refBudget) {
+				spatialCost = findBestSpatialSplit(refs, bounds, parentArea, state.splitPrim, spatialAxis, spatialSplitBin);
+			}
+
+			if (std::min(objectCost, spatialCost) >= leafCost(count) && count <= maxLeafSize) {
+				makeSpatialLeaf(nodeIdx, refs);
+				return;
+			}
+		}
+
+		std::vector<SpatialRef> leftRefs, rightRefs;
+
+		if (spatialCost < objectCost) {
+			// Send every reference to the side of the plane it lies on, straddling primitives are clipped in two
+			double axisMin = axisValue(bounds.min, spatialAxis);
+			double binWidth = (axisValue(bounds.max, spatialAxis) - axisMin) / numBins;
+			double spatialPos = axisMin + binWidth * spatialSplitBin;
+
+			std::vector<SpatialRef> straddling;
+			AABB leftBox, rightBox;
+			for (const SpatialRef& ref : refs) {
+				if (spatialBin(axisValue(ref.box.max, spatialAxis), axisMin, binWidth) < spatialSplitBin) {
+					leftRefs.push_back(ref);
+					leftBox.expand(ref.box);
+				}
+				else if (spatialBin(axisValue(ref.box.min, spatialAxis), axisMin, binWidth) >= spatialSplitBin) {
+					rightRefs.push_back(ref);
+					rightBox.expand(ref.box);
+				}
+				else {
+					straddling.push_back(ref);
+				}
+			}
+
+			int leftCount = (int)(leftRefs.size() + straddling.size());
+			int rightCount = (int)(rightRefs.size() + straddling.size());
+			std::vector<AABB> leftParts(straddling.size()), rightParts(straddling.size());
+			for (size_t i = 0; i < straddling.size(); ++i) {
+				AABB left, right;
+				state.splitPrim(straddling[i].prim, spatialAxis, spatialPos, left, right);
+				leftParts[i] = left.overlap(straddling[i].box);
+				rightParts[i] = right.overlap(straddling[i].box);
+				leftBox.expand(leftParts[i]);
+				rightBox.expand(rightParts[i]);
+			}
+
+			// Reference unsplitting, a primitive is put whole on one side when the bigger child is cheaper than the
+			// extra reference
+			for (size_t i = 0; i < straddling.size(); ++i) {
+				const SpatialRef& ref = straddling[i];
+				AABB leftWithRef = leftBox;
+				AABB rightWithRef = rightBox;
+				leftWithRef.expand(ref.box);
+				rightWithRef.expand(ref.box);
+
+				double splitCost = leftBox.surfaceArea() * leftCount + rightBox.surfaceArea() * rightCount;
+				double toLeftCost = leftWithRef.surfaceArea() * leftCount + rightBox.surfaceArea() * (rightCount - 1);
+				double toRightCost = leftBox.surfaceArea() * (leftCount - 1) + rightWithRef.surfaceArea() * rightCount;
+
+				if (toLeftCost < splitCost && toLeftCost <= toRightCost) {
+					leftRefs.push_back(ref);
+					leftBox = leftWithRef;
+					rightCount--;
+				}
+				else if (toRightCost < splitCost) {
+					rightRefs.push_back(ref);
+					rightBox = rightWithRef;
+					leftCount--;
+				}
+				else {
+					if (!leftParts[i].isEmpty()) leftRefs.push_back({ ref.prim, leftParts[i] });
+					if (!rightParts[i].isEmpty()) rightRefs.push_back({ ref.prim, rightParts[i] });
+					if (!leftParts[i].isEmpty() && !rightParts[i].isEmpty()) state.numRefs++;
+				}
+			}
+		}
+
+		// Object split, also the fallback if clipping left one side empty
+		if (leftRefs.empty() || rightRefs.empty()) {
+			leftRefs.clear();
+			rightRefs.clear();
+			std::nth_element(refs.begin(), refs.begin() + objectLeftCount, refs.end(), [&](const SpatialRef& a, const SpatialRef& b) {
+				return spatialRefLess(a, b, objectAxis);
+				});
+			leftRefs.assign(refs.begin(), refs.begin() + objectLeftCount);
+			rightRefs.assign(refs.begin() + objectLeftCount, refs.end());
+		}
+
+		// The reference list of this node is not needed anymore
+		std::vector<SpatialRef>().swap(refs);
+
+		int leftIdx = (int)nodes.size();
+		nodes.emplace_back();
+		nodes.emplace_back();
+		for (const SpatialRef& ref : leftRefs) nodes[leftIdx].bounds.expand(ref.box);
+		for (const SpatialRef& ref : rightRefs) nodes[leftIdx + 1].bounds.expand(ref.box);
+
+		nodes[nodeIdx].leftFirst = leftIdx;
+		nodes[nodeIdx].count = 0;
+
+		subdivideSpatial(leftIdx, leftRefs, state, depth + 1);
+		subdivideSpatial(leftIdx + 1, rightRefs, state, depth + 1);
+	}
+};
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "bvh.h"
+#include "mappedFile.h"
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <type_traits>
+#include <random>
+#include <thread>
+#include <functional>
+
+/// FNV-1a style hash over raw bytes, chain calls by passing the previous hash as seed. Mixes 8 bytes per step so large
+/// meshes hash at memory speed
+inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	const uint64_t prime = 1099511628211ull;
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, bytes + i, 8);
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; ++i) {
+		hash = (hash ^ bytes[i]) * prime;
+	}
+	return hash;
+}
+
+/// Name to write a file under before renaming it to path. Unique per writer, so jobs writing the same file at the
+/// same time each fill their own and the rename picks one whole file
+inline std::string uniqueTempPath(const std::string& path) {
+	static thread_local std::mt19937_64 gen(std::random_device{}() ^ std::hash<std::thread::id>{}(std::this_thread::get_id()));
+	char suffix[32];
+	std::snprintf(suffix, sizeof(suffix), ".%016llx.tmp", (unsigned long long)gen());
+	return path + suffix;
+}
+
+/// On-disk cache of built BVHs. Every BVH is stored in its own file named after the hash of the geometry it was built
+/// from, so a restarted job finds the tree of unchanged geometry and skips the build. The file holds the binary nodes,
+/// the primitive order and, if the tree was built with the wide layout, the wide nodes, all as raw arrays that are
+/// copied straight out of the memory mapping
+class BVHCache {
+public:
+	// Bump when the node layout or the builders change so old cache files are rebuilt
+	static constexpr uint32_t formatVersion = 3;
+
+	explicit BVHCache(const std::string& dir) : directory(dir) {}
+
+	// Load the BVH stored under hash, fails if there is none or it references primitives beyond expectedPrims. A tree
+	// built with spatial splits holds more references than primitives, so the reference count is not checked
+	bool load(uint64_t hash, int expectedPrims, BVH& bvh) const {
+		MappedFile file;
+		if (!file.open(path(hash))) {
+			return false;
+		}
+
+		Header header;
+		if (file.size() < sizeof(Header)) {
+			return false;
+		}
+		std::memcpy(&header, file.data(), sizeof(Header));
+
+		if (std::memcmp(header.magic, "BVHC", 4) != 0 || header.version != formatVersion || header.hash != hash ||
+			(int)header.primCount < expectedPrims) {
+			return false;
+		}
+
+		size_t nodeBytes = (size_t)header.nodeCount * sizeof(BVHNode);
+		size_t primBytes = (size_t)header.primCount * sizeof(int);
+		size_t wideBytes = (size_t)header.wideNodeCount * sizeof(WideBVHNode<BVH_WIDTH>);
+		if (header.wideNodeCount > 0 && header.wideWidth != BVH_WIDTH) {
+			return false; // written by a build with a different SIMD width
+		}
+		if (file.size() != sizeof(Header) + nodeBytes + primBytes + wideBytes) {
+			return false;
+		}
+
+		const unsigned char* data = file.data() + sizeof(Header);
+		bvh.nodes.resize(header.nodeCount);
+		bvh.primIndices.resize(header.primCount);
+		bvh.wide.nodes.resize(header.wideNodeCount);
+		bvh.wide16.clear(); // quantized layouts are not cached, they are collapsed again from the binary nodes
+		bvh.wide8.clear();
+		std::memcpy(bvh.nodes.data(), data, nodeBytes);
+		std::memcpy(bvh.primIndices.data(), data + nodeBytes, primBytes);
+		std::memcpy((void*)bvh.wide.nodes.data(), data + nodeBytes + primBytes, wideBytes);
+
+		// A truncated or foreign file must not send the traversal out of bounds
+		if (!isValid(bvh, expectedPrims)) {
+			bvh.nodes.clear();
+			bvh.primIndices.clear();
+			bvh.wide.clear();
+			return false;
+		}
+		bvh.builtCost = bvh.sahCost();
+		return true;
+	}
+
+	// Write the BVH under hash. The file is written under a temporary name of its own first so a job reading the
+	// cache at the same time never sees a partial file, and jobs storing the same tree don't write into one file
+	bool store(uint64_t hash, const BVH& bvh) const {
+		std::error_code ec;
+		std::filesystem::create_directories(directory, ec);
+
+		Header header;
+		std::memcpy(header.magic, "BVHC", 4);
+		header.version = formatVersion;
+		header.hash = hash;
+		header.nodeCount = (uint32_t)bvh.nodes.size();
+		header.primCount = (uint32_t)bvh.primIndices.size(); // number of references, not primitives
+		header.wideWidth = BVH_WIDTH;
+		header.wideNodeCount = (uint32_t)bvh.wide.nodes.size();
+
+		std::string finalPath = path(hash);
+		std::string tmpPath = uniqueTempPath(finalPath);
+		bool written;
+		{
+			std::ofstream ofs(tmpPath, std::ios::binary);
+			if (!ofs) {
+				return false;
+			}
+			ofs.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+			ofs.write(reinterpret_cast<const char*>(bvh.nodes.data()), bvh.nodes.size() * sizeof(BVHNode));
+			ofs.write(reinterpret_cast<const char*>(bvh.primIndices.data()), bvh.primIndices.size() * sizeof(int));
+			ofs.write(reinterpret_cast<const char*>(bvh.wide.nodes.data()), bvh.wide.nodes.size() * sizeof(WideBVHNode<BVH_WIDTH>));
+			written = (bool)ofs;
+		}
+
+		if (written) {
+			std::filesystem::rename(tmpPath, finalPath, ec);
+		}
+		if (!written || ec) {
+			std::filesystem::remove(tmpPath, ec);
+			return false;
+		}
+		return true;
+	}
+
+	// True if the tree only references nodes and primitives that exist, checked before a tree read from a file is used
+	static bool isValid(const BVH& bvh, int numPrims) {
+		int numNodes = (int)bvh.nodes.size();
+		int numRefs = (int)bvh.primIndices.size();
+
+		// Children always come after their parent, which also rules out cycles
+		for (int i = 0; i < numNodes; ++i) {
+			const BVHNode& node = bvh.nodes[i];
+			if (node.isLeaf() ? (node.leftFirst < 0 || node.count > BVH::maxLeafSize || node.leftFirst + node.count > numRefs)
+				: (node.leftFirst <= i || node.leftFirst + 1 >= numNodes)) {
+				return false;
+			}
+		}
+		for (int prim : bvh.primIndices) {
+			if (prim < 0 || prim >= numPrims) {
+				return false;
+			}
+		}
+
+		int numWide = (int)bvh.wide.nodes.size();
+		for (int i = 0; i < numWide; ++i) {
+			const auto& node = bvh.wide.nodes[i];
+			for (int c = 0; c < BVH_WIDTH; ++c) {
+				if (!(node.validMask & (1 << c))) {
+					continue;
+				}
+				if (node.count[c] > 0 ? (node.child[c] < 0 || node.child[c] + node.count[c] > numRefs)
+					: (node.child[c] <= i || node.child[c] >= numWide)) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+private:
+	static_assert(std::is_trivially_copyable<BVHNode>::value, "BVH nodes are written to disk as raw bytes");
+	static_assert(std::is_trivially_copyable<WideBVHNode<BVH_WIDTH>>::value, "BVH nodes are written to disk as raw bytes");
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint64_t hash;
+		uint32_t nodeCount;
+		uint32_t primCount;
+		uint32_t wideWidth;
+		uint32_t wideNodeCount;
+	};
+
+	std::string path(uint64_t hash) const {
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.bvh", (unsigned long long)hash);
+		return (std::filesystem::path(directory) / name).string();
+	}
+
+	std::string directory;
+};
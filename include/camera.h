@@ -2,6 +2,7 @@
 
 #include "include/roomClass.h"
 #include "include/ray.h"
+#include "include/vec3Simd.h"
 #include"stocasticRayGeneration.h"
 
 class Camera {
@@ -45,12 +46,13 @@ public:
 		std::vector<Ray> rays;
 		rays.reserve(n);
 
-		Vec3 horizontal = lr - ll;
-		Vec3 vertical = ul - ll;
+		// Image plane math in the SIMD vector type, converted back to Vec3 once per ray
+		const ShadeVec3 lowerLeft(ll), eye(eyePos);
+		const ShadeVec3 horizontal = ShadeVec3(lr) - lowerLeft;
+		const ShadeVec3 vertical = ShadeVec3(ul) - lowerLeft;
 
-		// Local RNG
-		std::random_device rd;
-		std::mt19937 gen(rd());
+		// Per-thread RNG, seeding a generator per pixel costed more than generating its rays
+		static thread_local std::mt19937 gen(std::random_device{}());
 
 		// Gaussian distribution centered at 0.5, std dev controls spread
 		const double mean = 0.5; // Center of pixel
@@ -82,11 +84,11 @@ public:
 				double v = std::clamp(u2 + offSetu2 * dv, 0.0, 1.0);
 
 				// Generate ray through the sampled pixel location
-				Vec3 pointOnImagePlane = ll + horizontal * u + vertical * v;
+				ShadeVec3 pointOnImagePlane = lowerLeft + horizontal * u + vertical * v;
 				// Ray's direction from eye to point on image plane and beyond 
-				Vec3 dir = (pointOnImagePlane - eyePos).normalize();
+				ShadeVec3 dir = (pointOnImagePlane - eye).normalize();
 
-				rays.emplace_back(eyePos, dir);
+				rays.emplace_back(eyePos, Vec3(dir));
 			}
 		}
 
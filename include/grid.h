@@ -0,0 +1,387 @@
+#pragma once
+
+#include "aabb.h"
+#include "ray.h"
+#include "traversalStats.h"
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+/// Hierarchical uniform grid over primitive bounding boxes, an alternative to the BVH for scenes of many similar-size
+/// primitives. It builds in linear time with a counting sort of primitive references into cells, and cells that still
+/// hold many primitives get a nested grid of their own. Rays walk the cells with 3D-DDA. Like the BVH the grid only
+/// knows primitive indices and the primitives are intersected by the caller in the same leaf callbacks
+class Grid {
+public:
+	// Target number of cells per primitive, the resolution follows from it and the shape of the bounds
+	static constexpr double cellsPerPrim = 2.0;
+	static constexpr int maxResolution = 128;
+
+	// Cells with more primitives than this get a nested grid, up to maxLevels grids deep
+	static constexpr int maxCellPrims = 16;
+	static constexpr int maxLevels = 2;
+
+	// Entries of the per-ray mailbox, must be a power of two
+	static constexpr int mailboxSize = 32;
+
+	void build(const std::vector<AABB>& primBounds) {
+		levels.clear();
+
+		std::vector<int> prims;
+		AABB bounds;
+		for (int i = 0; i < (int)primBounds.size(); ++i) {
+			if (!primBounds[i].isEmpty()) {
+				prims.push_back(i);
+				bounds.expand(primBounds[i]);
+			}
+		}
+		if (prims.empty()) {
+			return;
+		}
+		buildLevel(bounds, prims, primBounds, 0);
+	}
+
+	bool empty() const {
+		return levels.empty();
+	}
+
+	void clear() {
+		levels.clear();
+	}
+
+	/// Closest hit traversal with the same leaf callback contract as BVH::intersect. Cells are visited front to back
+	/// and the walk stops at the first cell that starts behind the closest hit
+	template<typename LeafTest>
+	bool intersect(const Ray& ray, double& tMax, LeafTest&& leafTest) const {
+		if (levels.empty()) {
+			return false;
+		}
+
+		Mailbox mailbox;
+		bool hit = false;
+		walk(0, RayData(ray), 0.0, tMax, tMax, [&](const std::vector<int>& prims, int first, int count) {
+			for (int i = first; i < first + count; ++i) {
+				if (mailbox.testedBefore(prims[i])) {
+					continue;
+				}
+				if (leafTest(prims[i], tMax)) {
+					hit = true;
+				}
+			}
+			return false;
+			});
+		return hit;
+	}
+
+	/// Any hit traversal, same contract as BVH::occluded
+	template<typename AnyHitTest>
+	bool occluded(const Ray& ray, double tMax, AnyHitTest&& anyHit) const {
+		if (levels.empty()) {
+			return false;
+		}
+
+		Mailbox mailbox;
+		return walk(0, RayData(ray), 0.0, tMax, tMax, [&](const std::vector<int>& prims, int first, int count) {
+			for (int i = first; i < first + count; ++i) {
+				if (!mailbox.testedBefore(prims[i]) && anyHit(prims[i])) {
+					return true;
+				}
+			}
+			return false;
+			});
+	}
+
+	// Number of grids (levels) and primitive references, for statistics
+	int gridCount() const {
+		return (int)levels.size();
+	}
+
+	size_t referenceCount() const {
+		size_t refs = 0;
+		for (const Level& level : levels) {
+			refs += level.prims.size();
+		}
+		return refs;
+	}
+
+private:
+	/// Cell contents, primitives [first, first + count) of the level's prims or a nested grid if child >= 0
+	struct Cell {
+		int first = 0;
+		int count = 0;
+		int child = -1;
+	};
+
+	struct Level {
+		AABB bounds;
+		int res[3];
+		Vec3 cellSize;
+		std::vector<Cell> cells;
+		std::vector<int> prims;
+	};
+
+	std::vector<Level> levels;
+
+	/// Small direct-mapped cache of the primitives a ray has already been tested against. A primitive overlapping
+	/// several cells is then only tested once, collisions only cost a repeated test. Kept per ray on the stack so
+	/// render threads don't share any state
+	struct Mailbox {
+		int entries[mailboxSize];
+
+		Mailbox() {
+			std::fill(entries, entries + mailboxSize, -1);
+		}
+
+		bool testedBefore(int prim) {
+			int& slot = entries[prim & (mailboxSize - 1)];
+			if (slot == prim) {
+				return true;
+			}
+			slot = prim;
+			return false;
+		}
+	};
+
+	struct RayData {
+		Vec3 origin, direction, invDir;
+
+		explicit RayData(const Ray& ray) : origin(ray.origin), direction(ray.direction),
+			invDir(1.0 / ray.direction.x, 1.0 / ray.direction.y, 1.0 / ray.direction.z) {}
+	};
+
+	// Parametric range where the ray is inside box, false if it misses it within [t0, t1]
+	static bool clip(const AABB& box, const RayData& r, double& t0, double& t1) {
+		for (int axis = 0; axis < 3; ++axis) {
+			double o = axisValue(r.origin, axis);
+			double d = axisValue(r.direction, axis);
+			double lo = axisValue(box.min, axis);
+			double hi = axisValue(box.max, axis);
+
+			if (d == 0.0) {
+				if (o < lo || o > hi) {
+					return false;
+				}
+				continue;
+			}
+
+			double inv = axisValue(r.invDir, axis);
+			double tA = (lo - o) * inv;
+			double tB = (hi - o) * inv;
+			t0 = std::max(t0, std::min(tA, tB));
+			t1 = std::min(t1, std::max(tA, tB));
+		}
+		return t0 <= t1;
+	}
+
+	// Grid resolution along each axis, about cellsPerPrim cells per primitive with roughly cubic cells. Cells are kept
+	// at least half as wide as the average primitive, smaller cells only add references to the same primitives
+	static void chooseResolution(const AABB& bounds, int numPrims, double meanPrimExtent, int res[3]) {
+		Vec3 e = bounds.extent();
+		double maxExtent = std::max<double>(e.x, std::max<double>(e.y, e.z));
+		double minExtent = maxExtent * 1e-3; // flat bounds still get a cell layer
+		double ex = std::max<double>(e.x, minExtent), ey = std::max<double>(e.y, minExtent), ez = std::max<double>(e.z, minExtent);
+
+		double cellsPerUnit = std::cbrt(cellsPerPrim * numPrims / (ex * ey * ez));
+		if (meanPrimExtent > 0.0) {
+			cellsPerUnit = std::min(cellsPerUnit, 2.0 / meanPrimExtent);
+		}
+		res[0] = e.x > 0.0 ? std::max(1, std::min(maxResolution, (int)(ex * cellsPerUnit))) : 1;
+		res[1] = e.y > 0.0 ? std::max(1, std::min(maxResolution, (int)(ey * cellsPerUnit))) : 1;
+		res[2] = e.z > 0.0 ? std::max(1, std::min(maxResolution, (int)(ez * cellsPerUnit))) : 1;
+	}
+
+	static int cellCoord(double v, double lo, double size, int res) {
+		if (size <= 0.0) {
+			return 0;
+		}
+		return std::max(0, std::min(res - 1, (int)((v - lo) / size)));
+	}
+
+	int buildLevel(const AABB& bounds, const std::vector<int>& prims, const std::vector<AABB>& primBounds, int depth) {
+		int levelIdx = (int)levels.size();
+		levels.emplace_back();
+
+		double meanPrimExtent = 0.0;
+		for (int prim : prims) {
+			Vec3 pe = primBounds[prim].overlap(bounds).extent();
+			meanPrimExtent += std::max(pe.x, std::max(pe.y, pe.z));
+		}
+		meanPrimExtent /= prims.size();
+
+		Level level;
+		level.bounds = bounds;
+		chooseResolution(bounds, (int)prims.size(), meanPrimExtent, level.res);
+		Vec3 e = bounds.extent();
+		level.cellSize = Vec3(e.x / level.res[0], e.y / level.res[1], e.z / level.res[2]);
+		level.cells.resize((size_t)level.res[0] * level.res[1] * level.res[2]);
+
+		// Counting sort of the references, first count the primitives per cell, then place them
+		auto forEachCell = [&](int prim, auto&& f) {
+			const AABB& b = primBounds[prim];
+			int lo[3], hi[3];
+			for (int axis = 0; axis < 3; ++axis) {
+				double origin = axisValue(bounds.min, axis);
+				double size = axisValue(level.cellSize, axis);
+				lo[axis] = cellCoord(axisValue(b.min, axis), origin, size, level.res[axis]);
+				hi[axis] = cellCoord(axisValue(b.max, axis), origin, size, level.res[axis]);
+			}
+			for (int z = lo[2]; z <= hi[2]; ++z) {
+				for (int y = lo[1]; y <= hi[1]; ++y) {
+					for (int x = lo[0]; x <= hi[0]; ++x) {
+						f(cellIndex(level, x, y, z));
+					}
+				}
+			}
+		};
+
+		for (int prim : prims) {
+			forEachCell(prim, [&](int cell) { level.cells[cell].count++; });
+		}
+
+		int total = 0;
+		for (Cell& cell : level.cells) {
+			cell.first = total;
+			total += cell.count;
+			cell.count = 0;
+		}
+		level.prims.resize(total);
+		for (int prim : prims) {
+			forEachCell(prim, [&](int cell) {
+				Cell& c = level.cells[cell];
+				level.prims[c.first + c.count++] = prim;
+				});
+		}
+
+		// Dense cells get a nested grid over the part of their primitives inside the cell
+		if (depth + 1 < maxLevels) {
+			for (int z = 0; z < level.res[2]; ++z) {
+				for (int y = 0; y < level.res[1]; ++y) {
+					for (int x = 0; x < level.res[0]; ++x) {
+						int index = cellIndex(level, x, y, z);
+						Cell cell = level.cells[index];
+						if (cell.count <= maxCellPrims) {
+							continue;
+						}
+
+						AABB cellBox(bounds.min + Vec3(x * level.cellSize.x, y * level.cellSize.y, z * level.cellSize.z),
+							bounds.min + Vec3((x + 1) * level.cellSize.x, (y + 1) * level.cellSize.y, (z + 1) * level.cellSize.z));
+						AABB childBounds;
+						std::vector<int> cellPrims(level.prims.begin() + cell.first, level.prims.begin() + cell.first + cell.count);
+						for (int prim : cellPrims) {
+							childBounds.expand(primBounds[prim].overlap(cellBox));
+						}
+
+						// Don't nest if all primitives cover the whole cell, a nested grid couldn't separate them
+						bool separable = false;
+						for (int prim : cellPrims) {
+							AABB part = primBounds[prim].overlap(cellBox);
+							if (part.surfaceArea() < 0.5 * childBounds.surfaceArea()) {
+								separable = true;
+								break;
+							}
+						}
+						if (!separable || childBounds.isEmpty()) {
+							continue;
+						}
+
+						level.cells[index].child = buildLevel(childBounds, cellPrims, primBounds, depth + 1);
+						level.cells[index].count = 0;
+					}
+				}
+			}
+
+			// Drop the references that moved to nested grids
+			std::vector<int> compacted;
+			compacted.reserve(level.prims.size());
+			for (Cell& cell : level.cells) {
+				int first = (int)compacted.size();
+				compacted.insert(compacted.end(), level.prims.begin() + cell.first, level.prims.begin() + cell.first + cell.count);
+				cell.first = first;
+			}
+			level.prims.swap(compacted);
+		}
+
+		levels[levelIdx] = std::move(level);
+		return levelIdx;
+	}
+
+	static int cellIndex(const Level& level, int x, int y, int z) {
+		return (z * level.res[1] + y) * level.res[0] + x;
+	}
+
+	/// 3D-DDA through one grid between tStart and tEnd. visit(prims, first, count) is called for every non-empty cell
+	/// and returns true to stop the walk. The leaf tests may shrink tMax while walking, the walk ends at the first cell
+	/// behind it. Nested grids are walked recursively over the range of their parent cell
+	template<typename Visit>
+	bool walk(int levelIdx, const RayData& r, double tStart, double tEnd, double& tMax, Visit&& visit) const {
+		const Level& level = levels[levelIdx];
+
+		double t0 = tStart;
+		double t1 = std::min(tEnd, tMax);
+		if (!clip(level.bounds, r, t0, t1)) {
+			return false;
+		}
+
+		// Starting cell and the distance to the next cell boundary along each axis
+		int cell[3], step[3], end[3];
+		double tNext[3], tDelta[3];
+		Vec3 entry = r.origin + r.direction * t0;
+		for (int axis = 0; axis < 3; ++axis) {
+			double lo = axisValue(level.bounds.min, axis);
+			double size = axisValue(level.cellSize, axis);
+			double d = axisValue(r.direction, axis);
+			cell[axis] = cellCoord(axisValue(entry, axis), lo, size, level.res[axis]);
+
+			if (d > 0.0) {
+				step[axis] = 1;
+				end[axis] = level.res[axis];
+				tNext[axis] = (lo + (cell[axis] + 1) * size - axisValue(r.origin, axis)) / d;
+				tDelta[axis] = size / d;
+			}
+			else if (d < 0.0) {
+				step[axis] = -1;
+				end[axis] = -1;
+				tNext[axis] = (lo + cell[axis] * size - axisValue(r.origin, axis)) / d;
+				tDelta[axis] = -size / d;
+			}
+			else {
+				step[axis] = 0;
+				end[axis] = -1;
+				tNext[axis] = std::numeric_limits<double>::infinity();
+				tDelta[axis] = 0.0;
+			}
+		}
+
+		double tCell = t0;
+		while (true) {
+			// Axis of the nearest cell boundary, the ray leaves the cell there
+			int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+			double tExit = std::min(tNext[axis], t1);
+
+			const Cell& c = level.cells[cellIndex(level, cell[0], cell[1], cell[2])];
+			TRAVERSAL_STAT(nodes);
+			if (c.child >= 0) {
+				if (walk(c.child, r, tCell, tExit, tMax, visit)) {
+					return true;
+				}
+			}
+			else if (c.count > 0 && visit(level.prims, c.first, c.count)) {
+				return true;
+			}
+
+			// Hits found so far are all closer than anything in the cells further along
+			if (tMax <= tExit || tNext[axis] >= t1) {
+				return false;
+			}
+
+			cell[axis] += step[axis];
+			if (cell[axis] == end[axis]) {
+				return false;
+			}
+			tCell = tNext[axis];
+			tNext[axis] += tDelta[axis];
+		}
+	}
+};
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "vec3.h"
+#include "aabb.h"
+#include "triangle.h"
+#include "ray.h"
+#include "meshBuffer.h"
+#include "material.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <cassert>
+
+/// Shape of a mesh face. A parallelogram is given by three vertices like a triangle, its corner and the corner moved
+/// along each of its two edges, and its fourth corner is implied. It is tested as one primitive where two triangles
+/// would take two tests
+enum class FaceShape : uint8_t {
+	Triangle,
+	Parallelogram
+};
+
+/// Indexed triangle mesh. Vertices are stored once and shared by the faces that use them, every face is three uint32
+/// indices into the vertex buffer plus a color and a material ID into small per-mesh palettes. Normals and edges are
+/// computed when needed instead of stored, so a closed mesh takes about 30 bytes per triangle against the 168 byte
+/// Triangle that copies its vertices, edges, normal and color. Scanned meshes can instead carry a color per vertex,
+/// which is interpolated over the faces. The per vertex and per face buffers can view a mapped scene file, see
+/// SceneFile. Faces can also be parallelograms, see FaceShape
+class IndexedMesh {
+public:
+	MeshBuffer<Vec3> vertices;
+	MeshBuffer<uint32_t> indices;
+
+	// Optional per vertex colors packed as 8 bit RGB, see packColor. Empty or one per vertex, when set they replace
+	// the face colors in shading. Vertices added to a mesh that has them take the color of the first face using them
+	MeshBuffer<uint32_t> vertexColors;
+
+	// Per face palette IDs
+	MeshBuffer<uint16_t> faceColors;
+	MeshBuffer<uint16_t> faceMaterials;
+
+	// Per face shapes, empty while all faces are triangles
+	MeshBuffer<FaceShape> faceShapes;
+
+	// Palettes the IDs refer to. Materials are entries of the material table, Materials::none for faces that use the
+	// material of their object
+	std::vector<Vec3> colors;
+	std::vector<MaterialID> materials;
+
+	// Palette IDs are 16 bit, a full palette reuses its closest entry
+	static constexpr size_t maxPaletteSize = 65535;
+
+	// Material palette ID of faces that use the material of their object. Past the largest palette, so it stays
+	// apart from the entries whatever the palette holds
+	static constexpr uint16_t objectMaterial = 0xffff;
+
+	size_t faceCount() const {
+		return faceColors.size();
+	}
+
+	bool empty() const {
+		return faceColors.empty();
+	}
+
+	void clear() {
+		*this = IndexedMesh();
+	}
+
+	void reserve(size_t numVertices, size_t numFaces) {
+		vertices.reserve(numVertices);
+		indices.reserve(numFaces * 3);
+		faceColors.reserve(numFaces);
+		faceMaterials.reserve(numFaces);
+	}
+
+	uint32_t addVertex(const Vec3& v) {
+		vertices.push_back(v);
+		return (uint32_t)(vertices.size() - 1);
+	}
+
+	// Add a face over three existing vertices. For a parallelogram a is the corner and b and c its neighbours
+	void addFace(uint32_t a, uint32_t b, uint32_t c, uint16_t colorID, uint16_t materialID = objectMaterial, FaceShape shape = FaceShape::Triangle) {
+		bool hasShapes = shape != FaceShape::Triangle || !faceShapes.empty();
+		if (hasShapes && faceShapes.empty()) {
+			faceShapes.assign(faceCount(), FaceShape::Triangle);
+		}
+		colorNewVertices(colorID);
+		indices.push_back(a);
+		indices.push_back(b);
+		indices.push_back(c);
+		faceColors.push_back(colorID);
+		faceMaterials.push_back(materialID);
+		if (hasShapes) {
+			faceShapes.push_back(shape);
+		}
+	}
+
+	// Add a face with its own three vertices, for geometry that comes as separate triangles
+	void addTriangle(const Vec3& a, const Vec3& b, const Vec3& c, const Vec3& color, uint16_t materialID = objectMaterial) {
+		uint32_t first = (uint32_t)vertices.size();
+		vertices.push_back(a);
+		vertices.push_back(b);
+		vertices.push_back(c);
+		addFace(first, first + 1, first + 2, colorID(color), materialID);
+	}
+
+	// Add a parallelogram with its own three vertices, spanned by two edges from a corner. The winding is that of
+	// the triangle corner, corner + edgeA, corner + edgeB
+	void addParallelogram(const Vec3& corner, const Vec3& edgeA, const Vec3& edgeB, const Vec3& color, uint16_t materialID = objectMaterial) {
+		uint32_t first = (uint32_t)vertices.size();
+		vertices.push_back(corner);
+		vertices.push_back(corner + edgeA);
+		vertices.push_back(corner + edgeB);
+		addFace(first, first + 1, first + 2, colorID(color), materialID, FaceShape::Parallelogram);
+	}
+
+	// Palette ID of a color, added to the palette if it isn't in it yet. Meshes use few colors and consecutive faces
+	// mostly share one, so the last entry is checked first
+	uint16_t colorID(const Vec3& color) {
+		return paletteID(colors, color);
+	}
+
+	uint16_t materialID(MaterialID material) {
+		return paletteID(materials, material);
+	}
+
+	// Palette ID of a material by name, an empty name is the object's material
+	uint16_t materialID(const std::string& name) {
+		return materialID(name.empty() ? Materials::none : Materials::id(name));
+	}
+
+	const Vec3& vertex(size_t face, int corner) const {
+		return vertices[indices[face * 3 + corner]];
+	}
+
+	bool isParallelogram(size_t face) const {
+		return !faceShapes.empty() && faceShapes[face] == FaceShape::Parallelogram;
+	}
+
+	// Corners of a face in order around it, returns their number, 3 or 4
+	int corners(size_t face, Vec3 out[4]) const {
+		out[0] = vertex(face, 0);
+		out[1] = vertex(face, 1);
+		if (!isParallelogram(face)) {
+			out[2] = vertex(face, 2);
+			return 3;
+		}
+		out[3] = vertex(face, 2);
+		out[2] = out[1] + out[3] - out[0];
+		return 4;
+	}
+
+	double area(size_t face) const {
+		const Vec3& v0 = vertex(face, 0);
+		double parallelogram = (vertex(face, 1) - v0).crossProduct(vertex(face, 2) - v0).getLength();
+		return isParallelogram(face) ? parallelogram : 0.5 * parallelogram;
+	}
+
+	// Point of a face for r1, r2 uniform in [0, 1), uniformly distributed over its area. Triangles fold the half of
+	// the unit square outside them back in
+	Vec3 samplePoint(size_t face, double r1, double r2) const {
+		if (!isParallelogram(face) && r1 + r2 > 1.0) {
+			r1 = 1.0 - r1;
+			r2 = 1.0 - r2;
+		}
+		const Vec3& v0 = vertex(face, 0);
+		return v0 + (vertex(face, 1) - v0) * r1 + (vertex(face, 2) - v0) * r2;
+	}
+
+	const Vec3& color(size_t face) const {
+		return colors[faceColors[face]];
+	}
+
+	// Color at barycentric coordinates u, v of a face, same convention as the triangle hits. Interpolates the vertex
+	// colors if the mesh has them and is the face color otherwise
+	Vec3 color(size_t face, double u, double v) const {
+		if (vertexColors.empty()) {
+			return color(face);
+		}
+		const uint32_t* corner = &indices[face * 3];
+		Vec3 c0 = unpackColor(vertexColors[corner[0]]);
+		Vec3 c1 = unpackColor(vertexColors[corner[1]]);
+		Vec3 c2 = unpackColor(vertexColors[corner[2]]);
+		if (!isParallelogram(face)) {
+			return c0 * (1.0 - u - v) + c1 * u + c2 * v;
+		}
+		// Bilinear over the parallelogram, u and v both run to 1. The implied fourth corner has no vertex and takes
+		// the mean of its two neighbours, so the result stays between the corner colors
+		Vec3 c3 = (c1 + c2) * 0.5;
+		return c0 * ((1.0 - u) * (1.0 - v)) + c1 * (u * (1.0 - v)) + c2 * ((1.0 - u) * v) + c3 * (u * v);
+	}
+
+	// True if the per vertex buffers agree with the vertex count, meshes that fail this can't be shaded or written
+	bool consistent() const {
+		return vertexColors.empty() || vertexColors.size() == vertices.size();
+	}
+
+	// 8 bit per channel RGB in the low three bytes, red lowest, for the 0 to 1 colors the tracer uses
+	static uint32_t packColor(const Vec3& color) {
+		auto channel = [](double c) { return (uint32_t)(std::min(std::max(c, 0.0), 1.0) * 255.0 + 0.5); };
+		return channel(color.x) | channel(color.y) << 8 | channel(color.z) << 16;
+	}
+
+	static Vec3 unpackColor(uint32_t packed) {
+		return Vec3(packed & 0xff, packed >> 8 & 0xff, packed >> 16 & 0xff) * (1.0 / 255.0);
+	}
+
+	// Material of a face, Materials::none if it uses the object's material
+	MaterialID material(size_t face) const {
+		return faceMaterials[face] < materials.size() ? materials[faceMaterials[face]] : Materials::none;
+	}
+
+	// Geometric normal, same winding as Triangle
+	Vec3 normal(size_t face) const {
+		const Vec3& v0 = vertex(face, 0);
+		return (vertex(face, 1) - v0).crossProduct(vertex(face, 2) - v0).normalize();
+	}
+
+	// Moller-Trumbore test of a face in the render precision, with the back face culling of
+	// Triangle::RayTriangleIntersect. True if it is hit closer than tMax, t gets the distance and u, v the coordinates
+	// along its two edges
+	bool intersect(size_t face, const Ray& ray, double tMax, double& t, double& u, double& v) const {
+		TRAVERSAL_STAT(triangleTests);
+		const double EPSILON = 1e-8;
+		const Vec3& v0 = vertex(face, 0);
+		Vec3 edge0 = vertex(face, 1) - v0;
+		Vec3 edge1 = vertex(face, 2) - v0;
+
+		// det is minus the ray direction along the unnormalized face normal
+		Vec3 R1 = ray.direction.crossProduct(edge1);
+		double det = edge0.dotProduct(R1);
+		if (det < EPSILON * edge0.crossProduct(edge1).getLength()) {
+			return false; // ray is parallel or points away from the face
+		}
+
+		Vec3 C3 = ray.origin - v0;
+		Vec3 R2 = C3.crossProduct(edge0);
+		t = edge1.dotProduct(R2) / det;
+		u = C3.dotProduct(R1) / det;
+		v = ray.direction.dotProduct(R2) / det;
+
+		bool inside = isParallelogram(face) ? u <= 1.0 && v <= 1.0 : u + v <= 1.0;
+		return t > EPSILON && t < tMax && u >= 0.0 && v >= 0.0 && inside;
+	}
+
+	AABB faceBounds(size_t face) const {
+		Vec3 verts[4];
+		int numVerts = corners(face, verts);
+		AABB box;
+		for (int i = 0; i < numVerts; ++i) {
+			box.expand(verts[i]);
+		}
+		return box;
+	}
+
+	std::vector<AABB> faceBounds() const {
+		std::vector<AABB> bounds;
+		bounds.reserve(faceCount());
+		for (size_t f = 0; f < faceCount(); ++f) {
+			bounds.push_back(faceBounds(f));
+		}
+		return bounds;
+	}
+
+	// Bounds of the parts of a face on each side of a plane, used by spatial BVH splits
+	void splitFaceBounds(size_t face, int axis, double pos, AABB& left, AABB& right) const {
+		Vec3 verts[4];
+		int numVerts = corners(face, verts);
+		Triangle::splitBounds(verts, numVerts, axis, pos, left, right);
+	}
+
+	// Standalone copy of a triangle face, for tools and reference tests. A parallelogram takes two triangles, see
+	// appendTriangles
+	Triangle triangle(size_t face) const {
+		assert(!isParallelogram(face));
+		return Triangle(vertex(face, 0), vertex(face, 1), vertex(face, 2), color(face));
+	}
+
+	// Append standalone copies covering a face to out, one for a triangle and two for a parallelogram
+	void appendTriangles(size_t face, std::vector<Triangle>& out) const {
+		Vec3 verts[4];
+		int numVerts = corners(face, verts);
+		out.emplace_back(verts[0], verts[1], verts[2], color(face));
+		if (numVerts == 4) {
+			out.emplace_back(verts[0], verts[2], verts[3], color(face));
+		}
+	}
+
+	// Heap bytes, buffers that view a mapped file don't count
+	size_t memoryBytes() const {
+		return vertices.capacity() * sizeof(Vec3) + vertexColors.capacity() * sizeof(uint32_t) + indices.capacity() * sizeof(uint32_t)
+			+ faceColors.capacity() * sizeof(uint16_t) + faceMaterials.capacity() * sizeof(uint16_t) + faceShapes.capacity()
+			+ colors.capacity() * sizeof(Vec3) + materials.capacity() * sizeof(MaterialID);
+	}
+
+private:
+	// Give the vertices added since the last face the color of a face, while the mesh has per vertex colors
+	void colorNewVertices(uint16_t colorID) {
+		if (vertexColors.empty()) {
+			return;
+		}
+		while (vertexColors.size() < vertices.size()) {
+			vertexColors.push_back(packColor(colors[colorID]));
+		}
+	}
+
+	template<typename E>
+	static uint16_t paletteID(std::vector<E>& palette, const E& entry) {
+		if (!palette.empty() && palette.back() == entry) {
+			return (uint16_t)(palette.size() - 1);
+		}
+		for (size_t i = 0; i < palette.size(); ++i) {
+			if (palette[i] == entry) {
+				return (uint16_t)i;
+			}
+		}
+		if (palette.size() < maxPaletteSize) {
+			palette.push_back(entry);
+			return (uint16_t)(palette.size() - 1);
+		}
+		return closestEntry(palette, entry);
+	}
+
+	static uint16_t closestEntry(const std::vector<Vec3>& palette, const Vec3& entry) {
+		size_t best = 0;
+		double bestDist = std::numeric_limits<double>::infinity();
+		for (size_t i = 0; i < palette.size(); ++i) {
+			Vec3 d = palette[i] - entry;
+			if (d.dotProduct(d) < bestDist) {
+				bestDist = d.dotProduct(d);
+				best = i;
+			}
+		}
+		return (uint16_t)best;
+	}
+
+	// Materials have no distance, a full material palette falls back to the first material
+	static uint16_t closestEntry(const std::vector<MaterialID>&, MaterialID) {
+		return 0;
+	}
+};
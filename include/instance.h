@@ -0,0 +1,88 @@
+#pragma once
+
+#include "objectDrawer.h"
+#include "transform.h"
+
+#include <memory>
+#include <string>
+
+/// A placed copy of a TriObj. The mesh, its BVH and packed triangles belong to the shared object, an instance only
+/// holds the transform to the world and its inverse, so copies cost about 200 bytes each whatever the mesh size.
+/// Rays are moved into object space to traverse the shared BVH, hits are moved back to the world
+class Instance {
+public:
+	Instance(const std::shared_ptr<TriObj>& obj, const Transform& objectToWorld)
+		: object(obj), toWorld(objectToWorld), toObject(objectToWorld.inverse()) {
+	}
+
+	const TriObj& getObject() const {
+		return *object;
+	}
+
+	const std::shared_ptr<TriObj>& sharedObject() const {
+		return object;
+	}
+
+	const Transform& objectToWorld() const {
+		return toWorld;
+	}
+
+	// Move the instance, the shared mesh is untouched. The scene's top level has to be updated afterwards
+	void setTransform(const Transform& objectToWorld) {
+		toWorld = objectToWorld;
+		toObject = objectToWorld.inverse();
+	}
+
+	// World bounds of the transformed object bounds, valid once the object's BVH is built
+	AABB bounds() const {
+		return toWorld.applyBounds(object->bounds());
+	}
+
+	// Closest hit closer than the world distance tMax, shrunk to the hit like TriObj::intersect
+	bool intersect(const Ray& ray, double& tMax, PackedTriangles::Hit& hit) const {
+		double scale;
+		Ray local = toObjectSpace(ray, scale);
+
+		// Object space distances are world distances times scale, since the transformed ray is normalized again
+		double tLocal = tMax * scale;
+		if (!object->intersect(local, tLocal, hit)) {
+			return false;
+		}
+		tMax = tLocal / scale;
+		return true;
+	}
+
+	bool occluded(const Ray& ray, double tMax) const {
+		double scale;
+		Ray local = toObjectSpace(ray, scale);
+		return object->occluded(local, tMax * scale);
+	}
+
+	// World space geometric normal of a triangle of the object
+	Vec3 normal(int prim) const {
+		return toObject.applyTransposed(object->normal(prim)).normalize();
+	}
+
+	Vec3 color(int prim, double u = 1.0 / 3.0, double v = 1.0 / 3.0) const {
+		return object->color(prim, u, v);
+	}
+
+	MaterialID getMat(int prim) const {
+		return object->getMat(prim);
+	}
+
+	bool isTransparent() const {
+		return object->isTransparent();
+	}
+
+private:
+	std::shared_ptr<TriObj> object;
+	Transform toWorld, toObject;
+
+	// The ray in object space. scale is the length of its direction before normalization
+	Ray toObjectSpace(const Ray& ray, double& scale) const {
+		Vec3 dir = toObject.applyVector(ray.direction);
+		scale = dir.getLength();
+		return Ray(toObject.applyPoint(ray.origin), dir);
+	}
+};
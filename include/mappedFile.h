@@ -0,0 +1,142 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/// Read-only memory mapping of a whole file. The mapping is released when the object is destroyed. An empty file opens
+/// with size 0 and no mapping, systems don't map zero bytes
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile() {
+		close();
+	}
+
+	// Map the file at path, returns false if it doesn't exist or can't be mapped
+	bool open(const std::string& path) {
+		close();
+
+#if defined(_WIN32)
+		fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (fileHandle == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(fileHandle, &fileSize)) {
+			close();
+			return false;
+		}
+		if (fileSize.QuadPart == 0) {
+			opened = true;
+			return true;
+		}
+		length = (size_t)fileSize.QuadPart;
+
+		mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mappingHandle == nullptr) {
+			close();
+			return false;
+		}
+
+		bytes = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+		if (bytes == nullptr) {
+			close();
+			return false;
+		}
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			::close(fd);
+			return false;
+		}
+		if (st.st_size == 0) {
+			::close(fd);
+			opened = true;
+			return true;
+		}
+		length = (size_t)st.st_size;
+
+		// Readers go through the whole file, so let the kernel fault the pages in up front where it can
+		int flags = MAP_PRIVATE;
+#if defined(MAP_POPULATE)
+		flags |= MAP_POPULATE;
+#endif
+		void* mapping = mmap(nullptr, length, PROT_READ, flags, fd, 0);
+		::close(fd); // the mapping stays valid after the descriptor is closed
+		if (mapping == MAP_FAILED) {
+			length = 0;
+			return false;
+		}
+		bytes = (const unsigned char*)mapping;
+#endif
+		opened = true;
+		return true;
+	}
+
+	void close() {
+#if defined(_WIN32)
+		if (bytes != nullptr) {
+			UnmapViewOfFile(bytes);
+		}
+		if (mappingHandle != nullptr) {
+			CloseHandle(mappingHandle);
+		}
+		if (fileHandle != INVALID_HANDLE_VALUE) {
+			CloseHandle(fileHandle);
+		}
+		mappingHandle = nullptr;
+		fileHandle = INVALID_HANDLE_VALUE;
+#else
+		if (bytes != nullptr) {
+			munmap((void*)bytes, length);
+		}
+#endif
+		bytes = nullptr;
+		length = 0;
+		opened = false;
+	}
+
+	bool isOpen() const {
+		return opened;
+	}
+
+	const unsigned char* data() const {
+		return bytes;
+	}
+
+	size_t size() const {
+		return length;
+	}
+
+private:
+	const unsigned char* bytes = nullptr;
+	size_t length = 0;
+	bool opened = false;
+
+#if defined(_WIN32)
+	HANDLE fileHandle = INVALID_HANDLE_VALUE;
+	HANDLE mappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "vec3.h"
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+/// How the tracer shades a surface, switched on once per hit
+enum class MaterialType : uint8_t {
+	Diffuse,
+	Mirror,
+	Glass,
+	Emissive
+};
+
+/// Index into the material table, see Materials
+using MaterialID = uint16_t;
+
+/// Typed parameters of a material. The albedo scales the surface color, ior is the refraction index of glass and the
+/// emission scales the scene's light color and intensity for lights made of the material
+struct Material {
+	std::string name;
+	MaterialType type = MaterialType::Diffuse;
+	Vec3 albedo = Vec3(1.0, 1.0, 1.0);
+	double ior = 1.5;
+	Vec3 emission = Vec3(0.0, 0.0, 0.0);
+
+	bool operator==(const Material& other) const {
+		return name == other.name && type == other.type && albedo.x == other.albedo.x && albedo.y == other.albedo.y &&
+			albedo.z == other.albedo.z && ior == other.ior && emission.x == other.emission.x &&
+			emission.y == other.emission.y && emission.z == other.emission.z;
+	}
+};
+
+/// Process-wide material table. Objects, faces and spheres hold a MaterialID and shading reads the parameters by
+/// index, so no name is compared or copied per hit. The built-in materials have fixed IDs under the names the scenes
+/// use, DIFFUSE, MIRROR, GLASS and EMISSIVE. Materials are added while scenes are built and entries never move or
+/// change, so rendering threads read the table without locking as long as nothing is added during a render
+class Materials {
+public:
+	static constexpr MaterialID diffuse = 0;
+	static constexpr MaterialID mirror = 1;
+	static constexpr MaterialID glass = 2;
+	static constexpr MaterialID emissive = 3;
+
+	// Per-face material that stands for the material of the object, see IndexedMesh::materials
+	static constexpr MaterialID none = 0xffff;
+
+	// The table holds at most this many materials, later ones fall back to the material of their name
+	static constexpr size_t maxMaterials = 0xfff0;
+
+	static const Material& get(MaterialID id) {
+		return table()[id];
+	}
+
+	// ID of the first material with this name. Unknown names are added as diffuse, like any material the tracer
+	// doesn't know shades
+	static MaterialID id(const std::string& name) {
+		std::lock_guard<std::mutex> lock(mutex());
+		auto& materials = table();
+		for (size_t i = 0; i < materials.size(); ++i) {
+			if (materials[i].name == name) {
+				return (MaterialID)i;
+			}
+		}
+		return append(materials, Material{ name });
+	}
+
+	// ID of a material with exactly these parameters, added if the table doesn't have it yet. Loading the same file
+	// twice gives the same IDs
+	static MaterialID add(const Material& material) {
+		std::lock_guard<std::mutex> lock(mutex());
+		auto& materials = table();
+		for (size_t i = 0; i < materials.size(); ++i) {
+			if (materials[i] == material) {
+				return (MaterialID)i;
+			}
+		}
+		if (materials.size() >= maxMaterials) {
+			for (size_t i = 0; i < materials.size(); ++i) {
+				if (materials[i].name == material.name) {
+					return (MaterialID)i;
+				}
+			}
+		}
+		return append(materials, material);
+	}
+
+	static bool isTransparent(MaterialID id) {
+		return get(id).type == MaterialType::Glass;
+	}
+
+	static size_t size() {
+		std::lock_guard<std::mutex> lock(mutex());
+		return table().size();
+	}
+
+private:
+	// A deque keeps the entries in place as the table grows
+	static std::deque<Material>& table() {
+		static std::deque<Material> materials = {
+			{ "DIFFUSE", MaterialType::Diffuse },
+			{ "MIRROR", MaterialType::Mirror },
+			{ "GLASS", MaterialType::Glass },
+			{ "EMISSIVE", MaterialType::Emissive, Vec3(1.0, 1.0, 1.0), 1.5, Vec3(1.0, 1.0, 1.0) }
+		};
+		return materials;
+	}
+
+	static std::mutex& mutex() {
+		static std::mutex m;
+		return m;
+	}
+
+	static MaterialID append(std::deque<Material>& materials, const Material& material) {
+		if (materials.size() >= maxMaterials) {
+			return diffuse;
+		}
+		materials.push_back(material);
+		return (MaterialID)(materials.size() - 1);
+	}
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <type_traits>
+
+/// Array of mesh data that either owns its elements or views memory kept alive by someone else, such as a mapped
+/// scene file. Reads go through one pointer either way. The first modification of a view copies it into owned
+/// storage, so a loaded mesh can still be animated or edited. Has the std::vector operations the meshes use
+template<typename T>
+class MeshBuffer {
+	static_assert(std::is_trivially_copyable<T>::value, "mesh buffers are written to and viewed from files as raw bytes");
+
+public:
+	MeshBuffer() = default;
+
+	MeshBuffer(const MeshBuffer& other) : owned(other.owned), owner(other.owner) {
+		if (owner) {
+			ptr = other.ptr;
+			count = other.count;
+		}
+		else {
+			sync();
+		}
+	}
+
+	MeshBuffer(MeshBuffer&& other) noexcept : owned(std::move(other.owned)), owner(std::move(other.owner)) {
+		if (owner) {
+			ptr = other.ptr;
+			count = other.count;
+		}
+		else {
+			sync();
+		}
+		other.owned.clear();
+		other.sync();
+	}
+
+	MeshBuffer& operator=(const MeshBuffer& other) {
+		if (this != &other) {
+			MeshBuffer copy(other);
+			*this = std::move(copy);
+		}
+		return *this;
+	}
+
+	MeshBuffer& operator=(MeshBuffer&& other) noexcept {
+		if (this != &other) {
+			owned = std::move(other.owned);
+			owner = std::move(other.owner);
+			if (owner) {
+				ptr = other.ptr;
+				count = other.count;
+			}
+			else {
+				sync();
+			}
+			other.owned.clear();
+			other.sync();
+		}
+		return *this;
+	}
+
+	// View count elements at data, owner keeps the memory alive for as long as the view or a copy of it exists
+	static MeshBuffer view(const T* data, size_t count, std::shared_ptr<const void> owner) {
+		MeshBuffer buffer;
+		buffer.ptr = const_cast<T*>(data); // never written through, writes copy the view first
+		buffer.count = count;
+		buffer.owner = std::move(owner);
+		return buffer;
+	}
+
+	bool isView() const {
+		return owner != nullptr;
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	// Owned elements allocated, a view owns none
+	size_t capacity() const {
+		return owned.capacity();
+	}
+
+	const T* data() const {
+		return ptr;
+	}
+
+	const T& operator[](size_t i) const {
+		return ptr[i];
+	}
+
+	const T* begin() const {
+		return ptr;
+	}
+
+	const T* end() const {
+		return ptr + count;
+	}
+
+	// Writable access, copies a view first
+	T* data() {
+		makeOwned();
+		return ptr;
+	}
+
+	T& operator[](size_t i) {
+		makeOwned();
+		return ptr[i];
+	}
+
+	T* begin() {
+		makeOwned();
+		return ptr;
+	}
+
+	T* end() {
+		makeOwned();
+		return ptr + count;
+	}
+
+	void push_back(const T& value) {
+		makeOwned();
+		owned.push_back(value);
+		sync();
+	}
+
+	void reserve(size_t n) {
+		makeOwned();
+		owned.reserve(n);
+		sync();
+	}
+
+	void resize(size_t n) {
+		makeOwned();
+		owned.resize(n);
+		sync();
+	}
+
+	void assign(size_t n, const T& value) {
+		owner.reset();
+		owned.assign(n, value);
+		sync();
+	}
+
+	void clear() {
+		owner.reset();
+		owned.clear();
+		sync();
+	}
+
+private:
+	std::vector<T> owned;
+	T* ptr = nullptr;
+	size_t count = 0;
+
+	// Set for views, holds what the viewed memory belongs to
+	std::shared_ptr<const void> owner;
+
+	void sync() {
+		ptr = owned.data();
+		count = owned.size();
+	}
+
+	void makeOwned() {
+		if (owner) {
+			owned.assign(ptr, ptr + count);
+			owner.reset();
+			sync();
+		}
+	}
+};
@@ -0,0 +1,435 @@
+#pragma once
+
+#include "objectDrawer.h"
+#include "mappedFile.h"
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+/// Wavefront OBJ loader producing an indexed TriObj. The file is memory mapped and split at line boundaries into one
+/// chunk per thread. A first parallel pass only counts the vertices and triangles of every chunk, so the mesh buffers
+/// are allocated once at their final size and each chunk knows where its vertices and faces go. The second parallel
+/// pass parses straight into those buffers. Lines are read as views into the mapping, nothing is allocated per line.
+/// Polygons are triangulated as fans, texture coordinates and normals are skipped. Materials come from the MTL files
+/// named by mtllib, their diffuse color becomes the face color and they are added to the material table with the type
+/// tracerMaterial gives them, their refraction index and their emission
+class ObjLoader {
+public:
+	// Threads used for parsing, 0 uses one per hardware thread
+	int numThreads = 0;
+
+	// Files smaller than this are parsed on the calling thread, starting threads would take longer
+	static constexpr size_t minBytesPerThread = 1 << 20;
+
+	// Reason the last load failed
+	std::string error;
+
+	// Load the OBJ file at path into obj, replacing its mesh. Faces without an MTL material use the object's material
+	// and an empty file gives an empty mesh. Returns false and sets error if the file can't be read or a face
+	// references a vertex that doesn't exist. The BVH has to be built afterwards
+	bool load(const std::string& path, TriObj& obj) {
+		error.clear();
+		MappedFile file;
+		if (!file.open(path)) {
+			error = "cannot open " + path;
+			return false;
+		}
+		const char* text = (const char*)file.data();
+		const char* end = text + file.size();
+
+		std::vector<Chunk> chunks = splitChunks(text, end);
+
+		// Pass 1, count what every chunk holds and give it its range of the mesh buffers
+		runParallel(chunks, [](Chunk& chunk) { countChunk(chunk); });
+		size_t numVertices = 0, numFaces = 0;
+		for (Chunk& chunk : chunks) {
+			chunk.firstVertex = numVertices;
+			chunk.firstFace = numFaces;
+			numVertices += chunk.numVertices;
+			numFaces += chunk.numFaces;
+		}
+		if (numVertices > UINT32_MAX) {
+			error = path + " has more vertices than 32 bit indices can address";
+			return false;
+		}
+
+		IndexedMesh& mesh = obj.mesh;
+		mesh.clear();
+		mesh.vertices.resize(numVertices);
+		mesh.indices.resize(numFaces * 3);
+
+		// Pass 2, parse every chunk into its range
+		runParallel(chunks, [&](Chunk& chunk) { parseChunk(chunk, mesh, numVertices); });
+		for (const Chunk& chunk : chunks) {
+			if (chunk.badIndex) {
+				mesh.clear();
+				error = path + " has a face referencing a vertex that doesn't exist";
+				return false;
+			}
+		}
+
+		assignMaterials(chunks, path, mesh);
+		return true;
+	}
+
+	// Tracer material type of an MTL material. Emitting materials are lights, materials that let light through are
+	// glass, polished ones (illum 3 or a strong specular color without diffuse) are mirrors and everything else is diffuse
+	static MaterialType tracerMaterial(const Vec3& kd, const Vec3& ks, const Vec3& ke, double dissolve, int illum) {
+		if (ke.x + ke.y + ke.z > 0.0) {
+			return MaterialType::Emissive;
+		}
+		if (dissolve < 1.0 || illum == 4 || illum == 6 || illum == 7 || illum == 9) {
+			return MaterialType::Glass;
+		}
+		if (illum == 3 || (ks.x + ks.y + ks.z > 2.0 && kd.x + kd.y + kd.z < 0.1)) {
+			return MaterialType::Mirror;
+		}
+		return MaterialType::Diffuse;
+	}
+
+private:
+	// Range of the file parsed by one thread and the part of the mesh it fills
+	struct Chunk {
+		const char* begin = nullptr;
+		const char* end = nullptr;
+		size_t numVertices = 0, numFaces = 0;
+		size_t firstVertex = 0, firstFace = 0;
+
+		// usemtl lines as the chunk-local face they apply from and the name, a view into the mapping
+		std::vector<std::pair<size_t, std::string_view>> materialSwitches;
+		std::vector<std::string_view> libraries;
+		bool badIndex = false;
+	};
+
+	// Material of an MTL file, reduced to what the tracer uses. id is its entry in the material table, added when a
+	// face first uses it
+	struct MtlMaterial {
+		Vec3 color = Vec3(0.8, 0.8, 0.8);
+		Material material;
+		MaterialID id = Materials::none;
+	};
+
+	std::vector<Chunk> splitChunks(const char* text, const char* end) const {
+		size_t size = (size_t)(end - text);
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		size_t threads = numThreads > 0 ? (size_t)numThreads : (hardwareThreads > 0 ? hardwareThreads : 4);
+		threads = std::max<size_t>(1, std::min(threads, size / minBytesPerThread));
+
+		std::vector<Chunk> chunks;
+		const char* begin = text;
+		for (size_t i = 1; i <= threads && begin < end; ++i) {
+			const char* split = i == threads ? end : text + size * i / threads;
+			split = std::max(split, begin);
+			while (split < end && split > text && split[-1] != '\n') {
+				++split; // chunks end after a newline so no line is cut in two
+			}
+			chunks.emplace_back();
+			chunks.back().begin = begin;
+			chunks.back().end = split;
+			begin = split;
+		}
+		return chunks;
+	}
+
+	template<typename F>
+	static void runParallel(std::vector<Chunk>& chunks, F&& work) {
+		std::vector<std::thread> workers;
+		for (size_t i = 1; i < chunks.size(); ++i) {
+			workers.emplace_back([&, i]() { work(chunks[i]); });
+		}
+		if (!chunks.empty()) {
+			work(chunks[0]); // the calling thread takes the first chunk
+		}
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	static bool isSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	// Line starting at p, without its newline, and p moved to the next line
+	static std::string_view nextLine(const char*& p, const char* end) {
+		const char* lineEnd = (const char*)std::memchr(p, '\n', (size_t)(end - p));
+		if (lineEnd == nullptr) {
+			lineEnd = end;
+		}
+		std::string_view line(p, (size_t)(lineEnd - p));
+		p = lineEnd < end ? lineEnd + 1 : end;
+		return line;
+	}
+
+	// Next whitespace separated token of a line, empty at the end of the line or at a comment
+	static std::string_view nextToken(std::string_view& line) {
+		size_t i = 0;
+		while (i < line.size() && isSpace(line[i])) {
+			++i;
+		}
+		if (i == line.size() || line[i] == '#') {
+			line = std::string_view();
+			return line;
+		}
+		size_t start = i;
+		while (i < line.size() && !isSpace(line[i])) {
+			++i;
+		}
+		std::string_view token = line.substr(start, i - start);
+		line.remove_prefix(i);
+		return token;
+	}
+
+	static void countChunk(Chunk& chunk) {
+		const char* p = chunk.begin;
+		while (p < chunk.end) {
+			std::string_view line = nextLine(p, chunk.end);
+			std::string_view keyword = nextToken(line);
+			if (keyword == "v") {
+				++chunk.numVertices;
+			}
+			else if (keyword == "f") {
+				int corners = 0;
+				while (!nextToken(line).empty()) {
+					++corners;
+				}
+				chunk.numFaces += corners > 2 ? corners - 2 : 0;
+			}
+		}
+	}
+
+	static void parseChunk(Chunk& chunk, IndexedMesh& mesh, size_t numVertices) {
+		size_t vertex = chunk.firstVertex;
+		size_t face = chunk.firstFace;
+		const char* p = chunk.begin;
+
+		while (p < chunk.end) {
+			std::string_view line = nextLine(p, chunk.end);
+			std::string_view keyword = nextToken(line);
+			if (keyword == "v") {
+				Real coords[3] = { 0, 0, 0 };
+				for (Real& c : coords) {
+					c = (Real)parseReal(nextToken(line));
+				}
+				mesh.vertices[vertex++] = Vec3(coords[0], coords[1], coords[2]);
+			}
+			else if (keyword == "f") {
+				// Negative indices count back from the last vertex defined before the face
+				uint32_t corners[3];
+				int numCorners = 0;
+				for (std::string_view token = nextToken(line); !token.empty(); token = nextToken(line)) {
+					long long index = parseIndex(token);
+					long long resolved = index < 0 ? (long long)vertex + index : index - 1;
+					if (index == 0 || resolved < 0 || resolved >= (long long)numVertices) {
+						chunk.badIndex = true;
+						resolved = 0;
+					}
+
+					// Fan triangulation, (first, previous, current) for every corner after the second
+					if (numCorners < 2) {
+						corners[numCorners++] = (uint32_t)resolved;
+						continue;
+					}
+					corners[2] = (uint32_t)resolved;
+					std::memcpy(&mesh.indices[face * 3], corners, sizeof(corners));
+					++face;
+					corners[1] = corners[2];
+				}
+			}
+			else if (keyword == "usemtl") {
+				chunk.materialSwitches.emplace_back(face - chunk.firstFace, nextToken(line));
+			}
+			else if (keyword == "mtllib") {
+				for (std::string_view name = nextToken(line); !name.empty(); name = nextToken(line)) {
+					chunk.libraries.push_back(name);
+				}
+			}
+		}
+	}
+
+	// Vertex index of a face corner, the part before the first slash of v, v/vt, v//vn or v/vt/vn. 0 if invalid
+	static long long parseIndex(std::string_view token) {
+		size_t i = 0;
+		bool negative = !token.empty() && token[0] == '-';
+		if (negative) {
+			++i;
+		}
+		long long value = 0;
+		size_t firstDigit = i;
+		for (; i < token.size() && token[i] >= '0' && token[i] <= '9'; ++i) {
+			value = value * 10 + (token[i] - '0');
+		}
+		if (i == firstDigit || (i < token.size() && token[i] != '/')) {
+			return 0;
+		}
+		return negative ? -value : value;
+	}
+
+	/// Decimal number of a token. Up to 19 significant digits with a small exponent take the exact path, a mantissa
+	/// that fits a double times an exact power of ten. Anything else goes through strtod on a copy in a stack buffer
+	static double parseReal(std::string_view token) {
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+		size_t i = 0;
+		bool negative = false;
+		if (i < token.size() && (token[i] == '-' || token[i] == '+')) {
+			negative = token[i++] == '-';
+		}
+		uint64_t mantissa = 0;
+		int digits = 0, exponent = 0;
+		for (; i < token.size() && token[i] >= '0' && token[i] <= '9'; ++i, ++digits) {
+			mantissa = mantissa * 10 + (uint64_t)(token[i] - '0');
+		}
+		if (i < token.size() && token[i] == '.') {
+			for (++i; i < token.size() && token[i] >= '0' && token[i] <= '9'; ++i, ++digits) {
+				mantissa = mantissa * 10 + (uint64_t)(token[i] - '0');
+				--exponent;
+			}
+		}
+		if (i < token.size() && (token[i] == 'e' || token[i] == 'E')) {
+			size_t e = i + 1;
+			bool negativeExp = e < token.size() && token[e] == '-';
+			if (e < token.size() && (token[e] == '-' || token[e] == '+')) {
+				++e;
+			}
+			int value = 0;
+			size_t firstDigit = e;
+			for (; e < token.size() && token[e] >= '0' && token[e] <= '9' && value < 10000; ++e) {
+				value = value * 10 + (token[e] - '0');
+			}
+			if (e > firstDigit) {
+				exponent += negativeExp ? -value : value;
+				i = e;
+			}
+		}
+
+		if (i == token.size() && digits > 0 && digits <= 19 && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22) {
+			double value = (double)mantissa;
+			value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+			return negative ? -value : value;
+		}
+
+		char buffer[64];
+		size_t length = std::min(token.size(), sizeof(buffer) - 1);
+		std::memcpy(buffer, token.data(), length);
+		buffer[length] = '\0';
+		return std::strtod(buffer, nullptr);
+	}
+
+	// Vec3 of the numbers following the keyword of an MTL line
+	static Vec3 parseVec3(std::string_view& line) {
+		double x = parseReal(nextToken(line));
+		double y = parseReal(nextToken(line));
+		double z = parseReal(nextToken(line));
+		return Vec3(x, y, z);
+	}
+
+	// Append the materials of an MTL file, files that can't be opened are skipped and their faces get the defaults
+	static void loadMaterials(const std::string& path, std::vector<MtlMaterial>& materials) {
+		MappedFile file;
+		if (!file.open(path)) {
+			return;
+		}
+		const char* p = (const char*)file.data();
+		const char* end = p + file.size();
+
+		Vec3 kd(0.8, 0.8, 0.8), ks, ke;
+		double dissolve = 1.0, ior = 1.5;
+		int illum = 2;
+		auto finish = [&]() {
+			if (!materials.empty()) {
+				Material& material = materials.back().material;
+				materials.back().color = kd;
+				material.type = tracerMaterial(kd, ks, ke, dissolve, illum);
+				material.ior = ior > 0.0 ? ior : 1.5;
+				material.emission = ke;
+			}
+		};
+
+		while (p < end) {
+			std::string_view line = nextLine(p, end);
+			std::string_view keyword = nextToken(line);
+			if (keyword == "newmtl") {
+				finish();
+				materials.emplace_back();
+				materials.back().material.name = std::string(nextToken(line));
+				kd = Vec3(0.8, 0.8, 0.8);
+				ks = ke = Vec3();
+				dissolve = 1.0;
+				ior = 1.5;
+				illum = 2;
+			}
+			else if (keyword == "Kd") {
+				kd = parseVec3(line);
+			}
+			else if (keyword == "Ks") {
+				ks = parseVec3(line);
+			}
+			else if (keyword == "Ke") {
+				ke = parseVec3(line);
+			}
+			else if (keyword == "d") {
+				dissolve = parseReal(nextToken(line));
+			}
+			else if (keyword == "Tr") {
+				dissolve = 1.0 - parseReal(nextToken(line));
+			}
+			else if (keyword == "Ni") {
+				ior = parseReal(nextToken(line));
+			}
+			else if (keyword == "illum") {
+				illum = (int)parseIndex(nextToken(line));
+			}
+		}
+		finish();
+	}
+
+	// Read the MTL libraries and give every face the color and material of the usemtl in effect for it. Faces before
+	// the first usemtl, or with a material no library defines, keep the default color and the object's material
+	static void assignMaterials(const std::vector<Chunk>& chunks, const std::string& objPath, IndexedMesh& mesh) {
+		std::string directory = objPath.substr(0, objPath.find_last_of("/\\") + 1);
+		std::vector<MtlMaterial> materials;
+		for (const Chunk& chunk : chunks) {
+			for (std::string_view library : chunk.libraries) {
+				loadMaterials(directory + std::string(library), materials);
+			}
+		}
+
+		const uint16_t defaultColor = mesh.colorID(Vec3(0.8, 0.8, 0.8));
+		const uint16_t defaultMaterial = IndexedMesh::objectMaterial;
+		mesh.faceColors.assign(mesh.indices.size() / 3, defaultColor);
+		mesh.faceMaterials.assign(mesh.indices.size() / 3, defaultMaterial);
+
+		// Material switches in file order, a switch lasts until the next one, which may be in a later chunk
+		std::vector<std::pair<size_t, std::string_view>> switches;
+		for (const Chunk& chunk : chunks) {
+			for (const auto& s : chunk.materialSwitches) {
+				switches.emplace_back(chunk.firstFace + s.first, s.second);
+			}
+		}
+
+		for (size_t i = 0; i < switches.size(); ++i) {
+			size_t first = switches[i].first;
+			size_t last = i + 1 < switches.size() ? switches[i + 1].first : mesh.faceColors.size();
+			auto material = std::find_if(materials.begin(), materials.end(),
+				[&](const MtlMaterial& m) { return m.material.name == switches[i].second; });
+
+			uint16_t color = defaultColor, materialID = defaultMaterial;
+			if (material != materials.end()) {
+				if (material->id == Materials::none) {
+					material->id = Materials::add(material->material);
+				}
+				color = mesh.colorID(material->color);
+				materialID = mesh.materialID(material->id);
+			}
+			std::fill(mesh.faceColors.begin() + first, mesh.faceColors.begin() + last, color);
+			std::fill(mesh.faceMaterials.begin() + first, mesh.faceMaterials.begin() + last, materialID);
+		}
+	}
+};
@@ -1,41 +1,61 @@
 #pragma once
 
 #include "vec3.h"
+#include "ray.h"
 #include "triangle.h"
-
-class Sphere {
+#include "bvh.h"
+#include "bvhCache.h"
+#include "indexedMesh.h"
+#include "packedTriangles.h"
+#include "material.h"
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+/// Sphere primitive, templated on the scalar type like the triangles
+template<typename T>
+class SphereT {
 public:
-	Sphere(const Vec3& c, double r, const Vec3& col, const std::string mat) : centerPoint(c), radius(r), color(col), material(mat) {}
+	SphereT(const Vec3T<T>& c, T r, const Vec3T<T>& col, MaterialID mat) : centerPoint(c), radius(r), color(col), material(mat) {}
+
+	// Material by name, see Materials::id
+	SphereT(const Vec3T<T>& c, T r, const Vec3T<T>& col, const std::string& mat) : SphereT(c, r, col, Materials::id(mat)) {}
 
 	// Ray intersection test for spheres 
-	double RaySphereIntersection(const Ray& ray) const {
+	T RaySphereIntersection(const RayT<T>& ray) const {
+		TRAVERSAL_STAT(sphereTests);
 
 		// Distance vector between sphere center and the start point of the ray (camera)
-		Vec3 L = centerPoint - ray.origin;
+		Vec3T<T> L = centerPoint - ray.origin;
 
 		// If the distance vector L and the ray direction are parallel, then their dot product will be negative and 
 		// intersection not occur
-		double t_ca = L.dotProduct(ray.direction);
+		T t_ca = L.dotProduct(ray.direction);
 		if (t_ca < 0) {
 			return -1.0;
 		}
 
 		// d2 is the vector length between vector B and the ray in Figure in lec 3
-		double d2 = L.dotProduct(L) - t_ca * t_ca;
+		T d2 = L.dotProduct(L) - t_ca * t_ca;
 
 		// Sphere radius squared
-		double r2 = radius * radius;
+		T r2 = radius * radius;
 
 		if (d2 > r2) {
 			return -1.0;  // ray misses sphere
 		}
 
 		// Compute hte offset 
-		double t_hc = sqrt(r2 - d2);
+		T t_hc = sqrt(r2 - d2);
 
 		// Compute the intersection points t0 and t1, two since ray must enter and leave the sphere
-		double t0 = t_ca - t_hc;
-		double t1 = t_ca + t_hc;
+		T t0 = t_ca - t_hc;
+		T t1 = t_ca + t_hc;
 
 		if (t0 > 0) {
 			return t0;
@@ -47,109 +67,422 @@ public:
 		return -1.0;
 	}
 
-	Vec3 centerPoint;
-	double radius;
-	Vec3 color;
-	std::string material;
+	// Bounding box of the sphere, used by the scene top-level BVH
+	AABB bounds() const {
+		Vec3T<T> r(radius, radius, radius);
+		return AABB(Vec3(centerPoint - r), Vec3(centerPoint + r));
+	}
+
+	Vec3T<T> centerPoint;
+	T radius;
+	Vec3T<T> color;
+	MaterialID material;
 
     bool isTransparent() const {
-        return material == "GLASS";
+        return Materials::isTransparent(material);
     }
 };
 
+using Sphere = SphereT<Real>;
+
 class TriObj {
 public:
-	std::vector<Triangle> triangles;
+	// Shared vertex and index buffers of the object's triangles
+	IndexedMesh mesh;
 
-	// Directly create triangle
+	// Directly create triangle, it gets its own three vertices
 	void addTriangle(const Triangle& tri) {
-		triangles.push_back(tri);
+		mesh.addTriangle(Vec3(tri.v0), Vec3(tri.v1), Vec3(tri.v2), Vec3(tri.color));
+	}
+
+	// Add a parallelogram spanned by two edges from a corner, it gets its own three vertices
+	void addParallelogram(const Vec3& corner, const Vec3& edgeA, const Vec3& edgeB, const Vec3& color) {
+		mesh.addParallelogram(corner, edgeA, edgeB, color);
+	}
+
+	size_t triangleCount() const {
+		return mesh.faceCount();
 	}
 
 	// Creates a cube based on a centre point and side length
 	void createCube(const Vec3& centre, const double& length, const Vec3& color) {
 		double centerDist = length / 2;
 
-		Vec3 v0((centre.x - centerDist), (centre.y + centerDist), (centre.z - centerDist));
-		Vec3 v1((centre.x - centerDist), (centre.y - centerDist), (centre.z - centerDist));
-		Vec3 v2((centre.x - centerDist), (centre.y + centerDist), (centre.z + centerDist));
-		Vec3 v3((centre.x - centerDist), (centre.y - centerDist), (centre.z + centerDist));
-		Vec3 v4((centre.x + centerDist), (centre.y + centerDist), (centre.z - centerDist));
-		Vec3 v5((centre.x + centerDist), (centre.y - centerDist), (centre.z - centerDist));
-		Vec3 v6((centre.x + centerDist), (centre.y + centerDist), (centre.z + centerDist));
-		Vec3 v7((centre.x + centerDist), (centre.y - centerDist), (centre.z + centerDist));
+		uint32_t base = (uint32_t)mesh.vertices.size();
+		mesh.addVertex(Vec3((centre.x - centerDist), (centre.y + centerDist), (centre.z - centerDist)));
+		mesh.addVertex(Vec3((centre.x - centerDist), (centre.y - centerDist), (centre.z - centerDist)));
+		mesh.addVertex(Vec3((centre.x - centerDist), (centre.y + centerDist), (centre.z + centerDist)));
+		mesh.addVertex(Vec3((centre.x - centerDist), (centre.y - centerDist), (centre.z + centerDist)));
+		mesh.addVertex(Vec3((centre.x + centerDist), (centre.y + centerDist), (centre.z - centerDist)));
+		mesh.addVertex(Vec3((centre.x + centerDist), (centre.y - centerDist), (centre.z - centerDist)));
+		mesh.addVertex(Vec3((centre.x + centerDist), (centre.y + centerDist), (centre.z + centerDist)));
+		mesh.addVertex(Vec3((centre.x + centerDist), (centre.y - centerDist), (centre.z + centerDist)));
+
+		uint16_t col = mesh.colorID(color);
+		// Every side is one parallelogram, a corner and its two neighbours on the side
+		auto face = [&](uint32_t a, uint32_t b, uint32_t c) { mesh.addFace(base + a, base + b, base + c, col, IndexedMesh::objectMaterial, FaceShape::Parallelogram); };
 
 		//Front
-		triangles.push_back(Triangle(v0, v1, v3, color));
-		triangles.push_back(Triangle(v0, v3, v2, color));
+		face(0, 1, 2);
 
 		//Left
-		triangles.push_back(Triangle(v0, v2, v6, color));
-		triangles.push_back(Triangle(v0, v6, v4, color));
+		face(0, 2, 4);
 
 		// Bottom
-		triangles.push_back(Triangle(v0, v5, v1, color));
-		triangles.push_back(Triangle(v0, v4, v5, color));
+		face(0, 4, 1);
 
 		// Right
-		triangles.push_back(Triangle(v1, v7, v3, color));
-		triangles.push_back(Triangle(v1, v5, v7, color));
+		face(1, 5, 3);
 
 		// Back
-		triangles.push_back(Triangle(v4, v6, v7, color));
-		triangles.push_back(Triangle(v4, v7, v5, color));
+		face(4, 6, 5);
 
 		// Top
-		triangles.push_back(Triangle(v2, v3, v7, color));
-		triangles.push_back(Triangle(v6, v2, v7, color));
+		face(2, 3, 6);
 	}
 
 	// Creates a tetrahedron based on four verticies
 	void createTetra(const Vec3& v0, const Vec3& v1, const Vec3& v2, const Vec3& v3, const Vec3& color) {
-		triangles.push_back(Triangle(v0, v1, v2, color));
-		triangles.push_back(Triangle(v0, v2, v3, color));
-		triangles.push_back(Triangle(v0, v3, v1, color));
-		triangles.push_back(Triangle(v1, v3, v2, color));
+		uint32_t a = mesh.addVertex(v0);
+		uint32_t b = mesh.addVertex(v1);
+		uint32_t c = mesh.addVertex(v2);
+		uint32_t d = mesh.addVertex(v3);
+		uint16_t col = mesh.colorID(color);
+		mesh.addFace(a, b, c, col);
+		mesh.addFace(a, c, d, col);
+		mesh.addFace(a, d, b, col);
+		mesh.addFace(b, d, c, col);
 	}
 
-	bool intersect(const Ray& ray, double& tHit, Vec3& outNormal, Vec3& outColor) const{
-		bool hit = false;
-		double tClosest = std::numeric_limits<double>::infinity();
+	// Creates a tessellated sphere from rings x (2 * rings) quads, about 4 * rings^2 triangles. Neighbouring quads
+	// share their vertices and each pole is a single vertex
+	void createSphereMesh(const Vec3& centre, const double& radius, int rings, const Vec3& color) {
+		int segments = 2 * rings;
+
+		// Point on the sphere at ring i (pole to pole) and segment j (around the equator)
+		auto spherePoint = [&](int i, int j) {
+			double theta = M_PI * i / rings;
+			double phi = 2.0 * M_PI * j / segments;
+			return centre + Vec3(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta)) * radius;
+		};
+
+		// Vertex layout: north pole, the rings - 1 inner rings of segments vertices, south pole
+		uint32_t base = (uint32_t)mesh.vertices.size();
+		mesh.reserve(mesh.vertices.size() + (size_t)(rings - 1) * segments + 2, mesh.faceCount() + (size_t)4 * rings * rings);
+		mesh.addVertex(spherePoint(0, 0));
+		for (int i = 1; i < rings; ++i) {
+			for (int j = 0; j < segments; ++j) {
+				mesh.addVertex(spherePoint(i, j));
+			}
+		}
+		mesh.addVertex(spherePoint(rings, 0));
 
-		// Loop all triangles and check for intersection
-		for (const auto& tri : triangles) {
-			double t = Triangle::RayTriangleIntersect(ray.origin, ray.direction, tri);
-
-			// If there is an intersection and its the closest one, store it and take the color
-			if (t > 0.0 && t < tClosest) {
-				hit = true;
-				tClosest = t;
-				outColor = tri.color;
-				outNormal = tri.normal;
-				if (outNormal.dotProduct(ray.direction) > 0.0) {
-					outNormal = outNormal * -1.0; // flip so it faces the incoming ray
+		auto vertexIndex = [&](int i, int j) -> uint32_t {
+			if (i == 0) {
+				return base;
+			}
+			if (i == rings) {
+				return base + 1 + (uint32_t)((rings - 1) * segments);
+			}
+			return base + 1 + (uint32_t)((i - 1) * segments + j % segments);
+		};
+
+		uint16_t col = mesh.colorID(color);
+		for (int i = 0; i < rings; ++i) {
+			for (int j = 0; j < segments; ++j) {
+				uint32_t a = vertexIndex(i, j);
+				uint32_t b = vertexIndex(i + 1, j);
+				uint32_t c = vertexIndex(i + 1, j + 1);
+				uint32_t d = vertexIndex(i, j + 1);
+
+				// The quads at the poles collapse into a single triangle
+				if (i != 0) {
+					mesh.addFace(a, b, d, col);
+				}
+				if (i != rings - 1) {
+					mesh.addFace(b, c, d, col);
 				}
 			}
 		}
-		if (hit) {
-			tHit = tClosest;
+	}
+
+	// Build the bottom-level BVH over the object's triangles, has to be called again after the triangles change.
+	// With a cache, a tree previously built from the same triangles and builder is loaded instead
+	void buildBVH(BVHBuilder builder = BVHBuilder::SAH, BVHLayout layout = BVHLayout::Wide, const BVHCache* cache = nullptr) {
+		blas.leafBatchSize = leafBatchSize;
+		uint64_t key = 0;
+		if (cache) {
+			key = geometryHash();
+			key = hashBytes(&builder, sizeof(builder), key);
+			key = hashBytes(&blas.leafBatchSize, sizeof(blas.leafBatchSize), key);
+			if (cache->load(key, (int)mesh.faceCount(), blas)) {
+				// Wide nodes are only collapsed if the cached tree was stored without them
+				if (layout != BVHLayout::Wide || blas.wide.empty()) {
+					blas.setLayout(layout);
+				}
+				bvhTriangleCount = mesh.faceCount();
+				packGeometry();
+				return;
+			}
 		}
 
-		return hit;
+		// Spatial splits clip the triangles themselves, the BVH only knows their bounds
+		BVH::SplitFunction splitTriangle = [this](int prim, int axis, double pos, AABB& left, AABB& right) {
+			mesh.splitFaceBounds(prim, axis, pos, left, right);
+		};
+		blas.build(mesh.faceBounds(), builder, layout, builder == BVHBuilder::SBVH ? splitTriangle : nullptr);
+		bvhTriangleCount = mesh.faceCount();
+		packGeometry();
+
+		if (cache) {
+			cache->store(key, blas);
+		}
 	}
 
-	void setMat(const std::string& mat){
+	// Use a BVH built earlier over the current mesh, such as one stored in a scene file, instead of building it. Wide
+	// nodes that come with the tree are kept
+	void setBVH(BVH&& bvh, BVHLayout layout = BVHLayout::Wide) {
+		blas = std::move(bvh);
+		blas.leafBatchSize = leafBatchSize;
+		if (layout != BVHLayout::Wide || blas.wide.empty()) {
+			blas.setLayout(layout);
+		}
+		blas.builtCost = blas.sahCost();
+		bvhTriangleCount = mesh.faceCount();
+		packGeometry();
+	}
+
+	// Update the BVH after the mesh vertices moved. The existing tree is refitted, which keeps the per-frame cost
+	// low for animations, and only rebuilt when triangles were added or removed or its SAH cost grew past
+	// BVH::maxRefitCostGrowth. Returns true if the tree was rebuilt
+	bool updateBVH(BVHBuilder builder = BVHBuilder::SAH, BVHLayout layout = BVHLayout::Wide) {
+		if (blas.empty() || bvhTriangleCount != mesh.faceCount()) {
+			buildBVH(builder, layout);
+			return true;
+		}
+
+		if (blas.refit(mesh.faceBounds()) > BVH::maxRefitCostGrowth) {
+			buildBVH(builder, layout);
+			return true;
+		}
+		packGeometry();
+		return false;
+	}
+
+	// Move all vertices by offset, the BVH has to be updated afterwards
+	void translate(const Vec3& offset) {
+		for (auto& v : mesh.vertices) {
+			v = v + offset;
+		}
+	}
+
+	// Hash of the vertex and index buffers, identifies the geometry in the BVH cache
+	uint64_t geometryHash() const {
+		uint64_t hash = hashBytes(nullptr, 0);
+		for (const auto& v : mesh.vertices) {
+			const double coords[3] = { v.x, v.y, v.z };
+			hash = hashBytes(coords, sizeof(coords), hash);
+		}
+		hash = hashBytes(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t), hash);
+		return hashBytes(mesh.faceShapes.data(), mesh.faceShapes.size(), hash);
+	}
+
+	// The object's bottom-level BVH, for statistics
+	const BVH& bvh() const {
+		return blas;
+	}
+
+	// Bytes of the mesh and of the packed copy the intersection tests read
+	size_t memoryBytes() const {
+		return mesh.memoryBytes() + packed.memoryBytes();
+	}
+
+	// Bounding box of all triangles in the object, valid once the BVH is built
+	AABB bounds() const {
+		return blas.empty() ? AABB() : blas.nodes[0].bounds;
+	}
+
+	// Closest triangle hit closer than tMax. Only the traversal result is returned, tMax is shrunk to the hit distance
+	// and hit holds the triangle and its barycentric coordinates. The shading attributes of the final hit are fetched
+	// afterwards with normal, color and getMat
+	bool intersect(const Ray& ray, double& tMax, PackedTriangles::Hit& hit) const {
+#if defined(PACKED_TRIANGLES)
+		// Traverse the object's BVH, the triangles of every leaf the ray passes through are tested together
+		PackedTriangles::FloatRay floatRay(ray);
+		return blas.intersectLeaves(ray, tMax, [&](int first, int count, double& tLeaf) {
+			return packed.intersect(floatRay, first, count, tLeaf, hit);
+			});
+#else
+		// Traverse the object's BVH, every face of a leaf is tested on the mesh in the render precision
+		return blas.intersect(ray, tMax, [&](int prim, double& tLeaf) {
+			double t, u, v;
+			if (!mesh.intersect(prim, ray, tLeaf, t, u, v)) {
+				return false;
+			}
+			tLeaf = t;
+			hit.prim = prim;
+			hit.u = (float)u;
+			hit.v = (float)v;
+			return true;
+			});
+#endif
+	}
+
+	// Closest hit together with its color and normal, for callers that test a single object
+	bool intersect(const Ray& ray, double& tHit, Vec3& outNormal, Vec3& outColor) const {
+		double tClosest = std::numeric_limits<double>::infinity();
+		PackedTriangles::Hit hit;
+		if (!intersect(ray, tClosest, hit)) {
+			return false;
+		}
+
+		tHit = tClosest;
+		outColor = color(hit.prim, hit.u, hit.v);
+		outNormal = normal(hit.prim);
+		if (outNormal.dotProduct(ray.direction) > 0.0) {
+			outNormal = outNormal * -1.0; // flip so it faces the incoming ray
+		}
+		return true;
+	}
+
+	// Geometric normal of a triangle
+	Vec3 normal(int prim) const {
+		return mesh.normal(prim);
+	}
+
+	// Color at barycentric coordinates u, v of a triangle, the centre by default
+	Vec3 color(int prim, double u = 1.0 / 3.0, double v = 1.0 / 3.0) const {
+		return mesh.color(prim, u, v);
+	}
+
+	// Occlusion test, true if any triangle is hit closer than tMax. Stops at the first such triangle
+	bool occluded(const Ray& ray, double tMax) const {
+		// Transparent (GLASS) faces let the ray through
+		const uint8_t* skipFaces = transparentFaces.empty() ? nullptr : transparentFaces.data();
+#if defined(PACKED_TRIANGLES)
+		PackedTriangles::FloatRay floatRay(ray);
+		return blas.occludedLeaves(ray, tMax, [&](int first, int count) {
+			return packed.occluded(floatRay, first, count, tMax, skipFaces);
+			});
+#else
+		return blas.occluded(ray, tMax, [&](int prim) {
+			double t, u, v;
+			return !(skipFaces && skipFaces[prim]) && mesh.intersect(prim, ray, tMax, t, u, v);
+			});
+#endif
+	}
+
+	void setMat(MaterialID mat) {
 		material = mat;
+		cacheFaceMaterials();
 	}
 
-	std::string getMat() const {
+	// Material by name, see Materials::id
+	void setMat(const std::string& mat){
+		setMat(Materials::id(mat));
+	}
+
+	MaterialID getMat() const {
 		return material;
 	}
 
+	// Material of a triangle, its per-face material if the mesh has one and the object's otherwise
+	MaterialID getMat(int prim) const {
+		MaterialID faceMaterial = mesh.material(prim);
+		return faceMaterial == Materials::none ? material : faceMaterial;
+	}
+
     bool isTransparent() const {
-        return material == "GLASS";
+        return Materials::isTransparent(material);
     }
+
+	// True if the object or any of its faces is emissive
+	bool isEmitter() const {
+		auto emits = [](MaterialID m) { return m != Materials::none && Materials::get(m).type == MaterialType::Emissive; };
+		return emits(material) || std::any_of(mesh.materials.begin(), mesh.materials.end(), emits);
+	}
+
+	// Total area of the emissive faces, sampleSurface picks points on them with density 1 / surfaceArea(). 0 for
+	// objects without any. Kept up to date by setMat and the BVH builds, faces added since are not included
+	double surfaceArea() const {
+		return faceAreaSums.empty() ? 0.0 : faceAreaSums.back();
+	}
+
+	// Point uniformly distributed over the emissive faces for r0, r1, r2 uniform in [0, 1), for sampling area lights.
+	// r0 picks a face with probability proportional to its area and r1, r2 place the point on it, prim gets the face.
+	// prim is -1 if surfaceArea() is 0
+	Vec3 sampleSurface(double r0, double r1, double r2, int& prim) const {
+		if (surfaceArea() <= 0.0) {
+			prim = -1;
+			return Vec3();
+		}
+		auto face = std::upper_bound(faceAreaSums.begin(), faceAreaSums.end(), r0 * faceAreaSums.back());
+		prim = (int)std::min<size_t>(face - faceAreaSums.begin(), faceAreaSums.size() - 1);
+		return mesh.samplePoint(prim, r1, r2);
+	}
 private:
 	
-	std::string material;
+	MaterialID material = Materials::diffuse;
+
+	// Bottom-level acceleration structure over the triangles
+	BVH blas;
+
+#if defined(PACKED_TRIANGLES)
+	// The packed kernel tests a leaf a full lane group at a time, the builder fills the leaves accordingly
+	static constexpr int leafBatchSize = PackedTriangles::laneWidth;
+#else
+	static constexpr int leafBatchSize = 1;
+#endif
+
+	// Single precision copy of the triangles in BVH leaf order, used for the intersection tests when compiled with
+	// PACKED_TRIANGLES and empty otherwise
+	PackedTriangles packed;
+
+	// Number of triangles the BVH was built for, a refit is only possible while it matches
+	size_t bvhTriangleCount = 0;
+
+	// Running sums of the emissive face areas for sampleSurface, one per face, empty for objects without emissive faces
+	std::vector<double> faceAreaSums;
+
+	// 1 for the faces shadow rays pass through, one per face, empty if the object has none
+	std::vector<uint8_t> transparentFaces;
+
+	// Copy the faces into the packed triangles in BVH leaf order, and cache what the face materials imply
+	void packGeometry() {
+#if defined(PACKED_TRIANGLES)
+		packed.build(mesh, blas.primIndices);
+#endif
+		cacheFaceMaterials();
+	}
+
+	// Running sums of the face areas for sampleSurface, where faces that aren't emissive add nothing so they are
+	// never picked, and the transparent faces. Only per face materials are looked at face by face, a transparent
+	// object is skipped as a whole by the scene
+	void cacheFaceMaterials() {
+		auto faceType = [&](size_t f) {
+			MaterialID faceMaterial = getMat((int)f);
+			return faceMaterial == Materials::none ? MaterialType::Diffuse : Materials::get(faceMaterial).type;
+		};
+
+		faceAreaSums.clear();
+		if (isEmitter()) {
+			double sum = 0.0;
+			for (size_t f = 0; f < mesh.faceCount(); ++f) {
+				if (faceType(f) == MaterialType::Emissive) {
+					sum += mesh.area(f);
+				}
+				faceAreaSums.push_back(sum);
+			}
+		}
+
+		transparentFaces.clear();
+		bool hasGlassFaces = std::any_of(mesh.materials.begin(), mesh.materials.end(),
+			[](MaterialID m) { return m != Materials::none && Materials::isTransparent(m); });
+		if (hasGlassFaces) {
+			transparentFaces.resize(mesh.faceCount());
+			for (size_t f = 0; f < mesh.faceCount(); ++f) {
+				transparentFaces[f] = faceType(f) == MaterialType::Glass;
+			}
+		}
+	}
 };
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "objectDrawer.h"
+#include "packedTriangles.h"
+#include "traversalStats.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+
+/// Single precision structure-of-arrays copy of the scene spheres in the order the top-level BVH leaves reference
+/// them: centre, squared radius and material ID in separate arrays. A leaf's spheres are consecutive lanes and are
+/// tested in one pass of 8 (AVX2) or 4 (SSE) lanes, like PackedTriangles, instead of one Sphere at a time through
+/// its shared_ptr. Lanes of references that aren't spheres get a negative squared radius, which no ray hits
+class PackedSpheres {
+public:
+	static constexpr int laneWidth = PackedTriangles::laneWidth;
+
+	// Pack the spheres among the references in primIndices, lane j holds spheres[primIndices[j] - firstSphere]
+	void build(const std::vector<std::shared_ptr<Sphere>>& spheres, const std::vector<int>& primIndices, int firstSphere) {
+		size_t numLanes = primIndices.size() + laneWidth; // padding so a full load at the last leaf stays in bounds
+		for (std::vector<float>* a : { &cx, &cy, &cz }) {
+			a->assign(numLanes, 0.0f);
+		}
+		r2.assign(numLanes, -1.0f);
+		materialIDs.assign(numLanes, 0);
+		prims.assign(numLanes, -1);
+		materials.clear();
+		transparent.clear();
+
+		for (size_t j = 0; j < primIndices.size(); ++j) {
+			int s = primIndices[j] - firstSphere;
+			if (s < 0) {
+				continue;
+			}
+			const Sphere& sphere = *spheres[s];
+			cx[j] = (float)sphere.centerPoint.x; cy[j] = (float)sphere.centerPoint.y; cz[j] = (float)sphere.centerPoint.z;
+			r2[j] = (float)(sphere.radius * sphere.radius);
+			materialIDs[j] = materialID(sphere);
+			prims[j] = s;
+		}
+	}
+
+	void clear() {
+		*this = PackedSpheres();
+	}
+
+	bool empty() const {
+		return prims.empty();
+	}
+
+	size_t memoryBytes() const {
+		return cx.size() * (4 * sizeof(float) + sizeof(uint16_t) + sizeof(int));
+	}
+
+	/// Tests the spheres in lanes [first, first + count) against the ray with the same rules as
+	/// Sphere::RaySphereIntersection. If one is hit closer than tMax, tMax is shrunk to it, sphere is set to its index
+	/// in Scene::spheres and true is returned
+	bool intersect(const PackedTriangles::FloatRay& r, int first, int count, double& tMax, int& sphere) const {
+		bool found = false;
+		for (int base = first; base < first + count; base += laneWidth) {
+			float t[laneWidth];
+			int mask = testLanes(r, base, (float)tMax, t);
+			if (first + count - base < laneWidth) {
+				mask &= (1 << (first + count - base)) - 1;
+			}
+
+			while (mask) {
+				int i = lowestBit(mask);
+				mask &= mask - 1;
+				if (t[i] < tMax) {
+					tMax = t[i];
+					sphere = prims[base + i];
+					found = true;
+				}
+			}
+		}
+		return found;
+	}
+
+	// True if an opaque sphere in lanes [first, first + count) is hit closer than tMax, transparent ones are skipped
+	bool occluded(const PackedTriangles::FloatRay& r, int first, int count, double tMax) const {
+		for (int base = first; base < first + count; base += laneWidth) {
+			float t[laneWidth];
+			int mask = testLanes(r, base, (float)tMax, t);
+			if (first + count - base < laneWidth) {
+				mask &= (1 << (first + count - base)) - 1;
+			}
+
+			while (mask) {
+				int i = lowestBit(mask);
+				mask &= mask - 1;
+				if (!transparent[materialIDs[base + i]]) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+private:
+	std::vector<float> cx, cy, cz, r2;
+	std::vector<uint16_t> materialIDs;
+	std::vector<int> prims;
+
+	// Materials of the IDs and whether they let shadow rays through
+	std::vector<MaterialID> materials;
+	std::vector<bool> transparent;
+
+	uint16_t materialID(const Sphere& sphere) {
+		for (size_t i = 0; i < materials.size(); ++i) {
+			if (materials[i] == sphere.material) {
+				return (uint16_t)i;
+			}
+		}
+		materials.push_back(sphere.material);
+		transparent.push_back(sphere.isTransparent());
+		return (uint16_t)(materials.size() - 1);
+	}
+
+	/// Tests laneWidth spheres starting at lane base. Returns a bit mask of the lanes hit in (0, tMax) and writes their
+	/// distances to t. The nearer root is taken if it is in front of the origin, otherwise the farther one
+	int testLanes(const PackedTriangles::FloatRay& r, int base, float tMax, float* t) const {
+#if defined(PACKED_TRIANGLES_AVX2)
+		// L = c - o, tca = L . d and d2 the squared distance of the centre from the ray, taken from L - tca * d since
+		// L . L - tca^2 cancels badly in single precision for spheres that are small against their distance
+		__m256 dx = _mm256_set1_ps(r.dx), dy = _mm256_set1_ps(r.dy), dz = _mm256_set1_ps(r.dz);
+		__m256 lx = _mm256_sub_ps(_mm256_loadu_ps(&cx[base]), _mm256_set1_ps(r.ox));
+		__m256 ly = _mm256_sub_ps(_mm256_loadu_ps(&cy[base]), _mm256_set1_ps(r.oy));
+		__m256 lz = _mm256_sub_ps(_mm256_loadu_ps(&cz[base]), _mm256_set1_ps(r.oz));
+		__m256 tca = _mm256_fmadd_ps(lx, dx, _mm256_fmadd_ps(ly, dy, _mm256_mul_ps(lz, dz)));
+		__m256 px = _mm256_fnmadd_ps(tca, dx, lx), py = _mm256_fnmadd_ps(tca, dy, ly), pz = _mm256_fnmadd_ps(tca, dz, lz);
+		__m256 d2 = _mm256_fmadd_ps(px, px, _mm256_fmadd_ps(py, py, _mm256_mul_ps(pz, pz)));
+		__m256 rad2 = _mm256_loadu_ps(&r2[base]);
+		__m256 thc = _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(rad2, d2), _mm256_setzero_ps()));
+
+		// t0 if it is in front of the origin, else t1
+		__m256 t0 = _mm256_sub_ps(tca, thc);
+		__m256 t1 = _mm256_add_ps(tca, thc);
+		__m256 tHit = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, _mm256_setzero_ps(), _CMP_GT_OQ));
+
+		__m256 valid = _mm256_and_ps(_mm256_cmp_ps(tca, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(d2, rad2, _CMP_LE_OQ));
+		valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(tHit, _mm256_setzero_ps(), _CMP_GT_OQ),
+			_mm256_cmp_ps(tHit, _mm256_set1_ps(tMax), _CMP_LT_OQ)));
+
+		_mm256_storeu_ps(t, tHit);
+		return _mm256_movemask_ps(valid);
+#elif defined(PACKED_TRIANGLES_SSE)
+		__m128 dx = _mm_set1_ps(r.dx), dy = _mm_set1_ps(r.dy), dz = _mm_set1_ps(r.dz);
+		__m128 lx = _mm_sub_ps(_mm_loadu_ps(&cx[base]), _mm_set1_ps(r.ox));
+		__m128 ly = _mm_sub_ps(_mm_loadu_ps(&cy[base]), _mm_set1_ps(r.oy));
+		__m128 lz = _mm_sub_ps(_mm_loadu_ps(&cz[base]), _mm_set1_ps(r.oz));
+		__m128 tca = _mm_add_ps(_mm_mul_ps(lx, dx), _mm_add_ps(_mm_mul_ps(ly, dy), _mm_mul_ps(lz, dz)));
+		__m128 px = _mm_sub_ps(lx, _mm_mul_ps(tca, dx)), py = _mm_sub_ps(ly, _mm_mul_ps(tca, dy)), pz = _mm_sub_ps(lz, _mm_mul_ps(tca, dz));
+		__m128 d2 = _mm_add_ps(_mm_mul_ps(px, px), _mm_add_ps(_mm_mul_ps(py, py), _mm_mul_ps(pz, pz)));
+		__m128 rad2 = _mm_loadu_ps(&r2[base]);
+		__m128 thc = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(rad2, d2), _mm_setzero_ps()));
+
+		// t0 if it is in front of the origin, else t1, selected with masks since SSE2 has no blend
+		__m128 t0 = _mm_sub_ps(tca, thc);
+		__m128 t1 = _mm_add_ps(tca, thc);
+		__m128 front = _mm_cmpgt_ps(t0, _mm_setzero_ps());
+		__m128 tHit = _mm_or_ps(_mm_and_ps(front, t0), _mm_andnot_ps(front, t1));
+
+		__m128 valid = _mm_and_ps(_mm_cmpge_ps(tca, _mm_setzero_ps()), _mm_cmple_ps(d2, rad2));
+		valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(tHit, _mm_setzero_ps()), _mm_cmplt_ps(tHit, _mm_set1_ps(tMax))));
+
+		_mm_storeu_ps(t, tHit);
+		return _mm_movemask_ps(valid);
+#else
+		// Scalar fallback for targets without SSE
+		int mask = 0;
+		for (int i = 0; i < laneWidth; ++i) {
+			int j = base + i;
+			float lx = cx[j] - r.ox, ly = cy[j] - r.oy, lz = cz[j] - r.oz;
+			float tca = lx * r.dx + ly * r.dy + lz * r.dz;
+			float px = lx - tca * r.dx, py = ly - tca * r.dy, pz = lz - tca * r.dz;
+			float d2 = px * px + py * py + pz * pz;
+			if (tca < 0.0f || d2 > r2[j]) {
+				continue;
+			}
+			float thc = std::sqrt(r2[j] - d2);
+			t[i] = tca - thc > 0.0f ? tca - thc : tca + thc;
+			if (t[i] > 0.0f && t[i] < tMax) {
+				mask |= 1 << i;
+			}
+		}
+		return mask;
+#endif
+	}
+
+	static int lowestBit(int mask) {
+#if defined(_MSC_VER)
+		unsigned long i;
+		_BitScanForward(&i, (unsigned long)mask);
+		return (int)i;
+#else
+		return __builtin_ctz((unsigned int)mask);
+#endif
+	}
+};
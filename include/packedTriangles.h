@@ -0,0 +1,300 @@
+#pragma once
+
+#include "indexedMesh.h"
+#include "ray.h"
+#include "traversalStats.h"
+
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// The 8 lane kernel needs FMA as well, which MSVC enables together with /arch:AVX2
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#include <immintrin.h>
+#define PACKED_TRIANGLES_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PACKED_TRIANGLES_SSE
+#endif
+
+/// Single precision structure-of-arrays copy of a mesh's triangles, only what the intersection needs: the first vertex
+/// and the two edges. Triangles are stored in the order the BVH leaves reference them, so a leaf's triangles are
+/// consecutive lanes and are tested in one pass of 8 (AVX2) or 4 (SSE) lanes. Parallelogram faces share the lanes,
+/// they only differ in the bound on the barycentric coordinates, which a per lane flag selects. At 40 bytes per
+/// reference this avoids the index indirection of the mesh, which is only read again for the shading of the closest
+/// hit. TriObj only builds and tests it when compiled with PACKED_TRIANGLES
+class PackedTriangles {
+public:
+#if defined(PACKED_TRIANGLES_AVX2)
+	static constexpr int laneWidth = 8;
+#else
+	static constexpr int laneWidth = 4;
+#endif
+
+	// Relative slack on the barycentric tests. Rounding the vertices and the ray to single precision moves u and v by
+	// about the float spacing of the coordinates over the edge length, so a fixed bound opens cracks along the shared
+	// edges of small triangles seen from afar. The bound scales with the operands instead, see testLanes
+	static constexpr float edgeTolerance = std::numeric_limits<float>::epsilon();
+
+	// Pack the faces referenced by primIndices, lane j holds face primIndices[j] of the mesh
+	void build(const IndexedMesh& mesh, const std::vector<int>& primIndices) {
+		size_t numLanes = primIndices.size() + laneWidth; // padding so a full load at the last leaf stays in bounds
+		for (std::vector<float>* a : { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z, &parallelogram }) {
+			a->assign(numLanes, 0.0f);
+		}
+		prims = primIndices;
+
+		for (size_t j = 0; j < primIndices.size(); ++j) {
+			const Vec3& v0 = mesh.vertex(primIndices[j], 0);
+			Vec3 edge0 = mesh.vertex(primIndices[j], 1) - v0;
+			Vec3 edge1 = mesh.vertex(primIndices[j], 2) - v0;
+			v0x[j] = (float)v0.x; v0y[j] = (float)v0.y; v0z[j] = (float)v0.z;
+			e1x[j] = (float)edge0.x; e1y[j] = (float)edge0.y; e1z[j] = (float)edge0.z;
+			e2x[j] = (float)edge1.x; e2y[j] = (float)edge1.y; e2z[j] = (float)edge1.z;
+			parallelogram[j] = mesh.isParallelogram(primIndices[j]) ? 1.0f : 0.0f;
+		}
+	}
+
+	bool empty() const {
+		return prims.empty();
+	}
+
+	size_t memoryBytes() const {
+		return v0x.size() * 10 * sizeof(float) + prims.size() * sizeof(int);
+	}
+
+	/// Ray in single precision, converted once per ray and shared by all leaves. originSize and directionSize are the
+	/// sums of the absolute components, for the rounding bounds of the triangle test
+	struct FloatRay {
+		float ox, oy, oz, dx, dy, dz;
+		float originSize, directionSize;
+
+		explicit FloatRay(const Ray& ray) {
+			ox = (float)ray.origin.x; oy = (float)ray.origin.y; oz = (float)ray.origin.z;
+			dx = (float)ray.direction.x; dy = (float)ray.direction.y; dz = (float)ray.direction.z;
+			originSize = std::abs(ox) + std::abs(oy) + std::abs(oz);
+			directionSize = std::abs(dx) + std::abs(dy) + std::abs(dz);
+		}
+	};
+
+	/// Closest triangle found by intersect, its index and the barycentric coordinates of the hit along its two edges
+	struct Hit {
+		int prim = -1;
+		float u = 0.0f, v = 0.0f;
+	};
+
+	/// Moller-Trumbore test of the triangles in lanes [first, first + count) against the ray, with the same back face
+	/// culling as Triangle::RayTriangleIntersect. If one is hit closer than tMax, tMax is shrunk to it, hit is set to
+	/// that triangle and true is returned
+	bool intersect(const FloatRay& r, int first, int count, double& tMax, Hit& hit) const {
+		TRAVERSAL_STAT_ADD(triangleTests, count);
+		bool found = false;
+		for (int base = first; base < first + count; base += laneWidth) {
+			float t[laneWidth], u[laneWidth], v[laneWidth];
+			int mask = testLanes(r, base, (float)tMax, t, u, v);
+			if (first + count - base < laneWidth) {
+				mask &= (1 << (first + count - base)) - 1;
+			}
+
+			while (mask) {
+				int i = lowestBit(mask);
+				mask &= mask - 1;
+				if (t[i] < tMax) {
+					tMax = t[i];
+					hit.prim = prims[base + i];
+					hit.u = u[i];
+					hit.v = v[i];
+					found = true;
+				}
+			}
+		}
+		return found;
+	}
+
+	// True if any triangle in lanes [first, first + count) is hit closer than tMax. Faces f with skipFaces[f] set are
+	// passed through, skipFaces is indexed by face and may be null
+	bool occluded(const FloatRay& r, int first, int count, double tMax, const uint8_t* skipFaces = nullptr) const {
+		TRAVERSAL_STAT_ADD(triangleTests, count);
+		for (int base = first; base < first + count; base += laneWidth) {
+			float t[laneWidth], u[laneWidth], v[laneWidth];
+			int mask = testLanes(r, base, (float)tMax, t, u, v);
+			if (first + count - base < laneWidth) {
+				mask &= (1 << (first + count - base)) - 1;
+			}
+			while (mask && skipFaces) {
+				int i = lowestBit(mask);
+				if (!skipFaces[prims[base + i]]) {
+					return true;
+				}
+				mask &= mask - 1;
+			}
+			if (mask) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	std::vector<float> v0x, v0y, v0z;
+	std::vector<float> e1x, e1y, e1z;
+	std::vector<float> e2x, e2y, e2z;
+
+	// 1 for parallelogram lanes, 0 for triangles
+	std::vector<float> parallelogram;
+	std::vector<int> prims;
+
+	// The smallest distance counted as a hit, as in Triangle::RayTriangleIntersect
+	static constexpr float tMin = 1e-8f;
+
+	/// Tests laneWidth triangles starting at lane base. Returns a bit mask of the lanes hit in (tMin, tMax) and
+	/// writes their distances to t and their barycentric coordinates to u and v. Triangles need u + v <= 1 and
+	/// parallelograms max(u, v) <= 1, the bound is u + v - min(u, v) times the parallelogram flag. The bounds are
+	/// tested on u * det and v * det before the division, each with a slack of edgeTolerance times the size of its
+	/// operands, (|o - v0| + |o|) |d| |e2| for u and (|o - v0| + |o|) |d| |e1| for v. That covers the rounding of the
+	/// vertices, the ray and the products, so two triangles sharing an edge leave no gap between them
+	int testLanes(const FloatRay& r, int base, float tMax, float* t, float* uOut, float* vOut) const {
+#if defined(PACKED_TRIANGLES_AVX2)
+		__m256 dx = _mm256_set1_ps(r.dx), dy = _mm256_set1_ps(r.dy), dz = _mm256_set1_ps(r.dz);
+		__m256 ax = _mm256_loadu_ps(&e1x[base]), ay = _mm256_loadu_ps(&e1y[base]), az = _mm256_loadu_ps(&e1z[base]);
+		__m256 bx = _mm256_loadu_ps(&e2x[base]), by = _mm256_loadu_ps(&e2y[base]), bz = _mm256_loadu_ps(&e2z[base]);
+
+		// p = d x e2, det = e1 . p
+		__m256 px = _mm256_fmsub_ps(dy, bz, _mm256_mul_ps(dz, by));
+		__m256 py = _mm256_fmsub_ps(dz, bx, _mm256_mul_ps(dx, bz));
+		__m256 pz = _mm256_fmsub_ps(dx, by, _mm256_mul_ps(dy, bx));
+		__m256 det = _mm256_fmadd_ps(ax, px, _mm256_fmadd_ps(ay, py, _mm256_mul_ps(az, pz)));
+		__m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+		// s = o - v0, u = (s . p) / det
+		__m256 sx = _mm256_sub_ps(_mm256_set1_ps(r.ox), _mm256_loadu_ps(&v0x[base]));
+		__m256 sy = _mm256_sub_ps(_mm256_set1_ps(r.oy), _mm256_loadu_ps(&v0y[base]));
+		__m256 sz = _mm256_sub_ps(_mm256_set1_ps(r.oz), _mm256_loadu_ps(&v0z[base]));
+		__m256 uDet = _mm256_fmadd_ps(sx, px, _mm256_fmadd_ps(sy, py, _mm256_mul_ps(sz, pz)));
+
+		// q = s x e1, v = (d . q) / det, t = (e2 . q) / det
+		__m256 qx = _mm256_fmsub_ps(sy, az, _mm256_mul_ps(sz, ay));
+		__m256 qy = _mm256_fmsub_ps(sz, ax, _mm256_mul_ps(sx, az));
+		__m256 qz = _mm256_fmsub_ps(sx, ay, _mm256_mul_ps(sy, ax));
+		__m256 vDet = _mm256_fmadd_ps(dx, qx, _mm256_fmadd_ps(dy, qy, _mm256_mul_ps(dz, qz)));
+		__m256 tHit = _mm256_mul_ps(_mm256_fmadd_ps(bx, qx, _mm256_fmadd_ps(by, qy, _mm256_mul_ps(bz, qz))), invDet);
+
+		// Slack of u * det and v * det, the absolute value clears the sign bit
+		__m256 sign = _mm256_set1_ps(-0.0f);
+		__m256 sSize = _mm256_add_ps(_mm256_add_ps(_mm256_andnot_ps(sign, sx), _mm256_andnot_ps(sign, sy)),
+			_mm256_add_ps(_mm256_andnot_ps(sign, sz), _mm256_set1_ps(r.originSize)));
+		__m256 scale = _mm256_mul_ps(sSize, _mm256_set1_ps(r.directionSize * edgeTolerance));
+		__m256 uSlack = _mm256_mul_ps(scale, _mm256_add_ps(_mm256_add_ps(_mm256_andnot_ps(sign, bx), _mm256_andnot_ps(sign, by)),
+			_mm256_andnot_ps(sign, bz)));
+		__m256 vSlack = _mm256_mul_ps(scale, _mm256_add_ps(_mm256_add_ps(_mm256_andnot_ps(sign, ax), _mm256_andnot_ps(sign, ay)),
+			_mm256_andnot_ps(sign, az)));
+
+		__m256 valid = _mm256_and_ps(_mm256_cmp_ps(det, _mm256_setzero_ps(), _CMP_GT_OQ),
+			_mm256_and_ps(_mm256_cmp_ps(_mm256_add_ps(uDet, uSlack), _mm256_setzero_ps(), _CMP_GE_OQ),
+				_mm256_cmp_ps(_mm256_add_ps(vDet, vSlack), _mm256_setzero_ps(), _CMP_GE_OQ)));
+		__m256 bound = _mm256_fnmadd_ps(_mm256_loadu_ps(&parallelogram[base]), _mm256_min_ps(uDet, vDet), _mm256_add_ps(uDet, vDet));
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(bound, _mm256_add_ps(det, _mm256_add_ps(uSlack, vSlack)), _CMP_LE_OQ));
+		__m256 u = _mm256_mul_ps(uDet, invDet);
+		__m256 v = _mm256_mul_ps(vDet, invDet);
+		valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(tHit, _mm256_set1_ps(tMin), _CMP_GT_OQ),
+			_mm256_cmp_ps(tHit, _mm256_set1_ps(tMax), _CMP_LT_OQ)));
+
+		_mm256_storeu_ps(t, tHit);
+		_mm256_storeu_ps(uOut, u);
+		_mm256_storeu_ps(vOut, v);
+		return _mm256_movemask_ps(valid);
+#elif defined(PACKED_TRIANGLES_SSE)
+		__m128 dx = _mm_set1_ps(r.dx), dy = _mm_set1_ps(r.dy), dz = _mm_set1_ps(r.dz);
+		__m128 ax = _mm_loadu_ps(&e1x[base]), ay = _mm_loadu_ps(&e1y[base]), az = _mm_loadu_ps(&e1z[base]);
+		__m128 bx = _mm_loadu_ps(&e2x[base]), by = _mm_loadu_ps(&e2y[base]), bz = _mm_loadu_ps(&e2z[base]);
+
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dy, bz), _mm_mul_ps(dz, by));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dz, bx), _mm_mul_ps(dx, bz));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, by), _mm_mul_ps(dy, bx));
+		__m128 det = _mm_add_ps(_mm_mul_ps(ax, px), _mm_add_ps(_mm_mul_ps(ay, py), _mm_mul_ps(az, pz)));
+		__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+		__m128 sx = _mm_sub_ps(_mm_set1_ps(r.ox), _mm_loadu_ps(&v0x[base]));
+		__m128 sy = _mm_sub_ps(_mm_set1_ps(r.oy), _mm_loadu_ps(&v0y[base]));
+		__m128 sz = _mm_sub_ps(_mm_set1_ps(r.oz), _mm_loadu_ps(&v0z[base]));
+		__m128 uDet = _mm_add_ps(_mm_mul_ps(sx, px), _mm_add_ps(_mm_mul_ps(sy, py), _mm_mul_ps(sz, pz)));
+
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, az), _mm_mul_ps(sz, ay));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, ax), _mm_mul_ps(sx, az));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, ay), _mm_mul_ps(sy, ax));
+		__m128 vDet = _mm_add_ps(_mm_mul_ps(dx, qx), _mm_add_ps(_mm_mul_ps(dy, qy), _mm_mul_ps(dz, qz)));
+		__m128 tHit = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(bx, qx), _mm_add_ps(_mm_mul_ps(by, qy), _mm_mul_ps(bz, qz))), invDet);
+
+		__m128 sign = _mm_set1_ps(-0.0f);
+		__m128 sSize = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(sign, sx), _mm_andnot_ps(sign, sy)),
+			_mm_add_ps(_mm_andnot_ps(sign, sz), _mm_set1_ps(r.originSize)));
+		__m128 scale = _mm_mul_ps(sSize, _mm_set1_ps(r.directionSize * edgeTolerance));
+		__m128 uSlack = _mm_mul_ps(scale, _mm_add_ps(_mm_add_ps(_mm_andnot_ps(sign, bx), _mm_andnot_ps(sign, by)), _mm_andnot_ps(sign, bz)));
+		__m128 vSlack = _mm_mul_ps(scale, _mm_add_ps(_mm_add_ps(_mm_andnot_ps(sign, ax), _mm_andnot_ps(sign, ay)), _mm_andnot_ps(sign, az)));
+
+		__m128 valid = _mm_and_ps(_mm_cmpgt_ps(det, _mm_setzero_ps()),
+			_mm_and_ps(_mm_cmpge_ps(_mm_add_ps(uDet, uSlack), _mm_setzero_ps()), _mm_cmpge_ps(_mm_add_ps(vDet, vSlack), _mm_setzero_ps())));
+		__m128 bound = _mm_sub_ps(_mm_add_ps(uDet, vDet), _mm_mul_ps(_mm_loadu_ps(&parallelogram[base]), _mm_min_ps(uDet, vDet)));
+		valid = _mm_and_ps(valid, _mm_cmple_ps(bound, _mm_add_ps(det, _mm_add_ps(uSlack, vSlack))));
+		__m128 u = _mm_mul_ps(uDet, invDet);
+		__m128 v = _mm_mul_ps(vDet, invDet);
+		valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(tHit, _mm_set1_ps(tMin)), _mm_cmplt_ps(tHit, _mm_set1_ps(tMax))));
+
+		_mm_storeu_ps(t, tHit);
+		_mm_storeu_ps(uOut, u);
+		_mm_storeu_ps(vOut, v);
+		return _mm_movemask_ps(valid);
+#else
+		// Scalar fallback for targets without SSE
+		int mask = 0;
+		for (int i = 0; i < laneWidth; ++i) {
+			int j = base + i;
+			float px = r.dy * e2z[j] - r.dz * e2y[j];
+			float py = r.dz * e2x[j] - r.dx * e2z[j];
+			float pz = r.dx * e2y[j] - r.dy * e2x[j];
+			float det = e1x[j] * px + e1y[j] * py + e1z[j] * pz;
+			if (!(det > 0.0f)) {
+				continue;
+			}
+			float invDet = 1.0f / det;
+
+			float sx = r.ox - v0x[j], sy = r.oy - v0y[j], sz = r.oz - v0z[j];
+			float uDet = sx * px + sy * py + sz * pz;
+
+			float qx = sy * e1z[j] - sz * e1y[j];
+			float qy = sz * e1x[j] - sx * e1z[j];
+			float qz = sx * e1y[j] - sy * e1x[j];
+			float vDet = r.dx * qx + r.dy * qy + r.dz * qz;
+			t[i] = (e2x[j] * qx + e2y[j] * qy + e2z[j] * qz) * invDet;
+			uOut[i] = uDet * invDet;
+			vOut[i] = vDet * invDet;
+
+			float scale = (std::abs(sx) + std::abs(sy) + std::abs(sz) + r.originSize) * r.directionSize * edgeTolerance;
+			float uSlack = scale * (std::abs(e2x[j]) + std::abs(e2y[j]) + std::abs(e2z[j]));
+			float vSlack = scale * (std::abs(e1x[j]) + std::abs(e1y[j]) + std::abs(e1z[j]));
+			float bound = uDet + vDet - parallelogram[j] * std::min(uDet, vDet);
+			if (uDet >= -uSlack && vDet >= -vSlack && bound <= det + uSlack + vSlack && t[i] > tMin && t[i] < tMax) {
+				mask |= 1 << i;
+			}
+		}
+		return mask;
+#endif
+	}
+
+	static int lowestBit(int mask) {
+#if defined(_MSC_VER)
+		unsigned long i;
+		_BitScanForward(&i, (unsigned long)mask);
+		return (int)i;
+#else
+		return __builtin_ctz((unsigned int)mask);
+#endif
+	}
+};
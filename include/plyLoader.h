@@ -0,0 +1,546 @@
+#pragma once
+
+#include "objectDrawer.h"
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+
+/// Binary PLY loader producing an indexed TriObj, for scanned meshes with tens of millions of faces. The header is
+/// parsed into its elements and properties, so any property order and types work and unknown properties and elements
+/// are skipped. The file is read through one fixed buffer and the vertex and face records are decoded straight into
+/// the mesh buffers, which are allocated at their final size from the element counts. The load peaks at the final
+/// mesh plus the buffer for triangle meshes; a file with polygons additionally holds the indices read before the
+/// first polygon while they grow to the counted size. Vertex colors (red, green, blue) are kept as the mesh's vertex
+/// colors, polygons are triangulated as fans. Both binary byte orders are read, ASCII files are rejected
+class PlyLoader {
+public:
+	// Size of the read buffer, also the largest record the loader accepts
+	static constexpr size_t bufferBytes = 1 << 20;
+
+	// Reason the last load failed
+	std::string error;
+
+	// Load the PLY file at path into obj, replacing its mesh. The faces get the object's material. Returns false and
+	// sets error if the file can't be read, isn't a binary PLY file with vertex positions and faces, or a face
+	// references a vertex that doesn't exist. The BVH has to be built afterwards
+	bool load(const std::string& path, TriObj& obj) {
+		error.clear();
+		IndexedMesh& mesh = obj.mesh;
+		mesh.clear();
+
+		Reader in;
+		if (!in.open(path, 0)) {
+			return fail("cannot open " + path);
+		}
+		std::vector<Element> elements;
+		if (!parseHeader(in, path, elements)) {
+			return false;
+		}
+
+		// Counts the file can't hold would size the mesh buffers before the reads find out
+		std::error_code sizeError;
+		uint64_t dataBytes = std::filesystem::file_size(path, sizeError) - in.offset();
+		for (const Element& element : elements) {
+			size_t minRecord = 0;
+			for (const Property& property : element.properties) {
+				minRecord += typeSize(property.countType != Type::Invalid ? property.countType : property.type);
+			}
+			if (sizeError || (minRecord > 0 && element.count > dataBytes / minRecord)) {
+				return fail(path + " is truncated or corrupt");
+			}
+		}
+
+		const Element* vertexElement = nullptr;
+		const Element* faceElement = nullptr;
+		for (const Element& element : elements) {
+			vertexElement = element.name == "vertex" ? &element : vertexElement;
+			faceElement = element.name == "face" ? &element : faceElement;
+		}
+		if (!vertexElement || !faceElement) {
+			return fail(path + " has no vertex or face element");
+		}
+		if (vertexElement->count > UINT32_MAX) {
+			return fail(path + " has more vertices than 32 bit indices can address");
+		}
+
+		VertexLayout vertexLayout;
+		vertexLayout.position[0] = vertexElement->find({ "x" });
+		vertexLayout.position[1] = vertexElement->find({ "y" });
+		vertexLayout.position[2] = vertexElement->find({ "z" });
+		vertexLayout.color[0] = vertexElement->find({ "red", "r", "diffuse_red" });
+		vertexLayout.color[1] = vertexElement->find({ "green", "g", "diffuse_green" });
+		vertexLayout.color[2] = vertexElement->find({ "blue", "b", "diffuse_blue" });
+		int cornerList = faceElement->find({ "vertex_indices", "vertex_index" });
+		if (vertexLayout.position[0] < 0 || vertexLayout.position[1] < 0 || vertexLayout.position[2] < 0 ||
+			cornerList < 0 || faceElement->properties[cornerList].countType == Type::Invalid) {
+			return fail(path + " has no vertex positions or face vertex lists");
+		}
+		for (int p : vertexLayout.position) {
+			if (vertexElement->properties[p].countType != Type::Invalid) {
+				return fail(path + " has a vertex position that is a list");
+			}
+		}
+		bool hasColors = true;
+		for (int c : vertexLayout.color) {
+			hasColors = hasColors && c >= 0 && vertexElement->properties[c].countType == Type::Invalid;
+		}
+
+		size_t numTriangles = 0;
+		for (const Element& element : elements) {
+			bool ok = &element == vertexElement ? readVertices(in, element, vertexLayout, hasColors, mesh)
+				: &element == faceElement ? readFaces(in, path, element, cornerList, vertexElement->count, mesh, numTriangles)
+				: skipElement(in, element);
+			if (!ok) {
+				mesh.clear();
+				if (error.empty()) {
+					error = path + " is truncated or has a record larger than the read buffer";
+				}
+				return false;
+			}
+		}
+
+		// Faces that had fewer than three corners left their share of the indices unused
+		mesh.indices.resize(numTriangles * 3);
+		mesh.faceColors.assign(numTriangles, mesh.colorID(Vec3(0.8, 0.8, 0.8)));
+		mesh.faceMaterials.assign(numTriangles, IndexedMesh::objectMaterial);
+		return true;
+	}
+
+private:
+	enum class Type {
+		Invalid, Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64
+	};
+
+	struct Property {
+		std::string name;
+		Type type = Type::Invalid;
+
+		// Type of the element count for list properties, Invalid for scalars
+		Type countType = Type::Invalid;
+	};
+
+	struct Element {
+		std::string name;
+		uint64_t count = 0;
+		std::vector<Property> properties;
+
+		// Bytes per record if the element has no lists, 0 otherwise
+		size_t recordSize = 0;
+
+		// Index of the first property with one of the names, -1 if there is none
+		int find(std::initializer_list<const char*> names) const {
+			for (size_t i = 0; i < properties.size(); ++i) {
+				for (const char* name : names) {
+					if (properties[i].name == name) {
+						return (int)i;
+					}
+				}
+			}
+			return -1;
+		}
+	};
+
+	// Vertex properties the mesh is filled from, -1 if missing
+	struct VertexLayout {
+		int position[3] = { -1, -1, -1 };
+		int color[3] = { -1, -1, -1 };
+	};
+
+	// Buffered reader over the file, hands out records as pointers into its buffer
+	class Reader {
+	public:
+		Reader() = default;
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+
+		~Reader() {
+			if (file) {
+				std::fclose(file);
+			}
+		}
+
+		bool open(const std::string& path, uint64_t offset) {
+			file = std::fopen(path.c_str(), "rb");
+			if (!file || !seek(offset)) {
+				return false;
+			}
+			buffer.resize(bufferBytes);
+			bufferOffset = offset;
+			return true;
+		}
+
+		// Pointer to the next n bytes without consuming them, null if the file ends before
+		const unsigned char* peek(size_t n) {
+			if (end - pos < n && !fill(n)) {
+				return nullptr;
+			}
+			return buffer.data() + pos;
+		}
+
+		// Pointer to the next n bytes, which are consumed
+		const unsigned char* take(size_t n) {
+			const unsigned char* data = peek(n);
+			pos += data ? n : 0;
+			return data;
+		}
+
+		// Consume the bytes up to and including the next newline, false if there is none within the buffer
+		bool line(std::string& out) {
+			for (size_t searched = 0;;) {
+				const unsigned char* data = buffer.data() + pos;
+				const void* newline = std::memchr(data + searched, '\n', end - pos - searched);
+				if (newline) {
+					size_t length = (size_t)((const unsigned char*)newline - data);
+					out.assign((const char*)data, length - (length > 0 && data[length - 1] == '\r'));
+					pos += length + 1;
+					return true;
+				}
+				searched = end - pos;
+				if (!fill(searched + 1)) {
+					return false;
+				}
+			}
+		}
+
+		// File offset of the next unconsumed byte
+		uint64_t offset() const {
+			return bufferOffset + pos;
+		}
+
+	private:
+		std::FILE* file = nullptr;
+		std::vector<unsigned char> buffer;
+		size_t pos = 0, end = 0;
+		uint64_t bufferOffset = 0;
+
+		// Move the unconsumed bytes to the front and read until at least n are buffered
+		bool fill(size_t n) {
+			if (n > buffer.size()) {
+				return false;
+			}
+			std::memmove(buffer.data(), buffer.data() + pos, end - pos);
+			bufferOffset += pos;
+			end -= pos;
+			pos = 0;
+			while (end < n) {
+				size_t read = std::fread(buffer.data() + end, 1, buffer.size() - end, file);
+				if (read == 0) {
+					return false;
+				}
+				end += read;
+			}
+			return true;
+		}
+
+		bool seek(uint64_t offset) {
+#if defined(_WIN32)
+			return _fseeki64(file, (long long)offset, SEEK_SET) == 0;
+#else
+			return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+		}
+	};
+
+	// The file's byte order differs from this machine's
+	bool swapBytes = false;
+
+	bool fail(const std::string& message) {
+		error = message;
+		return false;
+	}
+
+	static Type parseType(const std::string& name) {
+		static const std::pair<const char*, Type> names[] = {
+			{ "char", Type::Int8 }, { "int8", Type::Int8 }, { "uchar", Type::UInt8 }, { "uint8", Type::UInt8 },
+			{ "short", Type::Int16 }, { "int16", Type::Int16 }, { "ushort", Type::UInt16 }, { "uint16", Type::UInt16 },
+			{ "int", Type::Int32 }, { "int32", Type::Int32 }, { "uint", Type::UInt32 }, { "uint32", Type::UInt32 },
+			{ "float", Type::Float32 }, { "float32", Type::Float32 }, { "double", Type::Float64 }, { "float64", Type::Float64 }
+		};
+		for (const auto& entry : names) {
+			if (name == entry.first) {
+				return entry.second;
+			}
+		}
+		return Type::Invalid;
+	}
+
+	static size_t typeSize(Type type) {
+		switch (type) {
+		case Type::Int8: case Type::UInt8: return 1;
+		case Type::Int16: case Type::UInt16: return 2;
+		case Type::Int32: case Type::UInt32: case Type::Float32: return 4;
+		case Type::Float64: return 8;
+		default: return 0;
+		}
+	}
+
+	bool parseHeader(Reader& in, const std::string& path, std::vector<Element>& elements) {
+		std::string line, keyword;
+		if (!in.line(line) || line != "ply") {
+			return fail(path + " is not a PLY file");
+		}
+		while (true) {
+			if (!in.line(line)) {
+				return fail(path + " has no end_header");
+			}
+			std::istringstream ss(line);
+			ss >> keyword;
+			if (keyword == "end_header") {
+				break;
+			}
+			if (keyword == "format") {
+				std::string format;
+				ss >> format;
+				if (format != "binary_little_endian" && format != "binary_big_endian") {
+					return fail(path + " is in " + format + " format, only binary PLY files are read");
+				}
+				const uint16_t probe = 1;
+				bool littleEndianHost = *(const unsigned char*)&probe == 1;
+				swapBytes = (format == "binary_little_endian") != littleEndianHost;
+			}
+			else if (keyword == "element") {
+				elements.emplace_back();
+				ss >> elements.back().name >> elements.back().count;
+				if (!ss) {
+					return fail(path + " has a malformed element line");
+				}
+			}
+			else if (keyword == "property") {
+				if (elements.empty()) {
+					return fail(path + " has a property outside an element");
+				}
+				Property property;
+				std::string type;
+				ss >> type;
+				if (type == "list") {
+					std::string countType;
+					ss >> countType >> type;
+					property.countType = parseType(countType);
+					if (property.countType == Type::Invalid || property.countType == Type::Float32 || property.countType == Type::Float64) {
+						return fail(path + " has a list property with count type " + countType);
+					}
+				}
+				property.type = parseType(type);
+				ss >> property.name;
+				if (property.type == Type::Invalid || !ss) {
+					return fail(path + " has a property of unknown type " + type);
+				}
+				elements.back().properties.push_back(property);
+			}
+			// comment and obj_info lines are skipped
+		}
+
+		for (Element& element : elements) {
+			for (const Property& property : element.properties) {
+				if (property.countType != Type::Invalid) {
+					element.recordSize = 0;
+					break;
+				}
+				element.recordSize += typeSize(property.type);
+			}
+		}
+		return true;
+	}
+
+	template<typename T>
+	T scalar(const unsigned char* data) const {
+		T value;
+		std::memcpy(&value, data, sizeof(T));
+		if (swapBytes) {
+			unsigned char* bytes = (unsigned char*)&value;
+			std::reverse(bytes, bytes + sizeof(T));
+		}
+		return value;
+	}
+
+	double real(const unsigned char* data, Type type) const {
+		switch (type) {
+		case Type::Int8: return (double)(int8_t)data[0];
+		case Type::UInt8: return (double)data[0];
+		case Type::Int16: return (double)scalar<int16_t>(data);
+		case Type::UInt16: return (double)scalar<uint16_t>(data);
+		case Type::Int32: return (double)scalar<int32_t>(data);
+		case Type::UInt32: return (double)scalar<uint32_t>(data);
+		case Type::Float32: return (double)scalar<float>(data);
+		case Type::Float64: return scalar<double>(data);
+		default: return 0.0;
+		}
+	}
+
+	// Integer property, -1 for negative values so they fail the range checks
+	int64_t integer(const unsigned char* data, Type type) const {
+		switch (type) {
+		case Type::Int8: return std::max<int64_t>((int8_t)data[0], -1);
+		case Type::UInt8: return data[0];
+		case Type::Int16: return std::max<int64_t>(scalar<int16_t>(data), -1);
+		case Type::UInt16: return scalar<uint16_t>(data);
+		case Type::Int32: return std::max<int64_t>(scalar<int32_t>(data), -1);
+		case Type::UInt32: return scalar<uint32_t>(data);
+		default: return -1;
+		}
+	}
+
+	// Next record of element, null at the end of the file. offsets gets where each property starts in the record,
+	// for lists that is their count. Records without lists have fixed offsets and only need one buffer check
+	const unsigned char* nextRecord(Reader& in, const Element& element, std::vector<size_t>& offsets) const {
+		offsets.resize(element.properties.size());
+		if (element.recordSize > 0) {
+			return in.take(element.recordSize);
+		}
+		size_t size = 0;
+		for (size_t i = 0; i < element.properties.size(); ++i) {
+			const Property& property = element.properties[i];
+			offsets[i] = size;
+			if (property.countType == Type::Invalid) {
+				size += typeSize(property.type);
+				continue;
+			}
+			const unsigned char* data = in.peek(size + typeSize(property.countType));
+			int64_t count = data ? integer(data + size, property.countType) : -1;
+			if (count < 0 || (uint64_t)count > bufferBytes) {
+				return nullptr;
+			}
+			size += typeSize(property.countType) + (size_t)count * typeSize(property.type);
+		}
+		return in.take(size);
+	}
+
+	static std::vector<size_t> fixedOffsets(const Element& element) {
+		std::vector<size_t> offsets;
+		size_t size = 0;
+		for (const Property& property : element.properties) {
+			offsets.push_back(size);
+			size += typeSize(property.type);
+		}
+		return offsets;
+	}
+
+	bool readVertices(Reader& in, const Element& element, const VertexLayout& layout, bool hasColors, IndexedMesh& mesh) const {
+		mesh.vertices.resize((size_t)element.count);
+		mesh.vertexColors.resize(hasColors ? (size_t)element.count : 0);
+		Vec3* vertices = mesh.vertices.data();
+		uint32_t* colors = mesh.vertexColors.data();
+
+		const Property* props = element.properties.data();
+		std::vector<size_t> offsets = fixedOffsets(element);
+		for (uint64_t i = 0; i < element.count; ++i) {
+			const unsigned char* record = nextRecord(in, element, offsets);
+			if (!record) {
+				return false;
+			}
+			const int* p = layout.position;
+			vertices[i] = Vec3(real(record + offsets[p[0]], props[p[0]].type), real(record + offsets[p[1]], props[p[1]].type),
+				real(record + offsets[p[2]], props[p[2]].type));
+			if (hasColors) {
+				Real channels[3];
+				for (int c = 0; c < 3; ++c) {
+					Type type = props[layout.color[c]].type;
+					double value = real(record + offsets[layout.color[c]], type);
+
+					// Integer channels span their type's range, float channels are 0 to 1
+					channels[c] = (Real)(type == Type::UInt8 ? value / 255.0 : type == Type::UInt16 ? value / 65535.0 : value);
+				}
+				Vec3 color(channels[0], channels[1], channels[2]);
+				colors[i] = IndexedMesh::packColor(color);
+			}
+		}
+		return true;
+	}
+
+	// Triangulate the faces into the mesh indices, which are sized for one triangle per face until a polygon shows up
+	bool readFaces(Reader& in, const std::string& path, const Element& element, int cornerList, uint64_t numVertices,
+		IndexedMesh& mesh, size_t& numTriangles) {
+		mesh.indices.resize((size_t)element.count * 3);
+		uint32_t* indices = mesh.indices.data();
+		bool counted = false;
+		numTriangles = 0;
+
+		const Property& list = element.properties[cornerList];
+		size_t countSize = typeSize(list.countType), indexSize = typeSize(list.type);
+		std::vector<size_t> offsets = fixedOffsets(element);
+		for (uint64_t f = 0; f < element.count; ++f) {
+			uint64_t recordStart = in.offset();
+			const unsigned char* record = nextRecord(in, element, offsets);
+			if (!record) {
+				return false;
+			}
+			const unsigned char* corners = record + offsets[cornerList];
+			int64_t count = integer(corners, list.countType);
+			corners += countSize;
+			if (count < 3) {
+				continue;
+			}
+
+			// The first polygon makes the indices grow once, to the triangles the rest of the faces count
+			if (count > 3 && !counted) {
+				size_t remaining = 0;
+				if (!countTriangles(path, recordStart, element, cornerList, element.count - f, remaining)) {
+					return false;
+				}
+				if (numTriangles == 0) {
+					mesh.indices = MeshBuffer<uint32_t>(); // nothing to keep, so the old and new sizes are never held together
+				}
+				mesh.indices.resize((numTriangles + remaining) * 3);
+				indices = mesh.indices.data();
+				counted = true;
+			}
+			if ((numTriangles + (size_t)count - 2) * 3 > mesh.indices.size()) {
+				return fail(path + " changed while it was read");
+			}
+
+			uint32_t first = 0, previous = 0;
+			for (int64_t c = 0; c < count; ++c) {
+				int64_t index = integer(corners + c * indexSize, list.type);
+				if (index < 0 || (uint64_t)index >= numVertices) {
+					return fail(path + " has a face referencing a vertex that doesn't exist");
+				}
+				if (c == 0) {
+					first = (uint32_t)index;
+				}
+				else if (c >= 2) {
+					uint32_t* triangle = indices + numTriangles++ * 3;
+					triangle[0] = first;
+					triangle[1] = previous;
+					triangle[2] = (uint32_t)index;
+				}
+				previous = (uint32_t)index;
+			}
+		}
+		return true;
+	}
+
+	// Triangles of numFaces faces starting at offset, read through a second reader so the main one keeps its place
+	bool countTriangles(const std::string& path, uint64_t offset, const Element& element, int cornerList, uint64_t numFaces, size_t& triangles) const {
+		Reader in;
+		if (!in.open(path, offset)) {
+			return false;
+		}
+		std::vector<size_t> offsets = fixedOffsets(element);
+		const Property& list = element.properties[cornerList];
+		triangles = 0;
+		for (uint64_t f = 0; f < numFaces; ++f) {
+			const unsigned char* record = nextRecord(in, element, offsets);
+			if (!record) {
+				return false;
+			}
+			triangles += (size_t)std::max<int64_t>(integer(record + offsets[cornerList], list.countType) - 2, 0);
+		}
+		return true;
+	}
+
+	bool skipElement(Reader& in, const Element& element) const {
+		std::vector<size_t> offsets;
+		for (uint64_t i = 0; i < element.count; ++i) {
+			if (!nextRecord(in, element, offsets)) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
@@ -3,22 +3,24 @@
 #include "include/vec3.h"
 
 /// Utility structure for rays 
-class Ray {
+template<typename T>
+class RayT {
 public:
-	Vec3 origin, direction;
-	Ray(const Vec3& o, const Vec3 dir) : origin(o), direction(dir.normalize()) {}
+	Vec3T<T> origin, direction;
+	RayT(const Vec3T<T>& o, const Vec3T<T> dir) : origin(o), direction(dir.normalize()) {}
 
 
 	// Make shadow rays from points light rays reach back to the eye 
-	static Ray shadowRay(const Vec3& point, const Vec3& lightPos) {
-		Vec3 lightDir = (lightPos - point).normalize(); 
+	static RayT shadowRay(const Vec3T<T>& point, const Vec3T<T>& lightPos) {
+		Vec3T<T> lightDir = (lightPos - point).normalize(); 
 
 		// Add offset so that rays don't intersect themselves
-		const double offSetFactor = 1e-4; 
-		Vec3 offSetDir = lightDir * offSetFactor;
+		const T offSetFactor = (T)1e-4; 
+		Vec3T<T> offSetDir = lightDir * offSetFactor;
 
 		// Return shadow ray
-		return Ray(point + offSetDir, lightDir);
+		return RayT(point + offSetDir, lightDir);
 	}
 };
 
+using Ray = RayT<Real>;
@@ -4,6 +4,7 @@
 #include "include/camera.h"
 #include "include/ray.h"
 #include "tracer.h"
+#include "traversalStats.h"
 
 // Threading
 #include <thread>
@@ -20,8 +21,8 @@ public:
 		// Max color value for entire image, used for tone mapping
 		double maxVal = 0.0;
 
-		// Buffer for floating point color values before tone mapping
-		std::vector<Vec3> floatBuffer(width * height);
+		// Buffer for floating point color values before tone mapping, kept in double in the float render mode too
+		std::vector<Vec3d> floatBuffer(width * height);
 
 		// Parallel row-based rendering --> one thread per row block
 		unsigned int requestedThreads = std::thread::hardware_concurrency();
@@ -43,13 +44,18 @@ public:
 		// Each thread stores its own local max color value
 		std::vector<double> perThreadMax(numThreads, 0.0);
 
+#ifdef TRAVERSAL_STATS
+		// Traversal work per pixel, for the heatmap and the totals printed at the end
+		std::vector<TraversalStats> pixelStats(width * height);
+#endif
+
 		// Rendering parameters
 		const int spp = 256;
 		const int maxDepth = 8; // Max number of bounced allowed for each ray, after that terminate with Russian Roulette
 
-		const std::string shadingMethod = "MC";
-		/*const std::string shadingMethod = "LAMBERTIAN";
-		const std::string shadingMethod = "FLAT";*/
+		const ShadingMethod shadingMethod = ShadingMethod::MC;
+		/*const ShadingMethod shadingMethod = ShadingMethod::Lambertian;
+		const ShadingMethod shadingMethod = ShadingMethod::Flat;*/
 
 		// Iterate all threads
 		for (unsigned int threadIndex = 0; threadIndex < numThreads; ++threadIndex) {
@@ -72,7 +78,10 @@ public:
 				for (int y = startY; y < endY; ++y) {
 					for (int x = 0; x < width; ++x) {
 
-						Vec3 accumulatedColor(0.0, 0.0, 0.0);
+						Vec3d accumulatedColor(0.0, 0.0, 0.0);
+#ifdef TRAVERSAL_STATS
+						TraversalStats statsBefore = TraversalStats::local();
+#endif
 
 						// Generate spp MC rays per pixel
 						auto pixelRays = camera.generateRandomViewRays(x, y, width, height, spp);
@@ -81,13 +90,16 @@ public:
 
 							Vec3 sampleColor;
 							tracer.trace(ray, scene, sampleColor, 0, maxDepth, shadingMethod);
-							accumulatedColor = accumulatedColor + sampleColor;
+							accumulatedColor = accumulatedColor + Vec3d(sampleColor);
 
 						}
 
 						// Average all color contributions from the samples within each pixel
-						Vec3 averageColor = accumulatedColor / (double)spp;
+						Vec3d averageColor = accumulatedColor / (double)spp;
 						floatBuffer[y * width + x] = averageColor;
+#ifdef TRAVERSAL_STATS
+						pixelStats[y * width + x] = TraversalStats::local() - statsBefore;
+#endif
 						localMax = std::max({ localMax, averageColor.x, averageColor.y, averageColor.z });
 					}
 				}
@@ -111,7 +123,7 @@ public:
 
 		// Tone mapping for better color range representation 
 		for (int i = 0; i < width * height; i++) {
-			Vec3 c = floatBuffer[i];
+			Vec3d c = floatBuffer[i];
 
 			// Normalize with max value for better color gamut
 			if (maxVal > 0) {
@@ -122,7 +134,7 @@ public:
 			c = c / temp;*/
 
 			// Gamma correction with sqrt for gamma 2.0
-			c = Vec3(std::sqrt(c.x), std::sqrt(c.y), std::sqrt(c.z));
+			c = Vec3d(std::sqrt(c.x), std::sqrt(c.y), std::sqrt(c.z));
 
 			// Clamp and convert to unsigned char since stb_image_write needs that format
 			frameBuffer[3 * i + 0] = (unsigned char)(std::min(255.0, c.x * 255));
@@ -135,5 +147,71 @@ public:
 		ofs << "P6\n" << width << " " << height << "\n255\n";
 		ofs.write(reinterpret_cast<char*>(frameBuffer.data()), frameBuffer.size());
 		ofs.close();
+
+#ifdef TRAVERSAL_STATS
+		writeHeatmap(pixelStats, width, height, heatmapFilename(filename));
+		printStats(pixelStats);
+#endif
+	}
+
+private:
+	// The heatmap is written next to the image, test.ppm gives test_heatmap.ppm
+	static std::string heatmapFilename(const std::string& filename) {
+		size_t dot = filename.find_last_of('.');
+		if (dot == std::string::npos) {
+			return filename + "_heatmap";
+		}
+		return filename.substr(0, dot) + "_heatmap" + filename.substr(dot);
+	}
+
+	// False color image of the traversal work per pixel (nodes visited plus primitives tested), blue for the
+	// cheapest pixels through green and yellow to red for the most expensive one
+	static void writeHeatmap(const std::vector<TraversalStats>& pixelStats, int width, int height, const std::string& filename) {
+		uint64_t maxCost = 1;
+		for (const TraversalStats& stats : pixelStats) {
+			maxCost = std::max(maxCost, stats.cost());
+		}
+
+		const Vec3d ramp[] = { Vec3d(0.0, 0.0, 1.0), Vec3d(0.0, 1.0, 1.0), Vec3d(0.0, 1.0, 0.0), Vec3d(1.0, 1.0, 0.0), Vec3d(1.0, 0.0, 0.0) };
+		const int numSegments = (int)(sizeof(ramp) / sizeof(ramp[0])) - 1;
+
+		std::vector<unsigned char> heatmap(width * height * 3);
+		for (int i = 0; i < width * height; i++) {
+			double v = (double)pixelStats[i].cost() / (double)maxCost * numSegments;
+			int segment = std::min(numSegments - 1, (int)v);
+			double f = v - segment;
+			Vec3d c = ramp[segment] * (1.0 - f) + ramp[segment + 1] * f;
+
+			heatmap[3 * i + 0] = (unsigned char)(std::min(255.0, c.x * 255));
+			heatmap[3 * i + 1] = (unsigned char)(std::min(255.0, c.y * 255));
+			heatmap[3 * i + 2] = (unsigned char)(std::min(255.0, c.z * 255));
+		}
+
+		std::ofstream ofs(filename, std::ios::binary);
+		ofs << "P6\n" << width << " " << height << "\n255\n";
+		ofs.write(reinterpret_cast<char*>(heatmap.data()), heatmap.size());
+		ofs.close();
+
+		std::cout << "Traversal heatmap written to " << filename << ", red is " << maxCost << " nodes + tests per pixel" << std::endl;
+	}
+
+	// Totals over the whole image and averages per ray, closest hit and shadow rays together
+	static void printStats(const std::vector<TraversalStats>& pixelStats) {
+		TraversalStats total;
+		for (const TraversalStats& stats : pixelStats) {
+			total += stats;
+		}
+
+		double numRays = (double)std::max<uint64_t>(1, total.rays + total.shadowRays);
+		auto printCounter = [](const char* name, uint64_t count, double perRay, const char* rayKind) {
+			std::cout << "  " << name << count << " (" << count / perRay << " per " << rayKind << ")" << std::endl;
+		};
+
+		std::cout << "Traversal statistics:" << std::endl;
+		std::cout << "  Closest hit rays: " << total.rays << std::endl;
+		printCounter("Shadow tests:     ", total.shadowRays, (double)std::max<uint64_t>(1, total.rays), "closest hit ray");
+		printCounter("Nodes visited:    ", total.nodes, numRays, "ray");
+		printCounter("Triangle tests:   ", total.triangleTests, numRays, "ray");
+		printCounter("Sphere tests:     ", total.sphereTests, numRays, "ray");
 	}
 };
@@ -4,16 +4,51 @@
 #include <cmath>
 #include <vector>
 #include <fstream>
+#include <memory>
+#include <string>
+#include <limits>
+#include <unordered_set>
 
 #include "include/vec3.h"
 #include "include/ray.h"
+#include "include/bvh.h"
+#include "include/grid.h"
 #include "objectDrawer.h"
+#include "packedSpheres.h"
+#include "instance.h"
 
 
 /*
 * Classes for scene geometry, such as  triangles, objects and cube for the room itself
 */
 
+/// Closest hit found in the scene, only what the traversal produces. objIndex indexes Scene::spheres if isSphere is
+/// set, Scene::instances if isInstance is set and otherwise Scene::objs. For objects and instances primIndex is the
+/// triangle and u, v its barycentric coordinates. The shading attributes are fetched once for the final hit with
+/// Scene::surface
+struct SceneHit {
+	double t = std::numeric_limits<double>::infinity();
+	int objIndex = -1;
+	int primIndex = -1;
+	double u = 0.0, v = 0.0;
+	bool isSphere = false;
+	bool isInstance = false;
+};
+
+/// Shading attributes of a hit. The normal of triangles faces the incoming ray, the normal of spheres points out.
+/// material is the hit's entry in the material table
+struct SurfaceHit {
+	Vec3 point, normal, color;
+	MaterialID material = Materials::diffuse;
+};
+
+/// Acceleration structure over the scene objects and spheres. The grid suits many similar-size primitives spread
+/// evenly through the scene, the BVH adapts to clustered ones
+enum class SceneAccelerator {
+	BVH,
+	Grid
+};
+
 /// Class to make the scene room, that ie a cube 
 class Scene {
 public:
@@ -21,6 +56,31 @@ public:
 	std::vector<std::shared_ptr<Sphere>> spheres;
 	std::vector<std::shared_ptr<TriObj>> lightSources;
 
+	// Placed copies of objects, any number of instances share the mesh and BVH of one TriObj
+	std::vector<std::shared_ptr<Instance>> instances;
+
+	// Top-level acceleration structure over the object bounds. Primitive i < objs.size() is objs[i], the next
+	// instances.size() primitives are the instances and the remaining ones the spheres. Every TriObj has its own
+	// bottom-level BVH underneath
+	BVH tlas;
+
+	// Single precision copy of the spheres in tlas leaf order, so the spheres of a leaf are tested together
+	PackedSpheres packedSpheres;
+
+	// Alternative top-level structure, used instead of tlas when accelerator is SceneAccelerator::Grid
+	Grid grid;
+	SceneAccelerator accelerator = SceneAccelerator::BVH;
+
+	// Algorithm and traversal layout used for all BVH builds in the scene
+	BVHBuilder bvhBuilder = BVHBuilder::BinnedSAH;
+	BVHLayout bvhLayout = BVHLayout::Wide;
+
+	// Directory of the on-disk BVH cache, caching is disabled while this is empty
+	std::string bvhCacheDir;
+
+	// Number of objects, instances and spheres the top-level BVH was built for
+	size_t tlasPrimCount = 0;
+
 	const double distToRoofOffset = 1e-4;
 
 	/*Vec3 lightPos = Vec3(4, 2, 10);*/
@@ -48,69 +108,59 @@ public:
 		// Area light
 		auto ceilingLight = std::make_shared<TriObj>();
 
-		// Set up vertices based on the specified light position, area light size specifes size of the area light
+		// Set up the corner based on the specified light position, area light size specifes size of the area light
 		double areaLightSize = 0.5;
 		Vec3 lightV0(lightPos.x - areaLightSize, lightPos.y - areaLightSize, lightPos.z);
-		Vec3 lightV1(lightPos.x - areaLightSize, lightPos.y + areaLightSize, lightPos.z);
-		Vec3 lightV2(lightPos.x + areaLightSize, lightPos.y - areaLightSize, lightPos.z);
-		Vec3 lightV3(lightPos.x + areaLightSize, lightPos.y + areaLightSize, lightPos.z);
-
-		// Triangles lie flat on the z-plane
-		ceilingLight->addTriangle(Triangle(lightV0, lightV1, lightV3, Vec3(1.0, 1.0, 1.0)));
-		ceilingLight->addTriangle(Triangle(lightV0, lightV3, lightV2, Vec3(1.0, 0.95, 1.0)));
-		ceilingLight->setMat("EMISSIVE");
+
+		// One parallelogram that lies flat on the z-plane
+		ceilingLight->addParallelogram(lightV0, Vec3(0, 2 * areaLightSize, 0), Vec3(2 * areaLightSize, 0, 0), Vec3(1.0, 1.0, 1.0));
+		ceilingLight->setMat(Materials::emissive);
 		addTriObj(ceilingLight);
 		addLightSources(ceilingLight);
 
 		// Floor - White
 		auto floor = std::make_shared<TriObj>();
-		floor->addTriangle(Triangle(v0, v1, v2, Vec3(0.8, 0.8, 0.8)));
-		floor->addTriangle(Triangle(v0, v2, v3, Vec3(0.8, 0.8, 0.8)));
-		floor->setMat("DIFFUSE");
+		floor->addParallelogram(v0, v1 - v0, v3 - v0, Vec3(0.8, 0.8, 0.8));
+		floor->setMat(Materials::diffuse);
 		addTriObj(floor);
 
 		// The wall behind the camera
 		auto leftWall = std::make_shared<TriObj>();
-		leftWall->addTriangle(Triangle(v0, v3, v7, Vec3(0.8, 0.2, 0.2)));
-		leftWall->addTriangle(Triangle(v0, v7, v4, Vec3(0.8, 0.2, 0.2)));
-		leftWall->setMat("DIFFUSE");
+		leftWall->addParallelogram(v0, v3 - v0, v4 - v0, Vec3(0.8, 0.2, 0.2));
+		leftWall->setMat(Materials::diffuse);
 		addTriObj(leftWall);
 
 		// Back wall - green
 		auto rightWall = std::make_shared<TriObj>();
-		rightWall->addTriangle(Triangle(v1, v5, v6, Vec3(0.8, 0.8, 0.8)));
-		rightWall->addTriangle(Triangle(v1, v6, v2, Vec3(0.8, 0.8, 0.8)));
-		rightWall->setMat("MIRROR");
+		rightWall->addParallelogram(v1, v5 - v1, v2 - v1, Vec3(0.8, 0.8, 0.8));
+		rightWall->setMat(Materials::mirror);
 		addTriObj(rightWall);
 
 		// Left wall - blue
 		auto backWall = std::make_shared<TriObj>();
-		backWall->addTriangle(Triangle(v0, v4, v5, Vec3(0.2, 0.2, 0.8)));
-		backWall->addTriangle(Triangle(v0, v5, v1, Vec3(0.2, 0.2, 0.8)));
-		backWall->setMat("DIFFUSE");
+		backWall->addParallelogram(v0, v4 - v0, v1 - v0, Vec3(0.2, 0.2, 0.8));
+		backWall->setMat(Materials::diffuse);
 		addTriObj(backWall);
 
 		// Right wall - yellow
 		auto frontWall = std::make_shared<TriObj>();
-		frontWall->addTriangle(Triangle(v3, v2, v6, Vec3(0.8, 0.8, 0.2)));
-		frontWall->addTriangle(Triangle(v3, v6, v7, Vec3(0.8, 0.8, 0.2)));
-		frontWall->setMat("DIFFUSE");
+		frontWall->addParallelogram(v3, v2 - v3, v7 - v3, Vec3(0.8, 0.8, 0.2));
+		frontWall->setMat(Materials::diffuse);
 		addTriObj(frontWall);
 
 		// Ceiling - white (red)
 		auto ceiling = std::make_shared<TriObj>();
 		/*ceiling->addTriangle(Triangle(v4, v7, v6, Vec3(0.9, 0.3, 0.3)));
 		ceiling->addTriangle(Triangle(v4, v6, v5, Vec3(0.9, 0.3, 0.3)));*/
-		ceiling->addTriangle(Triangle(v4, v7, v6, Vec3(0.9, 0.9, 0.9)));
-		ceiling->addTriangle(Triangle(v4, v6, v5, Vec3(0.9, 0.9, 0.9)));
-		ceiling->setMat("DIFFUSE");
+		ceiling->addParallelogram(v4, v7 - v4, v5 - v4, Vec3(0.9, 0.9, 0.9));
+		ceiling->setMat(Materials::diffuse);
 		addTriObj(ceiling);
 
 		// Add a sphere to the scene
 		Vec3 sphereCenterPoint(3.0, 2.5, 1.4);
 		Vec3 sphereColor(0.8, 0.8, 0.8);
 		double sphereRadius = 0.45;
-		std::string sphereMat = "MIRROR";
+		MaterialID sphereMat = Materials::mirror;
 		auto sphere = std::make_shared<Sphere>(sphereCenterPoint, sphereRadius, sphereColor, sphereMat);
 		addSphere(sphere);
 
@@ -118,7 +168,7 @@ public:
 		Vec3 cubeCenterPoint(2.5, 0, 2);
 		double cubeSideLenghts = 1.0;
 		Vec3 cubeColour(0.9, 0.9, 0.9);
-		std::string cubeMat = "MIRROR";
+		MaterialID cubeMat = Materials::mirror;
 		auto cube = std::make_shared<TriObj>();
 		cube->createCube(cubeCenterPoint, cubeSideLenghts, cubeColour);
 		cube->setMat(cubeMat);
@@ -139,4 +189,284 @@ public:
 		lightSources.push_back(obj);
 	}
 
+	void addInstance(const std::shared_ptr<Instance>& instance) {
+		instances.push_back(instance);
+	}
+
+	// Build the bottom-level BVH of every object and the top-level BVH over them, has to be called again when
+	// objects are added. Bottom-level trees are taken from the cache when bvhCacheDir is set
+	void buildBVH() {
+		BVHCache cache(bvhCacheDir);
+		for (TriObj* obj : uniqueObjects()) {
+			obj->buildBVH(bvhBuilder, bvhLayout, bvhCacheDir.empty() ? nullptr : &cache);
+		}
+		buildTLAS();
+	}
+
+	// Rebuild the top-level structure from the current object and sphere bounds
+	void buildTLAS() {
+		std::vector<AABB> objBounds = topLevelBounds();
+
+		if (accelerator == SceneAccelerator::Grid) {
+			grid.build(objBounds);
+			tlas = BVH();
+		}
+		else {
+			// Spheres are tested a full lane group at a time, which the builder should know to fill the leaves
+			tlas.leafBatchSize = spheres.empty() ? 1 : PackedSpheres::laneWidth;
+			tlas.build(objBounds, bvhBuilder, bvhLayout);
+			grid.clear();
+		}
+		tlasPrimCount = objBounds.size();
+		packSpheres();
+	}
+
+	// After changing one object only its own BVH is rebuilt, the top level is cheap since it only holds objects
+	void rebuildObject(int objIndex) {
+		BVHCache cache(bvhCacheDir);
+		objs[objIndex]->buildBVH(bvhBuilder, bvhLayout, bvhCacheDir.empty() ? nullptr : &cache);
+		buildTLAS();
+	}
+
+	// Per-frame update after objects or spheres moved. Every BVH is refitted and only rebuilt once its quality
+	// dropped too far, see TriObj::updateBVH. The cache is not used since animated geometry changes every frame
+	void updateBVH() {
+		for (TriObj* obj : uniqueObjects()) {
+			obj->updateBVH(bvhBuilder, bvhLayout);
+		}
+		updateTLAS();
+	}
+
+	// Update a single moved object, the other objects keep their BVHs as they are
+	void updateObject(int objIndex) {
+		objs[objIndex]->updateBVH(bvhBuilder, bvhLayout);
+		updateTLAS();
+	}
+
+	// Refit the top-level BVH to the current object, instance and sphere bounds, rebuilt if objects were added or removed or
+	// the refit degraded it too far. The grid has no refit, it builds in linear time
+	void updateTLAS() {
+		if (accelerator == SceneAccelerator::Grid) {
+			buildTLAS();
+			return;
+		}
+
+		std::vector<AABB> objBounds = topLevelBounds();
+		if (tlas.empty() || tlasPrimCount != objBounds.size() || tlas.refit(objBounds) > BVH::maxRefitCostGrowth) {
+			buildTLAS();
+			return;
+		}
+
+		// The refitted tree keeps its leaves, only the sphere positions are packed again
+		packSpheres();
+	}
+
+	// Closest hit among all objects, instances and spheres
+	bool intersect(const Ray& ray, SceneHit& hit) const {
+		TRAVERSAL_STAT(rays);
+		double tClosest = std::numeric_limits<double>::infinity();
+		int numObjs = (int)objs.size();
+		int firstSphere = sphereOffset();
+
+		// Only objects whose bounds the ray crosses are entered, and only triangles closer than the current hit count
+		auto leafTest = [&](int prim, double& tMax) {
+			if (prim < firstSphere) {
+				bool isInstance = prim >= numObjs;
+				PackedTriangles::Hit triHit;
+				if (isInstance ? instances[prim - numObjs]->intersect(ray, tMax, triHit) : objs[prim]->intersect(ray, tMax, triHit)) {
+					hit.objIndex = isInstance ? prim - numObjs : prim;
+					hit.primIndex = triHit.prim;
+					hit.u = triHit.u;
+					hit.v = triHit.v;
+					hit.isSphere = false;
+					hit.isInstance = isInstance;
+					return true;
+				}
+				return false;
+			}
+
+			double t = spheres[prim - firstSphere]->RaySphereIntersection(ray);
+			if (t > 0.0 && t < tMax) {
+				tMax = t;
+				hit.objIndex = prim - firstSphere;
+				hit.primIndex = -1;
+				hit.isSphere = true;
+				hit.isInstance = false;
+				return true;
+			}
+			return false;
+		};
+
+		bool found = false;
+		if (accelerator == SceneAccelerator::Grid) {
+			found = grid.intersect(ray, tClosest, leafTest);
+		}
+		else {
+			// The spheres of a leaf go through the packed kernel in one pass, then its objects are entered one by one
+			PackedTriangles::FloatRay floatRay(ray);
+			found = tlas.intersectLeaves(ray, tClosest, [&](int first, int count, double& tMax) {
+				bool leafHit = false;
+				int sphere = -1;
+				if (!packedSpheres.empty() && packedSpheres.intersect(floatRay, first, count, tMax, sphere)) {
+					hit.objIndex = sphere;
+					hit.primIndex = -1;
+					hit.isSphere = true;
+					hit.isInstance = false;
+					leafHit = true;
+				}
+				for (int i = first; i < first + count; ++i) {
+					int prim = tlas.primIndices[i];
+					if (prim < firstSphere) {
+						leafHit |= leafTest(prim, tMax);
+					}
+					else {
+						TRAVERSAL_STAT(sphereTests);
+					}
+				}
+				return leafHit;
+				});
+
+			// The packed distance is single precision, the final sphere hit is measured again in double
+			if (found && hit.isSphere) {
+				double t = spheres[hit.objIndex]->RaySphereIntersection(ray);
+				if (t > 0.0) {
+					tClosest = t;
+				}
+			}
+		}
+
+		if (found) {
+			hit.t = tClosest;
+		}
+		return found;
+	}
+
+	// Shading attributes of a hit returned by intersect
+	SurfaceHit surface(const Ray& ray, const SceneHit& hit) const {
+		SurfaceHit surf;
+		surf.point = ray.origin + ray.direction * hit.t;
+
+		if (hit.isSphere) {
+			const Sphere& sphere = *spheres[hit.objIndex];
+			surf.normal = (surf.point - sphere.centerPoint).normalize();
+			surf.color = sphere.color;
+			surf.material = sphere.material;
+			return surf;
+		}
+
+		if (hit.isInstance) {
+			const Instance& instance = *instances[hit.objIndex];
+			surf.normal = instance.normal(hit.primIndex);
+			surf.color = instance.color(hit.primIndex, hit.u, hit.v);
+			surf.material = instance.getMat(hit.primIndex);
+		}
+		else {
+			const TriObj& obj = *objs[hit.objIndex];
+			surf.normal = obj.normal(hit.primIndex);
+			surf.color = obj.color(hit.primIndex, hit.u, hit.v);
+			surf.material = obj.getMat(hit.primIndex);
+		}
+		if (surf.normal.dotProduct(ray.direction) > 0.0) {
+			surf.normal = surf.normal * -1.0; // flip so it faces the incoming ray
+		}
+		return surf;
+	}
+
+	// Occlusion query for shadow rays, true if an opaque object or sphere blocks the ray before tMax. Transparent
+	// (GLASS) objects are skipped, the first blocker found ends the search and no shading data is computed
+	bool occluded(const Ray& ray, double tMax) const {
+		TRAVERSAL_STAT(shadowRays);
+		int numObjs = (int)objs.size();
+		int firstSphere = sphereOffset();
+
+		auto anyHit = [&](int prim) {
+			if (prim < numObjs) {
+				const TriObj& obj = *objs[prim];
+				return !obj.isTransparent() && obj.occluded(ray, tMax);
+			}
+			if (prim < firstSphere) {
+				const Instance& instance = *instances[prim - numObjs];
+				return !instance.isTransparent() && instance.occluded(ray, tMax);
+			}
+
+			const Sphere& sphere = *spheres[prim - firstSphere];
+			if (sphere.isTransparent()) {
+				return false;
+			}
+			double t = sphere.RaySphereIntersection(ray);
+			return t > 0.0 && t < tMax;
+		};
+
+		if (accelerator == SceneAccelerator::Grid) {
+			return grid.occluded(ray, tMax, anyHit);
+		}
+
+		PackedTriangles::FloatRay floatRay(ray);
+		return tlas.occludedLeaves(ray, tMax, [&](int first, int count) {
+			if (!packedSpheres.empty() && packedSpheres.occluded(floatRay, first, count, tMax)) {
+				return true;
+			}
+			for (int i = first; i < first + count; ++i) {
+				int prim = tlas.primIndices[i];
+				if (prim < firstSphere) {
+					if (anyHit(prim)) {
+						return true;
+					}
+				}
+				else {
+					TRAVERSAL_STAT(sphereTests);
+				}
+			}
+			return false;
+			});
+	}
+
+private:
+	// Top-level primitive index of the first sphere
+	int sphereOffset() const {
+		return (int)(objs.size() + instances.size());
+	}
+
+	// The scene objects and the objects the instances share, each once however often it is placed
+	std::vector<TriObj*> uniqueObjects() const {
+		std::vector<TriObj*> unique;
+		std::unordered_set<const TriObj*> seen;
+		for (const auto& obj : objs) {
+			if (seen.insert(obj.get()).second) {
+				unique.push_back(obj.get());
+			}
+		}
+		for (const auto& instance : instances) {
+			if (seen.insert(instance->sharedObject().get()).second) {
+				unique.push_back(instance->sharedObject().get());
+			}
+		}
+		return unique;
+	}
+
+	// Bounds of the top-level primitives, the objects followed by the instances and the spheres
+	std::vector<AABB> topLevelBounds() const {
+		std::vector<AABB> objBounds;
+		objBounds.reserve(objs.size() + instances.size() + spheres.size());
+		for (const auto& obj : objs) {
+			objBounds.push_back(obj->bounds());
+		}
+		for (const auto& instance : instances) {
+			objBounds.push_back(instance->bounds());
+		}
+		for (const auto& sphere : spheres) {
+			objBounds.push_back(sphere->bounds());
+		}
+		return objBounds;
+	}
+
+	// Pack the spheres in the order of the top-level BVH leaves, the grid tests them one by one
+	void packSpheres() {
+		if (spheres.empty() || accelerator == SceneAccelerator::Grid) {
+			packedSpheres.clear();
+		}
+		else {
+			packedSpheres.build(spheres, tlas.primIndices, sphereOffset());
+		}
+	}
 };
\ No newline at end of file
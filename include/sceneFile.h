@@ -0,0 +1,666 @@
+#pragma once
+
+#include "roomClass.h"
+#include "bvhCache.h"
+#include "mappedFile.h"
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <type_traits>
+
+/// Versioned binary scene file. A header and a table of blocks is followed by the blocks, each a raw array starting
+/// at a multiple of blockAlignment. Every object has its vertex, index, face color and face material blocks, its
+/// vertex colors and face shapes if it has them, its palettes and its bottom-level BVH with the wide nodes. Spheres,
+/// instances, the materials with their parameters and the strings naming them are scene-wide blocks. Loading maps the file and the vertex
+/// and per face buffers of the meshes view the mapping directly, the BVH is copied out and the packed triangles are
+/// gathered, so the startup cost is the page faults plus a linear pass instead of parsing and building. Files written
+/// by a build with the other Real type are converted
+class SceneFile {
+public:
+	// Bump when the records or block layout change, files of other versions are rejected
+	static constexpr uint32_t formatVersion = 4;
+
+	// Blocks start at a multiple of this so the mapped arrays suit the wide SIMD loads
+	static constexpr size_t blockAlignment = 64;
+
+	// Reason the last write or load failed
+	std::string error;
+
+	// Write the objects, instances, spheres and lights of a scene, BVHs that were built are stored with their objects
+	bool write(const std::string& path, const Scene& scene) {
+		return write(path, scene.objs, scene.instances, scene.spheres, scene.lightSources);
+	}
+
+	// Write the given objects, instances and spheres. Objects the instances share are stored once, objects that
+	// are only shared are not placed in the scene on their own when loaded. Lights have to be among objs
+	bool write(const std::string& path, const std::vector<std::shared_ptr<TriObj>>& objs,
+		const std::vector<std::shared_ptr<Instance>>& instances = {}, const std::vector<std::shared_ptr<Sphere>>& spheres = {},
+		const std::vector<std::shared_ptr<TriObj>>& lights = {}) {
+		error.clear();
+		Writer writer;
+
+		// Materials the file uses, numbered in the order they are first met
+		std::vector<MaterialID> materials;
+		std::vector<MaterialRecord> materialRecords;
+		auto materialIndex = [&](MaterialID id) {
+			if (id == Materials::none) {
+				return noMaterial;
+			}
+			for (size_t i = 0; i < materials.size(); ++i) {
+				if (materials[i] == id) {
+					return (uint32_t)i;
+				}
+			}
+			const Material& material = Materials::get(id);
+			MaterialRecord record;
+			record.name = writer.string(material.name);
+			record.type = (uint32_t)material.type;
+			const Vec3* values[2] = { &material.albedo, &material.emission };
+			for (int k = 0; k < 2; ++k) {
+				record.values[k * 4] = values[k]->x;
+				record.values[k * 4 + 1] = values[k]->y;
+				record.values[k * 4 + 2] = values[k]->z;
+			}
+			record.values[3] = material.ior;
+			materials.push_back(id);
+			materialRecords.push_back(record);
+			return (uint32_t)(materials.size() - 1);
+		};
+
+		// Placed objects first, then the ones only the instances use
+		std::vector<const TriObj*> objects;
+		auto objectIndex = [&](const TriObj* obj) {
+			for (size_t i = 0; i < objects.size(); ++i) {
+				if (objects[i] == obj) {
+					return (uint32_t)i;
+				}
+			}
+			objects.push_back(obj);
+			return (uint32_t)(objects.size() - 1);
+		};
+		std::vector<ObjectRecord> objectRecords;
+		for (const auto& obj : objs) {
+			objectIndex(obj.get());
+			ObjectRecord record;
+			record.material = materialIndex(obj->getMat());
+			record.flags = placedFlag;
+			for (const auto& light : lights) {
+				record.flags |= light == obj ? lightFlag : 0;
+			}
+			objectRecords.push_back(record);
+		}
+		std::vector<InstanceRecord> instanceRecords;
+		for (const auto& instance : instances) {
+			InstanceRecord record;
+			record.object = objectIndex(instance->sharedObject().get());
+			const Transform& t = instance->objectToWorld();
+			const Vec3* rows[4] = { &t.row0, &t.row1, &t.row2, &t.offset };
+			for (int r = 0; r < 4; ++r) {
+				record.transform[r * 3] = rows[r]->x;
+				record.transform[r * 3 + 1] = rows[r]->y;
+				record.transform[r * 3 + 2] = rows[r]->z;
+			}
+			instanceRecords.push_back(record);
+		}
+		for (size_t i = objectRecords.size(); i < objects.size(); ++i) {
+			ObjectRecord record;
+			record.material = materialIndex(objects[i]->getMat());
+			objectRecords.push_back(record);
+		}
+
+		std::vector<SphereRecord> sphereRecords;
+		for (const auto& sphere : spheres) {
+			SphereRecord record;
+			const Vec3 values[2] = { sphere->centerPoint, sphere->color };
+			for (int k = 0; k < 2; ++k) {
+				record.values[k * 4] = values[k].x;
+				record.values[k * 4 + 1] = values[k].y;
+				record.values[k * 4 + 2] = values[k].z;
+			}
+			record.values[3] = sphere->radius;
+			record.material = materialIndex(sphere->material);
+			sphereRecords.push_back(record);
+		}
+
+		for (uint32_t o = 0; o < (uint32_t)objects.size(); ++o) {
+			const IndexedMesh& mesh = objects[o]->mesh;
+			if (!mesh.consistent()) {
+				error = "object " + std::to_string(o) + " has vertex colors that don't match its vertices";
+				return false;
+			}
+			writer.block(BlockType::Vertices, o, mesh.vertices.data(), mesh.vertices.size());
+			writer.block(BlockType::VertexColors, o, mesh.vertexColors.data(), mesh.vertexColors.size());
+			writer.block(BlockType::Indices, o, mesh.indices.data(), mesh.indices.size());
+			writer.block(BlockType::FaceColors, o, mesh.faceColors.data(), mesh.faceColors.size());
+			writer.block(BlockType::FaceMaterials, o, mesh.faceMaterials.data(), mesh.faceMaterials.size());
+			writer.block(BlockType::FaceShapes, o, mesh.faceShapes.data(), mesh.faceShapes.size());
+			writer.block(BlockType::Colors, o, mesh.colors.data(), mesh.colors.size());
+			std::vector<uint32_t> faceMaterials;
+			for (MaterialID id : mesh.materials) {
+				faceMaterials.push_back(materialIndex(id));
+			}
+			writer.ownedBlock(BlockType::Materials, o, faceMaterials);
+
+			const BVH& bvh = objects[o]->bvh();
+			if (!bvh.empty()) {
+				writer.block(BlockType::BVHNodes, o, bvh.nodes.data(), bvh.nodes.size());
+				writer.block(BlockType::BVHPrims, o, bvh.primIndices.data(), bvh.primIndices.size());
+				writer.block(BlockType::BVHWideNodes, o, bvh.wide.nodes.data(), bvh.wide.nodes.size());
+			}
+		}
+		writer.ownedBlock(BlockType::Objects, 0, objectRecords);
+		writer.ownedBlock(BlockType::Instances, 0, instanceRecords);
+		writer.ownedBlock(BlockType::Spheres, 0, sphereRecords);
+		writer.ownedBlock(BlockType::MaterialTable, 0, materialRecords);
+		writer.ownedBlock(BlockType::Strings, 0, writer.strings);
+
+		if (!writer.write(path)) {
+			error = "cannot write " + path;
+			return false;
+		}
+		return true;
+	}
+
+	// Add the contents of a scene file to scene and rebuild its top level. Objects without a stored BVH, or written
+	// with the other Real type, get theirs built with the scene's builder. Nothing is added if the file is invalid
+	bool load(const std::string& path, Scene& scene) {
+		error.clear();
+		auto file = std::make_shared<MappedFile>();
+		if (!file->open(path)) {
+			return fail("cannot open " + path);
+		}
+
+		Header header;
+		if (file->size() < sizeof(Header)) {
+			return fail(path + " is not a scene file");
+		}
+		std::memcpy(&header, file->data(), sizeof(Header));
+		if (std::memcmp(header.magic, "TNSC", 4) != 0) {
+			return fail(path + " is not a scene file");
+		}
+		if (header.version != formatVersion) {
+			return fail(path + " has format version " + std::to_string(header.version) + ", expected " + std::to_string(formatVersion));
+		}
+		if (header.fileSize != file->size() || (header.realSize != sizeof(float) && header.realSize != sizeof(double)) ||
+			sizeof(Header) + (uint64_t)header.blockCount * sizeof(BlockEntry) > file->size() || header.objectCount > header.blockCount) {
+			return fail(path + " is truncated or corrupt");
+		}
+
+		// Block table, every object gets its blocks by type
+		const size_t numTypes = (size_t)BlockType::Count;
+		std::vector<BlockEntry> entries(header.blockCount);
+		std::memcpy(entries.data(), file->data() + sizeof(Header), entries.size() * sizeof(BlockEntry));
+		std::vector<const BlockEntry*> objectBlocks((size_t)header.objectCount * numTypes, nullptr);
+		std::vector<const BlockEntry*> sceneBlocks(numTypes, nullptr);
+		for (const BlockEntry& entry : entries) {
+			if (entry.type >= numTypes || entry.offset % blockAlignment != 0 || entry.offset > file->size() ||
+				entry.bytes > file->size() - entry.offset) {
+				return fail(path + " has a block outside the file");
+			}
+			if (isSceneBlock((BlockType)entry.type)) {
+				sceneBlocks[entry.type] = &entry;
+			}
+			else if (entry.object < header.objectCount) {
+				objectBlocks[(size_t)entry.object * numTypes + entry.type] = &entry;
+			}
+		}
+
+		// Strings are null terminated and numbered in order
+		std::vector<std::string_view> strings;
+		if (const BlockEntry* block = sceneBlocks[(size_t)BlockType::Strings]) {
+			const char* p = (const char*)file->data() + block->offset;
+			const char* end = p + block->bytes;
+			while (p < end) {
+				const char* nul = (const char*)std::memchr(p, '\0', (size_t)(end - p));
+				if (nul == nullptr) {
+					return fail(path + " has an unterminated string");
+				}
+				strings.emplace_back(p, (size_t)(nul - p));
+				p = nul + 1;
+			}
+		}
+		auto string = [&](uint32_t index, std::string& out) {
+			if (index >= strings.size()) {
+				return false;
+			}
+			out = std::string(strings[index]);
+			return true;
+		};
+
+		// Materials are added to the table, loading the same file again finds them there
+		std::vector<MaterialID> materials;
+		for (const MaterialRecord& record : records<MaterialRecord>(*file, sceneBlocks[(size_t)BlockType::MaterialTable])) {
+			Material material;
+			const double* v = record.values;
+			if (!string(record.name, material.name) || record.type > (uint32_t)MaterialType::Emissive ||
+				!isFinite(Vec3(v[0], v[1], v[2])) || !isFinite(Vec3(v[4], v[5], v[6])) || !(v[3] > 0.0 && v[3] <= maxCoordinate)) {
+				return fail(path + " has a broken material table");
+			}
+			material.type = (MaterialType)record.type;
+			material.albedo = Vec3(v[0], v[1], v[2]);
+			material.ior = v[3];
+			material.emission = Vec3(v[4], v[5], v[6]);
+			materials.push_back(Materials::add(material));
+		}
+		auto material = [&](uint32_t index, MaterialID& out) {
+			if (index == noMaterial) {
+				out = Materials::none;
+				return true;
+			}
+			if (index >= materials.size()) {
+				return false;
+			}
+			out = materials[index];
+			return true;
+		};
+
+		std::vector<ObjectRecord> objectRecords = records<ObjectRecord>(*file, sceneBlocks[(size_t)BlockType::Objects]);
+		if (objectRecords.size() != header.objectCount) {
+			return fail(path + " has a broken object table");
+		}
+
+		// Objects, the mesh buffers view the mapping when the Real types match
+		std::shared_ptr<const void> owner = file;
+		bool sameReal = header.realSize == sizeof(Real);
+		std::vector<std::shared_ptr<TriObj>> objects;
+		for (uint32_t o = 0; o < header.objectCount; ++o) {
+			auto block = [&](BlockType type) { return objectBlocks[(size_t)o * numTypes + (size_t)type]; };
+			auto obj = std::make_shared<TriObj>();
+			IndexedMesh& mesh = obj->mesh;
+
+			MaterialID objectMaterial;
+			if (!material(objectRecords[o].material, objectMaterial) || objectMaterial == Materials::none) {
+				return fail(path + " names a material that doesn't exist");
+			}
+			obj->setMat(objectMaterial);
+
+			if (!vec3Buffer(*file, owner, block(BlockType::Vertices), header.realSize, mesh.vertices) ||
+				!viewBuffer(*file, owner, block(BlockType::VertexColors), mesh.vertexColors) ||
+				!viewBuffer(*file, owner, block(BlockType::Indices), mesh.indices) ||
+				!viewBuffer(*file, owner, block(BlockType::FaceColors), mesh.faceColors) ||
+				!viewBuffer(*file, owner, block(BlockType::FaceMaterials), mesh.faceMaterials) ||
+				!viewBuffer(*file, owner, block(BlockType::FaceShapes), mesh.faceShapes)) {
+				return fail(path + " has a misaligned mesh block");
+			}
+			MeshBuffer<Vec3> colors;
+			if (!vec3Buffer(*file, owner, block(BlockType::Colors), header.realSize, colors)) {
+				return fail(path + " has a misaligned color block");
+			}
+			mesh.colors.assign(colors.begin(), colors.end());
+			for (uint32_t index : records<uint32_t>(*file, block(BlockType::Materials))) {
+				mesh.materials.emplace_back();
+				if (!material(index, mesh.materials.back())) {
+					return fail(path + " names a material that doesn't exist");
+				}
+			}
+
+			// The traversal trusts the indices, so a corrupt file must not get past here. Read through a const
+			// reference, writable access would copy the views
+			const IndexedMesh& mapped = mesh;
+			size_t numFaces = mapped.faceColors.size();
+			if (mapped.indices.size() != numFaces * 3 || mapped.faceMaterials.size() != numFaces ||
+				(numFaces > 0 && mapped.colors.empty()) ||
+				(!mapped.vertexColors.empty() && mapped.vertexColors.size() != mapped.vertices.size()) ||
+				(!mapped.faceShapes.empty() && mapped.faceShapes.size() != numFaces)) {
+				return fail(path + " has a mesh with inconsistent block sizes");
+			}
+			uint32_t maxIndex = 0;
+			for (uint32_t index : mapped.indices) {
+				maxIndex = std::max(maxIndex, index);
+			}
+			uint16_t maxColor = 0;
+			for (uint16_t color : mapped.faceColors) {
+				maxColor = std::max(maxColor, color);
+			}
+			for (FaceShape shape : mapped.faceShapes) {
+				if (shape != FaceShape::Triangle && shape != FaceShape::Parallelogram) {
+					return fail(path + " has a face of unknown shape");
+				}
+			}
+			if (numFaces > 0 && (maxIndex >= mapped.vertices.size() || maxColor >= mapped.colors.size())) {
+				return fail(path + " has a face referencing a vertex or color that doesn't exist");
+			}
+			AABB vertexBounds;
+			for (const Vec3& v : mapped.vertices) {
+				if (!isFinite(v)) {
+					return fail(path + " has a vertex that isn't a finite number");
+				}
+				vertexBounds.expand(v);
+			}
+
+			// The stored BVH is used if it was written with the same node layout, its wide nodes if also with the
+			// same BVH width. Otherwise the wide nodes are collapsed again from the binary ones
+			const BlockEntry* nodes = block(BlockType::BVHNodes);
+			const BlockEntry* prims = block(BlockType::BVHPrims);
+			const BlockEntry* wideNodes = block(BlockType::BVHWideNodes);
+			bool hasBVH = false;
+			if (sameReal && nodes && prims && nodes->bytes > 0 && prims->bytes > 0 && nodes->bytes % sizeof(BVHNode) == 0 &&
+				prims->bytes % sizeof(int) == 0) {
+				BVH bvh;
+				bvh.nodes.resize(nodes->bytes / sizeof(BVHNode));
+				bvh.primIndices.resize(prims->bytes / sizeof(int));
+				std::memcpy(bvh.nodes.data(), file->data() + nodes->offset, nodes->bytes);
+				std::memcpy(bvh.primIndices.data(), file->data() + prims->offset, prims->bytes);
+				if (wideNodes && wideNodes->bytes > 0 && header.wideWidth == BVH_WIDTH && scene.bvhLayout == BVHLayout::Wide &&
+					wideNodes->bytes % sizeof(WideBVHNode<BVH_WIDTH>) == 0) {
+					bvh.wide.nodes.resize(wideNodes->bytes / sizeof(WideBVHNode<BVH_WIDTH>));
+					std::memcpy((void*)bvh.wide.nodes.data(), file->data() + wideNodes->offset, wideNodes->bytes);
+				}
+				if (!bvh.nodes.empty() && BVHCache::isValid(bvh, (int)numFaces) && contains(bvh.nodes[0].bounds, vertexBounds)) {
+					obj->setBVH(std::move(bvh), scene.bvhLayout);
+					hasBVH = true;
+				}
+			}
+			if (!hasBVH) {
+				obj->buildBVH(scene.bvhBuilder, scene.bvhLayout);
+			}
+			objects.push_back(obj);
+		}
+
+		std::vector<std::shared_ptr<Instance>> instances;
+		for (const InstanceRecord& record : records<InstanceRecord>(*file, sceneBlocks[(size_t)BlockType::Instances])) {
+			if (record.object >= objects.size()) {
+				return fail(path + " has an instance of an object that doesn't exist");
+			}
+			const double* m = record.transform;
+			Transform t(Vec3(m[0], m[1], m[2]), Vec3(m[3], m[4], m[5]), Vec3(m[6], m[7], m[8]), Vec3(m[9], m[10], m[11]));
+			Transform inverse = t.inverse();
+			if (!isFinite(t.row0) || !isFinite(t.row1) || !isFinite(t.row2) || !isFinite(t.offset) ||
+				!isFinite(inverse.row0) || !isFinite(inverse.row1) || !isFinite(inverse.row2) || !isFinite(inverse.offset)) {
+				return fail(path + " has an instance with a singular transform");
+			}
+			instances.push_back(std::make_shared<Instance>(objects[record.object], t));
+		}
+
+		std::vector<std::shared_ptr<Sphere>> spheres;
+		for (const SphereRecord& record : records<SphereRecord>(*file, sceneBlocks[(size_t)BlockType::Spheres])) {
+			MaterialID sphereMaterial;
+			if (!material(record.material, sphereMaterial) || sphereMaterial == Materials::none) {
+				return fail(path + " names a material that doesn't exist");
+			}
+			const double* v = record.values;
+			if (!isFinite(Vec3(v[0], v[1], v[2])) || !(std::abs(v[3]) <= maxCoordinate)) {
+				return fail(path + " has a sphere that isn't finite");
+			}
+			spheres.push_back(std::make_shared<Sphere>(Vec3(v[0], v[1], v[2]), (Real)v[3], Vec3(v[4], v[5], v[6]), sphereMaterial));
+		}
+
+		// Everything is valid, add it to the scene. Objects without faces have no bounds and nothing to hit, they
+		// are left out of the top level
+		for (uint32_t o = 0; o < header.objectCount; ++o) {
+			if ((objectRecords[o].flags & placedFlag) && objects[o]->triangleCount() > 0) {
+				scene.addTriObj(objects[o]);
+			}
+			if (objectRecords[o].flags & lightFlag) {
+				scene.addLightSources(objects[o]);
+			}
+		}
+		for (const auto& instance : instances) {
+			if (instance->getObject().triangleCount() > 0) {
+				scene.addInstance(instance);
+			}
+		}
+		for (const auto& sphere : spheres) {
+			scene.addSphere(sphere);
+		}
+		scene.buildTLAS();
+		return true;
+	}
+
+private:
+	enum class BlockType : uint32_t {
+		Strings, Objects, Instances, Spheres, MaterialTable,
+		Vertices, VertexColors, Indices, FaceColors, FaceMaterials, FaceShapes, Colors, Materials, BVHNodes, BVHPrims, BVHWideNodes,
+		Count
+	};
+
+	static bool isSceneBlock(BlockType type) {
+		return type == BlockType::Strings || type == BlockType::Objects || type == BlockType::Instances || type == BlockType::Spheres ||
+			type == BlockType::MaterialTable;
+	}
+
+	static constexpr uint32_t placedFlag = 1;
+	static constexpr uint32_t lightFlag = 2;
+
+	// Material index of faces that use the material of their object
+	static constexpr uint32_t noMaterial = 0xffffffff;
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t realSize;
+		uint32_t blockCount;
+		uint64_t fileSize;
+		uint32_t objectCount;
+		uint32_t wideWidth;
+		uint32_t reserved[8];
+	};
+
+	struct BlockEntry {
+		uint32_t type;
+		uint32_t object;
+		uint64_t offset;
+		uint64_t bytes;
+	};
+
+	// Material is an index into the material table, flags tell if the object is placed in the scene and if it is a light
+	struct ObjectRecord {
+		uint32_t material = 0;
+		uint32_t flags = 0;
+	};
+
+	// Centre and radius, then color. Material is an index into the material table
+	struct SphereRecord {
+		double values[8] = {};
+		uint32_t material = 0;
+		uint32_t reserved = 0;
+	};
+
+	// Name is a string index and type a MaterialType. Albedo and refraction index, then emission
+	struct MaterialRecord {
+		uint32_t name = 0;
+		uint32_t type = 0;
+		double values[8] = {};
+	};
+
+	// Object to world transform as the three rows of the linear part and the translation
+	struct InstanceRecord {
+		uint32_t object = 0;
+		uint32_t reserved = 0;
+		double transform[12] = {};
+	};
+
+	static_assert(sizeof(Header) == 64, "the header is part of the file format");
+	static_assert(std::is_trivially_copyable<BVHNode>::value, "BVH nodes are written to disk as raw bytes");
+	static_assert(std::is_trivially_copyable<WideBVHNode<BVH_WIDTH>>::value, "BVH nodes are written to disk as raw bytes");
+
+	// Blocks collected in memory with their offsets, written in one go
+	struct Writer {
+		struct Block {
+			BlockEntry entry;
+			const void* data;
+		};
+		std::vector<Block> blocks;
+		std::vector<std::shared_ptr<std::vector<unsigned char>>> ownedData;
+		std::vector<char> strings;
+		std::vector<std::string> stringList;
+		uint64_t offset = 0;
+
+		uint32_t string(const std::string& s) {
+			for (size_t i = 0; i < stringList.size(); ++i) {
+				if (stringList[i] == s) {
+					return (uint32_t)i;
+				}
+			}
+			stringList.push_back(s);
+			strings.insert(strings.end(), s.begin(), s.end());
+			strings.push_back('\0');
+			return (uint32_t)(stringList.size() - 1);
+		}
+
+		template<typename E>
+		void block(BlockType type, uint32_t object, const E* data, size_t count) {
+			Block b;
+			b.entry.type = (uint32_t)type;
+			b.entry.object = object;
+			b.entry.bytes = count * sizeof(E);
+			b.data = data;
+			blocks.push_back(b);
+		}
+
+		// Block of data built for the file, kept alive until it is written
+		template<typename E>
+		void ownedBlock(BlockType type, uint32_t object, const std::vector<E>& data) {
+			auto bytes = std::make_shared<std::vector<unsigned char>>(data.size() * sizeof(E));
+			if (!data.empty()) {
+				std::memcpy(bytes->data(), data.data(), bytes->size());
+			}
+			ownedData.push_back(bytes);
+			block(type, object, bytes->data(), bytes->size());
+		}
+
+		bool write(const std::string& path) {
+			uint32_t objectCount = 0;
+			offset = align(sizeof(Header) + blocks.size() * sizeof(BlockEntry));
+			for (Block& b : blocks) {
+				b.entry.offset = offset;
+				offset = align(offset + b.entry.bytes);
+				if (!isSceneBlock((BlockType)b.entry.type)) {
+					objectCount = std::max(objectCount, b.entry.object + 1);
+				}
+				else if ((BlockType)b.entry.type == BlockType::Objects) {
+					objectCount = std::max(objectCount, (uint32_t)(b.entry.bytes / sizeof(ObjectRecord)));
+				}
+			}
+
+			Header header = {};
+			std::memcpy(header.magic, "TNSC", 4);
+			header.version = formatVersion;
+			header.realSize = sizeof(Real);
+			header.blockCount = (uint32_t)blocks.size();
+			header.fileSize = offset;
+			header.objectCount = objectCount;
+			header.wideWidth = BVH_WIDTH;
+
+			// Written under a temporary name of its own first so a job reading the file never sees a partial one and
+			// conversions to the same file don't write into one
+			std::string tmpPath = uniqueTempPath(path);
+			bool ok;
+			{
+				std::ofstream ofs(tmpPath, std::ios::binary);
+				if (!ofs) {
+					return false;
+				}
+				ofs.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+				for (const Block& b : blocks) {
+					ofs.write(reinterpret_cast<const char*>(&b.entry), sizeof(BlockEntry));
+				}
+				uint64_t written = sizeof(Header) + blocks.size() * sizeof(BlockEntry);
+				const char padding[blockAlignment] = {};
+				for (const Block& b : blocks) {
+					ofs.write(padding, (std::streamsize)(b.entry.offset - written));
+					ofs.write(reinterpret_cast<const char*>(b.data), (std::streamsize)b.entry.bytes);
+					written = b.entry.offset + b.entry.bytes;
+				}
+				ofs.write(padding, (std::streamsize)(offset - written));
+				ok = (bool)ofs;
+			}
+			std::error_code ec;
+			if (ok) {
+				std::filesystem::rename(tmpPath, path, ec);
+			}
+			if (!ok || ec) {
+				std::filesystem::remove(tmpPath, ec);
+				return false;
+			}
+			return true;
+		}
+
+		static uint64_t align(uint64_t value) {
+			return (value + blockAlignment - 1) / blockAlignment * blockAlignment;
+		}
+	};
+
+	// Coordinates beyond this overflow the bounding box math of the BVH builders
+	static constexpr double maxCoordinate = 1e30;
+
+	// False for NaN, infinite and huge coordinates, which a corrupt file could hold
+	static bool isFinite(const Vec3& v) {
+		return std::abs(v.x) <= maxCoordinate && std::abs(v.y) <= maxCoordinate && std::abs(v.z) <= maxCoordinate;
+	}
+
+	// True if the stored root box holds the mesh, which the top level relies on
+	static bool contains(const AABB& box, const AABB& inner) {
+		return isFinite(box.min) && isFinite(box.max) && box.min.x <= inner.min.x && box.min.y <= inner.min.y &&
+			box.min.z <= inner.min.z && box.max.x >= inner.max.x && box.max.y >= inner.max.y && box.max.z >= inner.max.z;
+	}
+
+	bool fail(const std::string& message) {
+		error = message;
+		return false;
+	}
+
+	// Copy of a small block of records, empty if the block is missing or its size doesn't fit the record
+	template<typename E>
+	static std::vector<E> records(const MappedFile& file, const BlockEntry* block) {
+		std::vector<E> result;
+		if (block && block->bytes > 0 && block->bytes % sizeof(E) == 0) {
+			result.resize(block->bytes / sizeof(E));
+			std::memcpy((void*)result.data(), file.data() + block->offset, block->bytes);
+		}
+		return result;
+	}
+
+	// Buffer viewing a block, a missing block is empty. Fails if the block isn't a whole number of elements
+	template<typename E>
+	static bool viewBuffer(const MappedFile& file, const std::shared_ptr<const void>& owner, const BlockEntry* block, MeshBuffer<E>& buffer) {
+		if (!block || block->bytes == 0) {
+			buffer.clear();
+			return true;
+		}
+		if (block->bytes % sizeof(E) != 0) {
+			return false;
+		}
+		buffer = MeshBuffer<E>::view((const E*)(file.data() + block->offset), block->bytes / sizeof(E), owner);
+		return true;
+	}
+
+	// Vec3 block, viewed if it was written with this build's Real type and converted otherwise
+	static bool vec3Buffer(const MappedFile& file, const std::shared_ptr<const void>& owner, const BlockEntry* block,
+		uint32_t realSize, MeshBuffer<Vec3>& buffer) {
+		if (realSize == sizeof(Real)) {
+			return viewBuffer(file, owner, block, buffer);
+		}
+		buffer.clear();
+		if (!block) {
+			return true;
+		}
+		if (block->bytes % (3 * realSize) != 0) {
+			return false;
+		}
+		size_t count = block->bytes / (3 * realSize);
+		buffer.resize(count);
+		const unsigned char* data = file.data() + block->offset;
+		for (size_t i = 0; i < count; ++i) {
+			if (realSize == sizeof(float)) {
+				float v[3];
+				std::memcpy(v, data + i * sizeof(v), sizeof(v));
+				buffer[i] = Vec3((Real)v[0], (Real)v[1], (Real)v[2]);
+			}
+			else {
+				double v[3];
+				std::memcpy(v, data + i * sizeof(v), sizeof(v));
+				buffer[i] = Vec3((Real)v[0], (Real)v[1], (Real)v[2]);
+			}
+		}
+		return true;
+	}
+};
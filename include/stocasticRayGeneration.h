@@ -2,6 +2,7 @@
 
 #include "vec3.h"
 #include "ray.h"
+#include "vec3Simd.h"
 
 #include <random>
 #include <cmath>
@@ -17,9 +18,8 @@ public:
     StocasticRayGeneration(const Vec3& o, int n, const Vec3& forward) {
         origin = o;
 
-        // RNG: use a local generator
-        std::random_device rd;
-        std::mt19937 gen(rd());
+        // RNG: per-thread generator, seeding one per sampler costed more than the sampling itself
+        static thread_local std::mt19937 gen(std::random_device{}());
         std::uniform_real_distribution<> dis(0.0, 1.0);
 
         // Gaussian parameters for importance sampling
@@ -27,12 +27,12 @@ public:
         double stddev = 0.4;
 
         // Build orthonormal basis for random sampling on local hemisphere
-        Vec3 w = forward.normalize();
+        ShadeVec3 w = ShadeVec3(forward).normalize();
 
         // Smaller than 0.999 to avoid numerical instability when forward is (0,1,0)
-        Vec3 up = (std::abs(w.y) < 0.999) ? Vec3(0.0, 1.0, 0.0) : Vec3(1.0, 0.0, 0.0);
-        Vec3 u = up.crossProduct(w).normalize(); // tangent
-        Vec3 v = w.crossProduct(u).normalize();  // bitangent
+        ShadeVec3 up = (std::abs(w.y) < 0.999) ? ShadeVec3(0.0, 1.0, 0.0) : ShadeVec3(1.0, 0.0, 0.0);
+        ShadeVec3 u = up.crossProduct(w).normalize(); // tangent
+        ShadeVec3 v = w.crossProduct(u).normalize();  // bitangent
 
         // Stratify with sqrt(n) --> TODO: test other strata
         int sqrtN = static_cast<int>(std::sqrt(n));
@@ -68,8 +68,8 @@ public:
                 double lz = std::cos(theta); // sqrt(1-u1)
 
                 // Convert to world space direction from local spherical
-                Vec3 worldDir = (u * lx + v * ly + w * lz).normalize();
-                rays.emplace_back(origin, worldDir);
+                ShadeVec3 worldDir = (u * lx + v * ly + w * lz).normalize();
+                rays.emplace_back(origin, Vec3(worldDir));
 
                 // Break if n samples is reached
                 if ((int)rays.size() >= n) {
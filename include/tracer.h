@@ -3,15 +3,24 @@
 #include"roomClass.h"
 #include "vec3.h"
 #include "ray.h"
+#include "stocasticRayGeneration.h"
+#include "vec3Simd.h"
 #include <random>
 
+/// How surfaces that aren't mirrors or glass spheres are shaded
+enum class ShadingMethod {
+	Flat,
+	Lambertian,
+	MC
+};
+
 class Tracer {
 public:
-	Tracer() : tClosest(0.0), normal(Vec3(0.0, 0.0, 0.0)), bestNormal(Vec3(0.0, 0.0, 0.0)),
-		bestColor(Vec3(0.0, 0.0, 0.0)), hitPoint(Vec3(0.0, 0.0, 0.0)), hitType(""), hitMaterial("") {
+	Tracer() : tClosest(0.0), hitSphere(false), normal(Vec3(0.0, 0.0, 0.0)), bestNormal(Vec3(0.0, 0.0, 0.0)),
+		bestColor(Vec3(0.0, 0.0, 0.0)), hitPoint(Vec3(0.0, 0.0, 0.0)) {
 	}
 
-	bool trace(const Ray& ray, const Scene& scene, Vec3& hitColor, int depth, const int& maxDepth, const std::string& shadingMethod) {
+	bool trace(const Ray& ray, const Scene& scene, Vec3& hitColor, int depth, const int& maxDepth, ShadingMethod shadingMethod) {
 		// Ray includes ray origin and direction.
 		// Scene includes all objects (speheres, planes, cubes, tetrahedrons),
 		// light position, light color, light intensity, ambient color, and background color.
@@ -27,33 +36,18 @@ public:
 		bool hit = false;
 		tClosest = std::numeric_limits<double>::infinity();
 
-		// Check intersection for all triangle-based objects
-		for (const auto& obj : scene.objs) {
-			double t; Vec3 n, c;
-			if (obj->intersect(ray, t, n, c) && t < tClosest) {
-				tClosest = t;
-				bestNormal = n;
-				bestColor = c;
-				hitPoint = ray.origin + ray.direction * tClosest;
-				hitType = "TRIANGLE";
-				hitMaterial = obj->getMat();
-				hit = true;
-			}
-		}
-
-		// Check intersection for all spheres 
-		for (const auto& sphere : scene.spheres) {
-			double tsphere = sphere->RaySphereIntersection(ray);
-
-			if (tsphere > 0.0 && tsphere < tClosest) {
-				tClosest = tsphere;
-				hitPoint = ray.origin + ray.direction * tsphere;
-				bestNormal = (hitPoint - sphere->centerPoint).normalize();
-				bestColor = sphere->color;
-				hitType = "SPHERE";
-				hitMaterial = sphere->material;
-				hit = true;
-			}
+		// Closest intersection among all triangle objects and spheres through the scene BVH, the shading attributes
+		// are only fetched for this final hit
+		SceneHit sceneHit;
+		if (scene.intersect(ray, sceneHit)) {
+			SurfaceHit surf = scene.surface(ray, sceneHit);
+			tClosest = sceneHit.t;
+			bestNormal = surf.normal;
+			hitMaterial = &Materials::get(surf.material);
+			bestColor = surf.color * hitMaterial->albedo;
+			hitPoint = surf.point;
+			hitSphere = sceneHit.isSphere;
+			hit = true;
 		}
 
 		// If nothing in the scene was hit
@@ -62,25 +56,30 @@ public:
 			return false;
 		}
 
-		// Sphere perfect mirror material
-		if (hitType == "SPHERE" && hitMaterial == "MIRROR") {
+		switch (hitMaterial->type) {
+
+		// Perfect mirror, spheres and triangle objects alike
+		case MaterialType::Mirror: {
 			Vec3 reflectDir = (ray.direction - (bestNormal * 2 * ray.direction.dotProduct(bestNormal))).normalize();
 			Vec3 reflectOrigin = hitPoint + (reflectDir * 1e-4);
 			Ray reflectRay = Ray(reflectOrigin, reflectDir);
 			return trace(reflectRay, scene, hitColor, (++depth), maxDepth, shadingMethod);
 		}
 
-		// Sphere Fresnel reflection + refraction (only for transparent materials)
-		if (hitType == "SPHERE" && hitMaterial == "GLASS") {
+		// Sphere Fresnel reflection + refraction, transparent triangle objects are shaded like diffuse ones
+		case MaterialType::Glass: {
+			if (!hitSphere) {
+				break;
+			}
 
-			// Refraction index for glass is [1.5,1.9]
-			double refrIdx = 1.5;
+			// Refraction index of the material, for glass it is [1.5,1.9]
+			double refrIdx = hitMaterial->ior;
 
 			// Intitalize normal n and eta ratio (refrIdx1 / refrIdx2 for snell's law)
 			bool frontFace = ray.direction.dotProduct(bestNormal) < 0.0;
 			Vec3 n = frontFace ? bestNormal : bestNormal * -1.0;
 			double etaRatio = frontFace ? (1.0 / refrIdx) : (refrIdx / 1.0);
-			double cosTheta = std::max(0.0, std::min(1.0, -ray.direction.dotProduct(n)));
+			double cosTheta = std::max(0.0, std::min<double>(1.0, -ray.direction.dotProduct(n)));
 
 			// Schlick refelectance to get the reflection coefficent 
 			double R = schlickReflectance(cosTheta, refrIdx);
@@ -124,23 +123,21 @@ public:
 			return true;
 		}
 
-
-		// Mirror reflection with triangle object
-		if (hitType == "TRIANGLE" && hitMaterial == "MIRROR" ) {
-			Vec3 reflectDir = (ray.direction - (bestNormal * 2 * ray.direction.dotProduct(bestNormal))).normalize();
-			Vec3 reflectOrigin = hitPoint + (reflectDir * 1e-4);
-			Ray reflectRay = Ray(reflectOrigin, reflectDir);
-			return trace(reflectRay, scene, hitColor, (++depth), maxDepth, shadingMethod);
+		case MaterialType::Diffuse:
+		case MaterialType::Emissive:
+			break;
 		}
 
+		switch (shadingMethod) {
+
 		/// Flat shading
-		if (shadingMethod == "FLAT") {
+		case ShadingMethod::Flat: {
 			hitColor = bestColor;
 			return true;
 		}
 
 		/// Lambertian shading
-		if (shadingMethod == "LAMBERTIAN") {
+		case ShadingMethod::Lambertian: {
 			if (shadowTest(scene)) {
 				hitColor = (bestColor * scene.ambient);
 				return true;
@@ -150,7 +147,7 @@ public:
 				Vec3 lightDir = lightVec.normalize();
 
 				// Lambertian relection factor
-				double diff = std::max(0.0, bestNormal.dotProduct(lightDir));
+				double diff = std::max<double>(0.0, bestNormal.dotProduct(lightDir));
 
 				// Compute squared distance from light source to intersection surface point - squared distance since light
 				// intesnity decreases by squared distance
@@ -167,13 +164,14 @@ public:
 
 
 		/// MC Tracing 
-		if (shadingMethod == "MC") {
+		case ShadingMethod::MC: {
 
-			// Color of the surface, used when multiplying incoming light
-			Vec3 albedo = bestColor;
+			// Color of the surface, used when multiplying incoming light. The per-sample light combination runs in the
+			// SIMD vector type and converts back to Vec3 at the recursion
+			ShadeVec3 albedo(bestColor);
 
-			// For importance sampling of direct light, we do one direct shadow ray test
-			Vec3 directLighting(0.0);
+			// Direct light of the sampled light points, recomputed for every child ray
+			ShadeVec3 directLighting(0.0);
 
 			// Indirect lighting uses hemisphere cosine-weighted sample --> this has to be same as maxDepth in
 			// Renderer.h --> TODO: Fix this so we only have to change in one place, should only be to set this to max depth
@@ -182,85 +180,49 @@ public:
 			// Sample new ray direction using CDF hemisphere sampling, only 1 child ray per surface interaction
 			StocasticRayGeneration sampler(hitPoint + bestNormal * 1e-4, 1, bestNormal);
 
-			Vec3 totalColor(0.0);
+			ShadeVec3 totalColor(0.0);
 
 			// Check all the rays from sampler
 			for (size_t i = 0; i < sampler.rays.size(); ++i) {
 
-				// Check if new ray, intersects the area light source
-				bool directLightHit = false;
-				for (const auto& obj : scene.objs) {
-					double t; Vec3 n, c;
-					if (obj->getMat() == "EMISSIVE" && obj->intersect(sampler.rays[i], t, n, c)) {
-						directLightHit = true;
-						break;
+				// Direct light, one point sampled uniformly over the emissive faces of every light source. Every point
+				// of a light carries its share of the light intensity and emits with a cosine falloff, so a small or
+				// distant light is lit like the point light of the Lambertian shading
+				directLighting = ShadeVec3(0.0);
+				for (const auto& light : scene.lightSources) {
+					if (light->surfaceArea() <= 0.0) {
+						continue;
 					}
-				}
-
-				if (directLightHit) {
-
-					double tLight = std::numeric_limits<double>::infinity();
-
-					for (const auto& obj : scene.objs) {
-						double t2; Vec3 n2, c2;
-						if (obj->getMat() == "EMISSIVE" && obj->intersect(sampler.rays[i], t2, n2, c2)) {
-							// take the nearest emissive intersection if multiple (defensive)
-							if (t2 > 0.0 && t2 < tLight) tLight = t2;
-						}
+					static thread_local std::mt19937 lightGen(std::random_device{}());
+					std::uniform_real_distribution<double> unif(0.0, 1.0);
+					int lightPrim;
+					Vec3 lightPoint = light->sampleSurface(unif(lightGen), unif(lightGen), unif(lightGen), lightPrim);
+
+					// Shadow ray towards the sampled point, small offset to avoid self-intersection
+					Vec3 shadowOrigin = hitPoint + bestNormal * 1e-4;
+					Vec3 toLight = lightPoint - shadowOrigin;
+					double dist2 = toLight.dotProduct(toLight);
+					double dist = std::sqrt(dist2);
+					Vec3 toLightDir = toLight / dist;
+
+					// Lambertian term at the surface and the cosine falloff of the emitter, lights emit from both sides
+					double NdotL = bestNormal.dotProduct(toLightDir);
+					double cosLight = std::abs(light->normal(lightPrim).dotProduct(toLightDir));
+					if (NdotL <= 0.0 || cosLight <= 0.0) {
+						continue;
 					}
 
-					// Sample the light directly, treating light as a point
-					if (tLight == std::numeric_limits<double>::infinity()) {
-						directLighting = bestColor * scene.ambient;
-					}
-					else {
-						// Direction toward the light is the sampled ray's direction (already)
-						Vec3 toLightDir = sampler.rays[i].direction.normalize();
-
-						// Squared distance to emitter
-						double dist2 = tLight * tLight;
-
-						// Shadow ray to check visibility, small offset to avoid self-intersection
-						Ray shadowRay(hitPoint + bestNormal * 1e-4, toLightDir);
-
-						// Iterate all objects in the scene and test for occlusion
-						bool occluded = false;
-
-						for (const auto& obj : scene.objs) {
-							// Transparent materials don't occlude
-							if (obj->isTransparent()) continue;
-							double t3; Vec3 n3, c3;
-							if (obj->intersect(shadowRay, t3, n3, c3) && t3 > 1e-6 && t3 < tLight) {
-								occluded = true;
-								break;
-							}
-						}
-
-						if (!occluded) {
-							for (const auto& s : scene.spheres) {
-								if (s->isTransparent()) continue;
-								double ts = s->RaySphereIntersection(shadowRay);
-								if (ts > 1e-6 && ts < tLight) {
-									occluded = true;
-									break;
-								}
-							}
-						}
-
-						if (occluded) {
-							directLighting = bestColor * scene.ambient;
-						}
-						else {
-							// Lambertian term using NdotL and light intensity / squared distance
-							double NdotL = std::max(0.0, bestNormal.dotProduct(toLightDir));
-
-							// Incident irradiance from point light - intensity decreases with squared distance
-							Vec3 irradiance = scene.lightColor * (scene.lightIntensity / dist2);
-
-							// Get the direct light contribution
-							directLighting = albedo * irradiance * NdotL;
-						}
+					// Test for occlusion by any opaque object or sphere in front of the sampled point, the light itself
+					// lies just past the end of the ray
+					if (scene.occluded(Ray(shadowOrigin, toLightDir), dist - 1e-4)) {
+						continue;
 					}
+
+					// Incident irradiance, intensity decreases with squared distance and is scaled by the emission of
+					// the light's material
+					Vec3 emission = Materials::get(light->getMat(lightPrim)).emission;
+					ShadeVec3 irradiance = ShadeVec3(scene.lightColor * emission) * (scene.lightIntensity * cosLight / dist2);
+					directLighting += albedo * irradiance * NdotL;
 				}
 
 				// Intitialize incoming color
@@ -292,14 +254,14 @@ public:
 
 					// Ray termination = setting hit color to direct light only
 					if (urnif(rrGen) >= survivalProb) {
-						hitColor = directLighting;
+						hitColor = Vec3(directLighting);
 						totalColor += directLighting;
 						continue; 
 					}
 				}
 
 				// For cosine-weighted sampling, cos/pdf cancels -> contribution = albedo * incoming
-				Vec3 indirectLighting = albedo * incoming;
+				ShadeVec3 indirectLighting = albedo * ShadeVec3(incoming);
 				if (depth >= (rrDepth - 1) && survivalProb > 0.0)
 					indirectLighting = indirectLighting / survivalProb;
 
@@ -307,9 +269,10 @@ public:
 				// Combine direcr and indirect light contributions
 				totalColor += directLighting + indirectLighting;
 			}
-			hitColor = totalColor / double(sampler.rays.size());
+			hitColor = Vec3(totalColor / double(sampler.rays.size()));
 			return true;
 		}
+		}
 		hitColor = scene.backgroundColor;
 		return false;
 	}
@@ -323,29 +286,8 @@ public:
 		// Get the euclidean distance from the light source and the hit point 
 		double lightDist = sRay.origin.euclDist(scene.lightPos);
 
-		for (const auto& sphere : scene.spheres) {
-			// Transparent materials don't occlude
-			if (sphere->isTransparent()) continue;
-
-			// Check shadow ray intersection with spheres
-			double tsphere = sphere->RaySphereIntersection(sRay);
-			if (tsphere > 0.0 && tsphere < lightDist) {
-				return true;
-			}
-		}
-
-		for (const auto& obj : scene.objs) {
-			// Transparent materials don't occlude
-			if (obj->isTransparent()) continue;
-			double t; Vec3 n, c;
-			// Check shadow ray intersection with triangles
-			if (obj->intersect(sRay, t, n, c) && t < lightDist) {
-				return true;
-			}
-		}
-
-		// No occlusion found
-		return false;
+		// Any opaque object or sphere between the hit point and the light, transparent materials don't occlude
+		return scene.occluded(sRay, lightDist);
 	}
 
 	// Schlick's approximation for Fresnel reflectance
@@ -374,7 +316,8 @@ public:
 
 private:
 	double tClosest;
-	std::string hitMaterial;
-	std::string hitType;
+	// Material of the current hit, an entry of the material table
+	const Material* hitMaterial = nullptr;
+	bool hitSphere;
 	Vec3 normal, color, bestNormal, bestColor, hitPoint;
 };
\ No newline at end of file
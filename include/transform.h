@@ -0,0 +1,93 @@
+#pragma once
+
+#include "vec3.h"
+#include "aabb.h"
+
+#include <cmath>
+
+/// Affine transform, a 3x3 linear part in rows plus a translation. Points get the translation, directions only the
+/// linear part. Used to place shared meshes in the scene, see Instance
+template<typename T>
+class TransformT {
+public:
+	// Rows of the linear part and the translation column
+	Vec3T<T> row0 = Vec3T<T>(1, 0, 0), row1 = Vec3T<T>(0, 1, 0), row2 = Vec3T<T>(0, 0, 1);
+	Vec3T<T> offset = Vec3T<T>(0, 0, 0);
+
+	// Constructor creates the identity
+	TransformT() {}
+	TransformT(const Vec3T<T>& r0, const Vec3T<T>& r1, const Vec3T<T>& r2, const Vec3T<T>& t) : row0(r0), row1(r1), row2(r2), offset(t) {}
+
+	static TransformT translation(const Vec3T<T>& t) {
+		return TransformT(Vec3T<T>(1, 0, 0), Vec3T<T>(0, 1, 0), Vec3T<T>(0, 0, 1), t);
+	}
+
+	static TransformT scaling(const Vec3T<T>& s) {
+		return TransformT(Vec3T<T>(s.x, 0, 0), Vec3T<T>(0, s.y, 0), Vec3T<T>(0, 0, s.z), Vec3T<T>(0, 0, 0));
+	}
+
+	// Rotation by angle radians around axis, counter-clockwise looking down the axis
+	static TransformT rotation(const Vec3T<T>& axis, T angle) {
+		Vec3T<T> a = axis.normalize();
+		T c = std::cos(angle), s = std::sin(angle), k = 1 - c;
+		return TransformT(
+			Vec3T<T>(c + a.x * a.x * k, a.x * a.y * k - a.z * s, a.x * a.z * k + a.y * s),
+			Vec3T<T>(a.y * a.x * k + a.z * s, c + a.y * a.y * k, a.y * a.z * k - a.x * s),
+			Vec3T<T>(a.z * a.x * k - a.y * s, a.z * a.y * k + a.x * s, c + a.z * a.z * k),
+			Vec3T<T>(0, 0, 0));
+	}
+
+	// Composition, (a * b) applies b first and then a
+	TransformT operator*(const TransformT& b) const {
+		Vec3T<T> col0(b.row0.x, b.row1.x, b.row2.x), col1(b.row0.y, b.row1.y, b.row2.y), col2(b.row0.z, b.row1.z, b.row2.z);
+		auto mulRow = [&](const Vec3T<T>& r) {
+			return Vec3T<T>(r.dotProduct(col0), r.dotProduct(col1), r.dotProduct(col2));
+		};
+		return TransformT(mulRow(row0), mulRow(row1), mulRow(row2), applyPoint(b.offset));
+	}
+
+	Vec3T<T> applyPoint(const Vec3T<T>& p) const {
+		return applyVector(p) + offset;
+	}
+
+	Vec3T<T> applyVector(const Vec3T<T>& v) const {
+		return Vec3T<T>(row0.dotProduct(v), row1.dotProduct(v), row2.dotProduct(v));
+	}
+
+	// Multiplies by the transposed linear part. Normals go to the other space with the transpose of the inverse, so
+	// the inverse transform moves them back with this
+	Vec3T<T> applyTransposed(const Vec3T<T>& v) const {
+		return row0 * v.x + row1 * v.y + row2 * v.z;
+	}
+
+	// Box around the transformed corners of a box
+	AABB applyBounds(const AABB& box) const {
+		AABB result;
+		if (box.isEmpty()) {
+			return result;
+		}
+		for (int corner = 0; corner < 8; ++corner) {
+			Vec3 p((corner & 1) ? box.max.x : box.min.x, (corner & 2) ? box.max.y : box.min.y, (corner & 4) ? box.max.z : box.min.z);
+			result.expand(Vec3(applyPoint(Vec3T<T>(p))));
+		}
+		return result;
+	}
+
+	T determinant() const {
+		return row0.dotProduct(row1.crossProduct(row2));
+	}
+
+	// Inverse through the adjugate of the linear part, the transform must not be singular
+	TransformT inverse() const {
+		// Columns of the inverse are the cross products of the rows divided by the determinant, so its rows are
+		// the components of those
+		Vec3T<T> c0 = row1.crossProduct(row2), c1 = row2.crossProduct(row0), c2 = row0.crossProduct(row1);
+		T invDet = 1 / determinant();
+		TransformT inv(Vec3T<T>(c0.x, c1.x, c2.x) * invDet, Vec3T<T>(c0.y, c1.y, c2.y) * invDet,
+			Vec3T<T>(c0.z, c1.z, c2.z) * invDet, Vec3T<T>(0, 0, 0));
+		inv.offset = inv.applyVector(offset) * (T)-1;
+		return inv;
+	}
+};
+
+using Transform = TransformT<Real>;
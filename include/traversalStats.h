@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+/// Counters for the work done by the ray queries, to find out where the time goes in a slow scene. Each thread counts
+/// into its own instance so no atomics are needed, the renderer reads them per pixel. The counters are only updated
+/// when compiled with TRAVERSAL_STATS, otherwise TRAVERSAL_STAT() expands to nothing and the queries cost the same
+/// as without statistics
+struct TraversalStats {
+	uint64_t rays = 0;			// Closest hit queries through the scene
+	uint64_t shadowRays = 0;	// Occlusion queries through the scene
+	uint64_t nodes = 0;			// BVH nodes and grid cells visited, top and bottom level
+	uint64_t triangleTests = 0;
+	uint64_t sphereTests = 0;
+
+	TraversalStats& operator+=(const TraversalStats& other) {
+		rays += other.rays;
+		shadowRays += other.shadowRays;
+		nodes += other.nodes;
+		triangleTests += other.triangleTests;
+		sphereTests += other.sphereTests;
+		return *this;
+	}
+
+	TraversalStats operator-(const TraversalStats& other) const {
+		TraversalStats diff;
+		diff.rays = rays - other.rays;
+		diff.shadowRays = shadowRays - other.shadowRays;
+		diff.nodes = nodes - other.nodes;
+		diff.triangleTests = triangleTests - other.triangleTests;
+		diff.sphereTests = sphereTests - other.sphereTests;
+		return diff;
+	}
+
+	// Total traversal work, nodes visited plus primitives tested
+	uint64_t cost() const {
+		return nodes + triangleTests + sphereTests;
+	}
+
+	// Counters of the calling thread
+	static TraversalStats& local() {
+		static thread_local TraversalStats stats;
+		return stats;
+	}
+};
+
+#ifdef TRAVERSAL_STATS
+#define TRAVERSAL_STAT(counter) (++TraversalStats::local().counter)
+#define TRAVERSAL_STAT_ADD(counter, n) (TraversalStats::local().counter += (uint64_t)(n))
+#else
+#define TRAVERSAL_STAT(counter) ((void)0)
+#define TRAVERSAL_STAT_ADD(counter, n) ((void)0)
+#endif
@@ -1,49 +1,63 @@
 #pragma once
 
 #include "vec3.h"
+#include "aabb.h"
+#include "traversalStats.h"
 #include <iostream>
 
 
 /// Triangle class, the basis for all scene geoemtry 
-class Triangle {
+template<typename T>
+class TriangleT {
 public:
-	Vec3 v0, v1, v2;
-	Vec3 color;
-	Vec3 edge0, edge1;
-	Vec3 normal;
+	Vec3T<T> v0, v1, v2;
+	Vec3T<T> color;
+	Vec3T<T> edge0, edge1;
+	Vec3T<T> normal;
 
 	// Constructor 
-	Triangle(const Vec3& a, const Vec3& b, const Vec3& c, const Vec3& col) : v0(a), v1(b), v2(c), color(col) {
+	TriangleT(const Vec3T<T>& a, const Vec3T<T>& b, const Vec3T<T>& c, const Vec3T<T>& col) : v0(a), v1(b), v2(c), color(col) {
+		edge0 = v1 - v0;
+		edge1 = v2 - v0;
+		normal = computeTriangeNormal();
+	}
+
+	// Move the vertices, the edges and normal are recomputed
+	void setVertices(const Vec3T<T>& a, const Vec3T<T>& b, const Vec3T<T>& c) {
+		v0 = a;
+		v1 = b;
+		v2 = c;
 		edge0 = v1 - v0;
 		edge1 = v2 - v0;
 		normal = computeTriangeNormal();
 	}
 
 	/// Moller-Trumbore ray-triangle intersection algorithm --> object class uses this function, hence static
-	static double RayTriangleIntersect(const Vec3& rayOrigin, const Vec3& rayDir, const Triangle& tri) {
-		const double EPSILON = 1e-8;
+	static T RayTriangleIntersect(const Vec3T<T>& rayOrigin, const Vec3T<T>& rayDir, const TriangleT& tri) {
+		TRAVERSAL_STAT(triangleTests);
+		const T EPSILON = (T)1e-8;
 
 		// Check if triangle normal and ray direction are anti-parallel
-		double dotTest = tri.normal.dotProduct(rayDir);
+		T dotTest = tri.normal.dotProduct(rayDir);
 		if (dotTest > -EPSILON) {
 			return -1.0; // ray is parallel or points away from  triangle
 		}
 
 		// Geometric Moller-Trumbore
-		Vec3 R1 = rayDir.crossProduct(tri.edge1);
-		double Cs = tri.edge0.dotProduct(R1);
+		Vec3T<T> R1 = rayDir.crossProduct(tri.edge1);
+		T Cs = tri.edge0.dotProduct(R1);
 
 		//if (fabs(Cs) < EPSILON) {
 		//	return -1.0; // ray is parallel to triangle
 		//} --> vet ej om vi beehver tv test p ray-triagle parallellitet...?
 
-		Vec3 C3 = rayOrigin - tri.v0;
-		Vec3 R2 = C3.crossProduct(tri.edge0);
+		Vec3T<T> C3 = rayOrigin - tri.v0;
+		Vec3T<T> R2 = C3.crossProduct(tri.edge0);
 
 		// Compute the solution of the intersection equation 
-		double t = tri.edge1.dotProduct(R2) / Cs;
-		double u = C3.dotProduct(R1) / Cs;
-		double v = rayDir.dotProduct(R2) / Cs;
+		T t = tri.edge1.dotProduct(R2) / Cs;
+		T u = C3.dotProduct(R1) / Cs;
+		T v = rayDir.dotProduct(R2) / Cs;
 
 		if (t > EPSILON && u >= 0.0 && v >= 0.0 && (u + v) <= 1.0) {
 			return t; // valid intersection
@@ -52,16 +66,59 @@ public:
 		return -1.0;
 	}
 
+	// Bounding box of the three vertices, used when building the BVH
+	AABB bounds() const {
+		AABB box;
+		box.expand(Vec3(v0));
+		box.expand(Vec3(v1));
+		box.expand(Vec3(v2));
+		return box;
+	}
+
+	// Bounds of the parts of the triangle on each side of the plane at pos along axis, used by spatial BVH splits
+	void splitBounds(int axis, double pos, AABB& left, AABB& right) const {
+		const Vec3 verts[3] = { Vec3(v0), Vec3(v1), Vec3(v2) };
+		splitBounds(verts, axis, pos, left, right);
+	}
+
+	// Same for a triangle given by its vertices, used by meshes that don't store Triangles
+	static void splitBounds(const Vec3 verts[3], int axis, double pos, AABB& left, AABB& right) {
+		splitBounds(verts, 3, axis, pos, left, right);
+	}
+
+	// Same for a convex polygon given by its corners in order, such as a parallelogram face
+	static void splitBounds(const Vec3* verts, int numVerts, int axis, double pos, AABB& left, AABB& right) {
+		left = AABB();
+		right = AABB();
+
+		for (int i = 0; i < numVerts; ++i) {
+			const Vec3& a = verts[i];
+			const Vec3& b = verts[(i + 1) % numVerts];
+			double va = axisValue(a, axis);
+			double vb = axisValue(b, axis);
+
+			if (va <= pos) left.expand(a);
+			if (va >= pos) right.expand(a);
+
+			// The edge crosses the plane, the crossing point belongs to both sides
+			if ((va < pos && vb > pos) || (va > pos && vb < pos)) {
+				Vec3 p = a + (b - a) * ((pos - va) / (vb - va));
+				left.expand(p);
+				right.expand(p);
+			}
+		}
+	}
+
 private:
 	// Compute normalized triangle normal 
-	Vec3 computeTriangeNormal() const {
-		Vec3 n = edge0.crossProduct(edge1).normalize();
+	Vec3T<T> computeTriangeNormal() const {
+		Vec3T<T> n = edge0.crossProduct(edge1).normalize();
 
 		// Ensure normals point inwards to the room 
-		Vec3 roomCenter(2.0, 2.0, 2.0);
-		Vec3 triangleCentroid = (v0 + v1 + v2) / 3.0;
+		Vec3T<T> roomCenter(2.0, 2.0, 2.0);
+		Vec3T<T> triangleCentroid = (v0 + v1 + v2) / 3.0;
 
-		Vec3 dirToCenter = (roomCenter - triangleCentroid).normalize();
+		Vec3T<T> dirToCenter = (roomCenter - triangleCentroid).normalize();
 
 		// Flip normal if it points outwards 
 		/*
@@ -79,4 +136,6 @@ private:
 			<< v2.x << "," << v2.y << "," << v2.z << "\n";
 		std::cout << std::endl << "Triangle normal: " << normal.x << "," << normal.y << "," << normal.z << "\n";
 	}
-};
\ No newline at end of file
+};
+
+using Triangle = TriangleT<Real>;
@@ -1,74 +1,93 @@
 #pragma once
 
+#include <cmath>
+
+// Scalar type of the scene geometry, rays and shading. Compiling with RENDER_FLOAT renders in single precision, which
+// halves the memory traffic of the geometry; pixel accumulation stays in double either way
+#ifdef RENDER_FLOAT
+using Real = float;
+#else
+using Real = double;
+#endif
+
 /// Utility data structure to define 3D points and effectively 3D vectors
-struct Vec3 {
+template<typename T>
+struct Vec3T {
 
-	double x, y, z;
+	T x, y, z;
 
-	// Constructor 
-	Vec3(double xx = 0, double yy = 0, double zz = 0) : x(xx), y(yy), z(zz) {}
+	// Constructor
+	Vec3T(T xx = 0, T yy = 0, T zz = 0) : x(xx), y(yy), z(zz) {}
+
+	// Conversion between precisions
+	template<typename U>
+	explicit Vec3T(const Vec3T<U>& v) : x((T)v.x), y((T)v.y), z((T)v.z) {}
 
 	// Computational operators
-	Vec3 operator+ (const Vec3& v) const {
-		return Vec3(x + v.x, y + v.y, z + v.z);
+	Vec3T operator+ (const Vec3T& v) const {
+		return Vec3T(x + v.x, y + v.y, z + v.z);
 	}
 
-	Vec3 operator- (const Vec3& v) const {
-		return Vec3(x - v.x, y - v.y, z - v.z);
+	Vec3T operator- (const Vec3T& v) const {
+		return Vec3T(x - v.x, y - v.y, z - v.z);
 	}
 
-	// Overloaded multiplication - vector and scalar 
-	Vec3 operator* (double d) const {
-		return Vec3(x * d, y * d, z * d);
+	// Overloaded multiplication - vector and scalar
+	Vec3T operator* (T d) const {
+		return Vec3T(x * d, y * d, z * d);
 	}
 
 	// Overloaded multiplication - vector with vector
-	Vec3 operator* (const Vec3& v)  const {
-		return Vec3(x * v.x, y * v.y, z * v.z);
+	Vec3T operator* (const Vec3T& v)  const {
+		return Vec3T(x * v.x, y * v.y, z * v.z);
 	}
 
 	// Division operator (only for normalization)
-	Vec3 operator/ (double d) const {
-		return Vec3(x / d, y / d, z / d);
+	Vec3T operator/ (T d) const {
+		return Vec3T(x / d, y / d, z / d);
 	}
 
-	Vec3 operator/ (Vec3& v) const {
-		return Vec3(x / v.x, y / v.y, z / v.z);
+	Vec3T operator/ (Vec3T& v) const {
+		return Vec3T(x / v.x, y / v.y, z / v.z);
 	}
 
 	// Comparison operator
-	bool operator== (const Vec3& v) const {
+	bool operator== (const Vec3T& v) const {
 		return (x == v.x && y == v.y && z == v.z);
 	}
 
 	// Addition assignment operator
-	Vec3& operator+= (const Vec3& v) {
+	Vec3T& operator+= (const Vec3T& v) {
 		return *this = *this + v; // Implicitly uses operator +
 	}
 
 	// Division assignment operator
-	Vec3& operator/= (double d) {
+	Vec3T& operator/= (T d) {
 		return *this = *this / d; // Implicitly uses operator /
 	}
 
-	double dotProduct(const Vec3& v) const {
+	T dotProduct(const Vec3T& v) const {
 		return x * v.x + y * v.y + z * v.z;
 	}
 
-	Vec3 crossProduct(const Vec3& v) const {
-		return Vec3(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x);
+	Vec3T crossProduct(const Vec3T& v) const {
+		return Vec3T(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x);
 	}
 
-	double getLength() const {
+	T getLength() const {
 		return std::sqrt(x * x + y * y + z * z);
 	}
 
-	double euclDist(const Vec3& v) const {
-		return hypot(hypot(x - v.x, y - v.y), z - v.z);
+	T euclDist(const Vec3T& v) const {
+		return std::hypot(std::hypot(x - v.x, y - v.y), z - v.z);
 	}
 
-	Vec3 normalize() const {
-		double len = getLength();
+	Vec3T normalize() const {
+		T len = getLength();
 		return len > 0 ? (*this) / len : *this;
 	}
-};
\ No newline at end of file
+};
+
+using Vec3 = Vec3T<Real>;
+using Vec3d = Vec3T<double>;
+using Vec3f = Vec3T<float>;
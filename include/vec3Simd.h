@@ -0,0 +1,183 @@
+#pragma once
+
+#include "vec3.h"
+
+#include <cmath>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VEC3_SIMD_SSE
+#endif
+
+/// Vec3 padded to 4 lanes and aligned to the lane width so every operation is a few SSE instructions on the whole
+/// vector. Float vectors fill one SSE register, double vectors two (x, y and z, w). The padding lane w is always zero,
+/// so dot products can sum all four lanes. Same interface as Vec3T, converting to and from it is explicit so the hot
+/// paths can use it as a drop-in without it spreading to the stored geometry
+template<typename T>
+struct alignas(4 * sizeof(T)) Vec3AT {
+	static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value, "Vec3AT supports float and double");
+
+	T x, y, z, w;
+
+	Vec3AT(T xx = 0, T yy = 0, T zz = 0) : x(xx), y(yy), z(zz), w(0) {}
+
+	explicit Vec3AT(const Vec3T<T>& v) : x(v.x), y(v.y), z(v.z), w(0) {}
+
+	explicit operator Vec3T<T>() const {
+		return Vec3T<T>(x, y, z);
+	}
+
+	Vec3AT operator+ (const Vec3AT& v) const {
+#if defined(VEC3_SIMD_SSE)
+		if constexpr (std::is_same<T, float>::value) {
+			return fromLanes(_mm_add_ps(lanes(), v.lanes()));
+		}
+		else {
+			return fromLanes(_mm_add_pd(lanesXY(), v.lanesXY()), _mm_add_pd(lanesZW(), v.lanesZW()));
+		}
+#else
+		return Vec3AT(x + v.x, y + v.y, z + v.z);
+#endif
+	}
+
+	Vec3AT operator- (const Vec3AT& v) const {
+#if defined(VEC3_SIMD_SSE)
+		if constexpr (std::is_same<T, float>::value) {
+			return fromLanes(_mm_sub_ps(lanes(), v.lanes()));
+		}
+		else {
+			return fromLanes(_mm_sub_pd(lanesXY(), v.lanesXY()), _mm_sub_pd(lanesZW(), v.lanesZW()));
+		}
+#else
+		return Vec3AT(x - v.x, y - v.y, z - v.z);
+#endif
+	}
+
+	Vec3AT operator* (T d) const {
+#if defined(VEC3_SIMD_SSE)
+		if constexpr (std::is_same<T, float>::value) {
+			return fromLanes(_mm_mul_ps(lanes(), _mm_set1_ps(d)));
+		}
+		else {
+			__m128d s = _mm_set1_pd(d);
+			return fromLanes(_mm_mul_pd(lanesXY(), s), _mm_mul_pd(lanesZW(), s));
+		}
+#else
+		return Vec3AT(x * d, y * d, z * d);
+#endif
+	}
+
+	Vec3AT operator* (const Vec3AT& v) const {
+#if defined(VEC3_SIMD_SSE)
+		if constexpr (std::is_same<T, float>::value) {
+			return fromLanes(_mm_mul_ps(lanes(), v.lanes()));
+		}
+		else {
+			return fromLanes(_mm_mul_pd(lanesXY(), v.lanesXY()), _mm_mul_pd(lanesZW(), v.lanesZW()));
+		}
+#else
+		return Vec3AT(x * v.x, y * v.y, z * v.z);
+#endif
+	}
+
+	Vec3AT operator/ (T d) const {
+		return *this * (T(1) / d);
+	}
+
+	Vec3AT& operator+= (const Vec3AT& v) {
+		return *this = *this + v;
+	}
+
+	Vec3AT& operator/= (T d) {
+		return *this = *this / d;
+	}
+
+	T dotProduct(const Vec3AT& v) const {
+#if defined(VEC3_SIMD_SSE)
+		if constexpr (std::is_same<T, float>::value) {
+			__m128 p = _mm_mul_ps(lanes(), v.lanes());
+			__m128 s = _mm_add_ps(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 3, 0, 1)));
+			s = _mm_add_ss(s, _mm_movehl_ps(s, s));
+			return _mm_cvtss_f32(s);
+		}
+		else {
+			__m128d s = _mm_add_pd(_mm_mul_pd(lanesXY(), v.lanesXY()), _mm_mul_pd(lanesZW(), v.lanesZW()));
+			return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+		}
+#else
+		return x * v.x + y * v.y + z * v.z;
+#endif
+	}
+
+	Vec3AT crossProduct(const Vec3AT& v) const {
+#if defined(VEC3_SIMD_SSE)
+		if constexpr (std::is_same<T, float>::value) {
+			// (y, z, x) * (v.z, v.x, v.y) - (z, x, y) * (v.y, v.z, v.x), the w lanes stay zero
+			__m128 a = lanes(), b = v.lanes();
+			__m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+			__m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+			__m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+			return fromLanes(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+		}
+		else {
+			__m128d aXY = lanesXY(), aZW = lanesZW(), bXY = v.lanesXY(), bZW = v.lanesZW();
+			__m128d aYZ = _mm_shuffle_pd(aXY, aZW, 1), bYZ = _mm_shuffle_pd(bXY, bZW, 1);
+			__m128d aZX = _mm_shuffle_pd(aZW, aXY, 0), bZX = _mm_shuffle_pd(bZW, bXY, 0);
+			__m128d cXY = _mm_sub_pd(_mm_mul_pd(aYZ, bZX), _mm_mul_pd(aZX, bYZ));
+			__m128d p = _mm_mul_pd(aXY, _mm_shuffle_pd(bXY, bXY, 1));
+			__m128d cZ = _mm_sub_sd(p, _mm_unpackhi_pd(p, p));
+			return fromLanes(cXY, _mm_move_sd(_mm_setzero_pd(), cZ));
+		}
+#else
+		return Vec3AT(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x);
+#endif
+	}
+
+	T getLength() const {
+		return std::sqrt(dotProduct(*this));
+	}
+
+	Vec3AT normalize() const {
+		T len = getLength();
+		return len > 0 ? (*this) / len : *this;
+	}
+
+private:
+#if defined(VEC3_SIMD_SSE)
+	__m128 lanes() const {
+		return _mm_load_ps(reinterpret_cast<const float*>(&x));
+	}
+
+	__m128d lanesXY() const {
+		return _mm_load_pd(reinterpret_cast<const double*>(&x));
+	}
+
+	__m128d lanesZW() const {
+		return _mm_load_pd(reinterpret_cast<const double*>(&z));
+	}
+
+	static Vec3AT fromLanes(__m128 v) {
+		Vec3AT r;
+		_mm_store_ps(reinterpret_cast<float*>(&r.x), v);
+		return r;
+	}
+
+	static Vec3AT fromLanes(__m128d xy, __m128d zw) {
+		Vec3AT r;
+		_mm_store_pd(reinterpret_cast<double*>(&r.x), xy);
+		_mm_store_pd(reinterpret_cast<double*>(&r.z), zw);
+		return r;
+	}
+#endif
+};
+
+using Vec3A = Vec3AT<Real>;
+
+// Vector type of the per-sample shading math (camera rays, hemisphere sampling and the MC light combination). The
+// SIMD vector unless compiled with VEC3_SCALAR, which keeps the plain Vec3 for comparison
+#ifdef VEC3_SCALAR
+using ShadeVec3 = Vec3;
+#else
+using ShadeVec3 = Vec3A;
+#endif
@@ -0,0 +1,546 @@
+#pragma once
+
+#include "aabb.h"
+#include "ray.h"
+#include "traversalStats.h"
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WIDE_BVH_SSE
+#endif
+
+// Branching factor of the wide BVH, 8 lanes when compiled for AVX2 (BVH8) and 4 lanes for SSE (BVH4)
+#ifndef BVH_WIDTH
+#if defined(__AVX2__)
+#define BVH_WIDTH 8
+#else
+#define BVH_WIDTH 4
+#endif
+#endif
+
+/// Node of a wide BVH with quantized child bounds. Every child box is stored as Quant (8 or 16 bit) steps of scale
+/// from the origin of the node's own box, rounded outwards so the decoded box always contains the real one. A node is
+/// about half (16 bit) or a quarter (8 bit) of the float node's bound storage, so much more of a large tree stays in
+/// cache, at the price of looser boxes and a decode per visited node
+template<int Width, typename Quant = float>
+struct alignas(16) WideBVHNode {
+	using CountType = uint8_t; // leaves never hold more than BVH::maxLeafSize primitives
+
+	float origin[3];
+	float scale[3];
+	Quant qMinX[Width], qMinY[Width], qMinZ[Width];
+	Quant qMaxX[Width], qMaxY[Width], qMaxZ[Width];
+	int child[Width];
+	CountType count[Width];
+	int validMask = 0; // bit i is set if slot i holds a child
+};
+
+/// Node of a wide BVH. The child bounds are stored in single precision structure-of-arrays form so all children of a
+/// node are slab tested against a ray with one SIMD instruction per plane. A child with count > 0 is a leaf holding
+/// primitives [child, child + count) of the source BVH's primIndices, otherwise child is the index of a wide node
+template<int Width>
+struct alignas(32) WideBVHNode<Width, float> {
+	using CountType = int;
+
+	float minX[Width], minY[Width], minZ[Width];
+	float maxX[Width], maxY[Width], maxZ[Width];
+	int child[Width];
+	CountType count[Width];
+	int validMask = 0; // bit i is set if slot i holds a child
+};
+
+/// Wide (4 or 8 ary) BVH collapsed from a binary BVH, only used for traversal. Leaves keep referencing the primitive
+/// ranges of the binary tree so the same leaf callbacks work for both layouts. Quant selects float child bounds or
+/// bounds quantized to uint8_t/uint16_t
+template<int Width, typename Quant = float>
+class WideBVH {
+public:
+	using Node = WideBVHNode<Width, Quant>;
+
+	std::vector<Node> nodes;
+
+	bool empty() const {
+		return nodes.empty();
+	}
+
+	void clear() {
+		nodes.clear();
+	}
+
+	/// Collapse a binary tree, each wide node pulls up the interior child with the largest surface area until it has
+	/// Width children or only leaves are left
+	template<typename BinaryNode>
+	void collapse(const std::vector<BinaryNode>& binaryNodes) {
+		nodes.clear();
+		if (binaryNodes.empty()) {
+			return;
+		}
+		nodes.reserve(binaryNodes.size() / 2 + 1);
+		nodes.emplace_back();
+		fillNode(0, 0, binaryNodes);
+		nodes.shrink_to_fit();
+	}
+
+	/// Update the child bounds after the primitives moved without changing the topology. Child nodes are stored after
+	/// their parent, so a reverse sweep has the exact box of every child node before the slot pointing to it is set
+	void refit(const std::vector<int>& primIndices, const std::vector<AABB>& primBounds) {
+		std::vector<AABB> nodeBoxes(nodes.size());
+
+		for (int n = (int)nodes.size() - 1; n >= 0; --n) {
+			Node& node = nodes[n];
+			AABB boxes[Width];
+			int numChildren = 0;
+			for (int i = 0; i < Width; ++i) {
+				if (!(node.validMask & (1 << i))) {
+					continue;
+				}
+				numChildren = i + 1;
+
+				if (node.count[i] > 0) {
+					for (int j = node.child[i]; j < node.child[i] + node.count[i]; ++j) {
+						boxes[i].expand(primBounds[primIndices[j]]);
+					}
+				}
+				else {
+					boxes[i] = nodeBoxes[node.child[i]];
+				}
+				nodeBoxes[n].expand(boxes[i]);
+			}
+			setChildBounds(node, boxes, numChildren);
+		}
+	}
+
+	// Bytes used by the nodes
+	size_t memoryBytes() const {
+		return nodes.size() * sizeof(Node);
+	}
+
+	/// Closest hit traversal with the same leaf callback contract as BVH::intersectLeaves. Children hit by the ray are
+	/// sorted by entry distance and visited near to far
+	template<typename LeafTest>
+	bool intersect(const Ray& ray, double& tMax, LeafTest&& leafTest) const {
+		if (nodes.empty()) {
+			return false;
+		}
+
+		FloatRay fr(ray);
+		bool hit = false;
+
+		StackEntry stack[maxStackSize];
+		int stackSize = 0;
+		stack[stackSize++] = { 0, 0, 0.0f };
+
+		while (stackSize > 0) {
+			StackEntry entry = stack[--stackSize];
+
+			// Entries pushed before tMax shrank may be behind the closest hit by now
+			if (entry.tNear > (float)tMax * tFarScale) {
+				continue;
+			}
+
+			if (entry.count > 0) {
+				if (leafTest(entry.index, entry.count, tMax)) {
+					hit = true;
+				}
+				continue;
+			}
+
+			const Node& node = nodes[entry.index];
+			TRAVERSAL_STAT(nodes);
+			float tNear[Width];
+			int mask = slabTest(node, fr, (float)tMax * tFarScale, tNear) & node.validMask;
+
+			// Collect the hit children and sort them far to near, so the nearest ends on top of the stack
+			StackEntry hits[Width];
+			int numHits = 0;
+			while (mask) {
+				int i = lowestBit(mask);
+				mask &= mask - 1;
+
+				StackEntry e = { node.child[i], node.count[i], tNear[i] };
+				int j = numHits++;
+				while (j > 0 && hits[j - 1].tNear < e.tNear) {
+					hits[j] = hits[j - 1];
+					--j;
+				}
+				hits[j] = e;
+			}
+			for (int i = 0; i < numHits; ++i) {
+				stack[stackSize++] = hits[i];
+			}
+		}
+
+		return hit;
+	}
+
+	/// Any hit traversal for occlusion queries with the same leaf callback contract as BVH::occludedLeaves, the
+	/// traversal stops at the first leaf holding a blocker. Children are not sorted since any blocker will do
+	template<typename AnyHitTest>
+	bool occluded(const Ray& ray, double tMax, AnyHitTest&& anyHit) const {
+		if (nodes.empty()) {
+			return false;
+		}
+
+		FloatRay fr(ray);
+		float tFar = (float)tMax * tFarScale;
+
+		int stack[maxStackSize];
+		int stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize > 0) {
+			const Node& node = nodes[stack[--stackSize]];
+			TRAVERSAL_STAT(nodes);
+			float tNear[Width];
+			int mask = slabTest(node, fr, tFar, tNear) & node.validMask;
+
+			while (mask) {
+				int i = lowestBit(mask);
+				mask &= mask - 1;
+
+				// Leaves are tested right away, interior children are pushed
+				if (node.count[i] > 0) {
+					if (anyHit(node.child[i], (int)node.count[i])) {
+						return true;
+					}
+				}
+				else {
+					stack[stackSize++] = node.child[i];
+				}
+			}
+		}
+
+		return false;
+	}
+
+private:
+	struct StackEntry {
+		int index;
+		int count;
+		float tNear;
+	};
+
+	// The binary builders keep the depth below 128, every wide node pushes at most Width entries
+	static constexpr int maxStackSize = 128 * Width;
+
+	// Slab distances are computed in single precision, widen the far distance so rounding can't cull a real hit
+	static constexpr float tFarScale = 1.0f + 1e-6f;
+
+	/// Ray in single precision. Zero direction components are replaced by a tiny value so the inverse stays finite
+	/// and the slab test never produces NaNs. Origin and inverse direction are broadcast to SIMD registers once per ray
+	struct FloatRay {
+		float ox, oy, oz;
+		float idx, idy, idz;
+#if defined(__AVX__)
+		__m256 ox8, oy8, oz8, idx8, idy8, idz8;
+#endif
+#if defined(WIDE_BVH_SSE)
+		__m128 ox4, oy4, oz4, idx4, idy4, idz4;
+#endif
+
+		explicit FloatRay(const Ray& ray) {
+			ox = (float)ray.origin.x;
+			oy = (float)ray.origin.y;
+			oz = (float)ray.origin.z;
+			idx = inverse(ray.direction.x);
+			idy = inverse(ray.direction.y);
+			idz = inverse(ray.direction.z);
+#if defined(__AVX__)
+			if constexpr (Width == 8) {
+				ox8 = _mm256_set1_ps(ox); oy8 = _mm256_set1_ps(oy); oz8 = _mm256_set1_ps(oz);
+				idx8 = _mm256_set1_ps(idx); idy8 = _mm256_set1_ps(idy); idz8 = _mm256_set1_ps(idz);
+			}
+#endif
+#if defined(WIDE_BVH_SSE)
+			if constexpr (Width == 4) {
+				ox4 = _mm_set1_ps(ox); oy4 = _mm_set1_ps(oy); oz4 = _mm_set1_ps(oz);
+				idx4 = _mm_set1_ps(idx); idy4 = _mm_set1_ps(idy); idz4 = _mm_set1_ps(idz);
+			}
+#endif
+		}
+
+		static float inverse(double d) {
+			const double minDir = 1e-20;
+			if (std::abs(d) < minDir) {
+				d = d < 0.0 ? -minDir : minDir;
+			}
+			return (float)(1.0 / d);
+		}
+	};
+
+	static int lowestBit(int mask) {
+#if defined(_MSC_VER)
+		unsigned long i;
+		_BitScanForward(&i, (unsigned long)mask);
+		return (int)i;
+#else
+		return __builtin_ctz((unsigned int)mask);
+#endif
+	}
+
+	// Round outwards when converting bounds to float, plus a small margin that covers the rounding of the ray origin
+	static float roundDown(double v) {
+		double padded = v - (std::abs(v) + 1.0) * 1e-6;
+		return std::nextafter((float)padded, -std::numeric_limits<float>::infinity());
+	}
+
+	static float roundUp(double v) {
+		double padded = v + (std::abs(v) + 1.0) * 1e-6;
+		return std::nextafter((float)padded, std::numeric_limits<float>::infinity());
+	}
+
+	template<typename BinaryNode>
+	void fillNode(int wideIdx, int binaryIdx, const std::vector<BinaryNode>& binaryNodes) {
+		int children[Width];
+		int numChildren = 0;
+
+		const BinaryNode& root = binaryNodes[binaryIdx];
+		if (root.isLeaf()) {
+			children[numChildren++] = binaryIdx;
+		}
+		else {
+			children[numChildren++] = root.leftFirst;
+			children[numChildren++] = root.leftFirst + 1;
+		}
+
+		// Open up the largest interior child until the node is full
+		while (numChildren < Width) {
+			int largest = -1;
+			double largestArea = -1.0;
+			for (int i = 0; i < numChildren; ++i) {
+				const BinaryNode& c = binaryNodes[children[i]];
+				if (!c.isLeaf() && c.bounds.surfaceArea() > largestArea) {
+					largestArea = c.bounds.surfaceArea();
+					largest = i;
+				}
+			}
+			if (largest < 0) {
+				break;
+			}
+
+			int opened = children[largest];
+			children[largest] = binaryNodes[opened].leftFirst;
+			children[numChildren++] = binaryNodes[opened].leftFirst + 1;
+		}
+
+		AABB boxes[Width];
+		for (int i = 0; i < numChildren; ++i) {
+			boxes[i] = binaryNodes[children[i]].bounds;
+		}
+		setChildBounds(nodes[wideIdx], boxes, numChildren);
+
+		for (int i = 0; i < Width; ++i) {
+			Node& node = nodes[wideIdx];
+			if (i >= numChildren) {
+				node.child[i] = 0;
+				node.count[i] = 0;
+				continue;
+			}
+
+			const BinaryNode& c = binaryNodes[children[i]];
+			node.validMask |= 1 << i;
+
+			if (c.isLeaf()) {
+				node.child[i] = c.leftFirst;
+				node.count[i] = (typename Node::CountType)c.count;
+			}
+			else {
+				// Allocating may move the node array, so the reference above is taken again every iteration
+				int childIdx = (int)nodes.size();
+				nodes.emplace_back();
+				nodes[wideIdx].child[i] = childIdx;
+				nodes[wideIdx].count[i] = 0;
+				fillNode(childIdx, children[i], binaryNodes);
+			}
+		}
+	}
+
+	/// Store the bounds of the first numChildren slots, the remaining slots get empty bounds
+	static void setChildBounds(Node& node, const AABB* boxes, int numChildren) {
+		if constexpr (std::is_same<Quant, float>::value) {
+			for (int i = 0; i < Width; ++i) {
+				bool used = i < numChildren;
+				node.minX[i] = used ? roundDown(boxes[i].min.x) : 0.0f;
+				node.minY[i] = used ? roundDown(boxes[i].min.y) : 0.0f;
+				node.minZ[i] = used ? roundDown(boxes[i].min.z) : 0.0f;
+				node.maxX[i] = used ? roundUp(boxes[i].max.x) : 0.0f;
+				node.maxY[i] = used ? roundUp(boxes[i].max.y) : 0.0f;
+				node.maxZ[i] = used ? roundUp(boxes[i].max.z) : 0.0f;
+			}
+		}
+		else {
+			Quant* qMin[3] = { node.qMinX, node.qMinY, node.qMinZ };
+			Quant* qMax[3] = { node.qMaxX, node.qMaxY, node.qMaxZ };
+
+			for (int axis = 0; axis < 3; ++axis) {
+				// Child bounds rounded outwards to float first, exactly like the float layout
+				float lo[Width], hi[Width];
+				float nodeLo = std::numeric_limits<float>::infinity();
+				float nodeHi = -std::numeric_limits<float>::infinity();
+				for (int i = 0; i < numChildren; ++i) {
+					lo[i] = roundDown(axisValue(boxes[i].min, axis));
+					hi[i] = roundUp(axisValue(boxes[i].max, axis));
+					nodeLo = std::min(nodeLo, lo[i]);
+					nodeHi = std::max(nodeHi, hi[i]);
+				}
+				if (numChildren == 0) {
+					nodeLo = nodeHi = 0.0f;
+				}
+
+				// Smallest step for which the top quantization level still reaches the node's upper bound
+				const double levels = (double)std::numeric_limits<Quant>::max();
+				float scale = (float)((nodeHi - nodeLo) / levels);
+				while (decodeLow(levels, nodeLo, scale) < nodeHi) {
+					scale = std::nextafter(scale, std::numeric_limits<float>::infinity());
+				}
+				node.origin[axis] = nodeLo;
+				node.scale[axis] = scale;
+
+				for (int i = 0; i < Width; ++i) {
+					if (i >= numChildren || scale == 0.0f) {
+						qMin[axis][i] = 0;
+						qMax[axis][i] = 0;
+						continue;
+					}
+
+					// Round down/up to a level, then step further out until the decoded value is outside the child
+					double qLo = std::max(0.0, std::floor((lo[i] - nodeLo) / (double)scale));
+					double qHi = std::min(levels, std::ceil((hi[i] - nodeLo) / (double)scale));
+					while (qLo > 0.0 && decodeHigh(qLo, nodeLo, scale) > lo[i]) {
+						qLo -= 1.0;
+					}
+					while (qHi < levels && decodeLow(qHi, nodeLo, scale) < hi[i]) {
+						qHi += 1.0;
+					}
+					qMin[axis][i] = (Quant)qLo;
+					qMax[axis][i] = (Quant)qHi;
+				}
+			}
+		}
+	}
+
+	// Decoded value of a quantization level, the traversal computes origin + q * scale with or without a fused
+	// multiply-add depending on the compiler, so the encoder checks against the smaller and larger of both results
+	static float decodeLow(double q, float origin, float scale) {
+		float product = (float)q * scale;
+		return std::min(origin + product, std::fma((float)q, scale, origin));
+	}
+
+	static float decodeHigh(double q, float origin, float scale) {
+		float product = (float)q * scale;
+		return std::max(origin + product, std::fma((float)q, scale, origin));
+	}
+
+	/// Slab test of a node's children, quantized nodes are decoded to float bounds first
+	static int slabTest(const Node& node, const FloatRay& r, float tMax, float* tNear) {
+		if constexpr (std::is_same<Quant, float>::value) {
+			return slabTest(node.minX, node.minY, node.minZ, node.maxX, node.maxY, node.maxZ, r, tMax, tNear);
+		}
+		else {
+			alignas(32) float minX[Width], minY[Width], minZ[Width], maxX[Width], maxY[Width], maxZ[Width];
+			decode(node.qMinX, node.origin[0], node.scale[0], minX);
+			decode(node.qMinY, node.origin[1], node.scale[1], minY);
+			decode(node.qMinZ, node.origin[2], node.scale[2], minZ);
+			decode(node.qMaxX, node.origin[0], node.scale[0], maxX);
+			decode(node.qMaxY, node.origin[1], node.scale[1], maxY);
+			decode(node.qMaxZ, node.origin[2], node.scale[2], maxZ);
+			return slabTest(minX, minY, minZ, maxX, maxY, maxZ, r, tMax, tNear);
+		}
+	}
+
+	static void decode(const Quant* q, float origin, float scale, float* out) {
+#if defined(__AVX2__)
+		if constexpr (Width == 8) {
+			__m256i wide;
+			if constexpr (sizeof(Quant) == 1) {
+				wide = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)q));
+			}
+			else {
+				wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)q));
+			}
+			__m256 levels = _mm256_cvtepi32_ps(wide);
+			_mm256_store_ps(out, _mm256_add_ps(_mm256_set1_ps(origin), _mm256_mul_ps(levels, _mm256_set1_ps(scale))));
+			return;
+		}
+#endif
+		for (int i = 0; i < Width; ++i) {
+			out[i] = origin + (float)q[i] * scale;
+		}
+	}
+
+	/// Slab test of all children against the ray at once. Returns a bit mask of the children the ray hits within
+	/// [0, tMax] and writes their entry distances to tNear. The bound arrays have to be 32 byte aligned
+	static int slabTest(const float* minX, const float* minY, const float* minZ, const float* maxX, const float* maxY,
+		const float* maxZ, const FloatRay& r, float tMax, float* tNear) {
+#if defined(__AVX__)
+		if constexpr (Width == 8) {
+			const __m256 &ox = r.ox8, &oy = r.oy8, &oz = r.oz8, &idx = r.idx8, &idy = r.idy8, &idz = r.idz8;
+
+			__m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(minX), ox), idx);
+			__m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(maxX), ox), idx);
+			__m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(minY), oy), idy);
+			__m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(maxY), oy), idy);
+			__m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(minZ), oz), idz);
+			__m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(maxZ), oz), idz);
+
+			__m256 tEntry = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)),
+				_mm256_max_ps(_mm256_min_ps(tz0, tz1), _mm256_setzero_ps()));
+			__m256 tExit = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)),
+				_mm256_min_ps(_mm256_max_ps(tz0, tz1), _mm256_set1_ps(tMax)));
+
+			_mm256_storeu_ps(tNear, tEntry);
+			return _mm256_movemask_ps(_mm256_cmp_ps(tEntry, tExit, _CMP_LE_OQ));
+		}
+#endif
+#if defined(WIDE_BVH_SSE)
+		if constexpr (Width == 4) {
+			const __m128 &ox = r.ox4, &oy = r.oy4, &oz = r.oz4, &idx = r.idx4, &idy = r.idy4, &idz = r.idz4;
+
+			__m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(minX), ox), idx);
+			__m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxX), ox), idx);
+			__m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(minY), oy), idy);
+			__m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxY), oy), idy);
+			__m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(minZ), oz), idz);
+			__m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxZ), oz), idz);
+
+			__m128 tEntry = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)),
+				_mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+			__m128 tExit = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+				_mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(tMax)));
+
+			_mm_storeu_ps(tNear, tEntry);
+			return _mm_movemask_ps(_mm_cmple_ps(tEntry, tExit));
+		}
+#endif
+		// Scalar fallback for other widths or targets without SSE
+		int mask = 0;
+		for (int i = 0; i < Width; ++i) {
+			float tx0 = (minX[i] - r.ox) * r.idx, tx1 = (maxX[i] - r.ox) * r.idx;
+			float ty0 = (minY[i] - r.oy) * r.idy, ty1 = (maxY[i] - r.oy) * r.idy;
+			float tz0 = (minZ[i] - r.oz) * r.idz, tz1 = (maxZ[i] - r.oz) * r.idz;
+
+			float tEntry = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+			float tExit = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), tMax));
+
+			tNear[i] = tEntry;
+			if (tEntry <= tExit) {
+				mask |= 1 << i;
+			}
+		}
+		return mask;
+	}
+};
@@ -17,6 +17,14 @@ int main() {
 	Camera cam;
 	Scene scene;
 
+	// Build the acceleration structures separately so build time is reported on its own. Trees of unchanged
+	// geometry are loaded from the cache directory instead of being rebuilt
+	scene.bvhCacheDir = "bvhcache";
+	auto b1 = high_resolution_clock::now();
+	scene.buildBVH();
+	auto b2 = high_resolution_clock::now();
+	auto buildMs = duration_cast<milliseconds>(b2 - b1);
+
 	Renderer renderer;
 	auto t1 = high_resolution_clock::now();
 	renderer.render(scene, cam, WIDTH, HEIGHT, "test.ppm");
@@ -28,6 +36,7 @@ int main() {
 	/* Getting number of milliseconds as a double. */
 	duration<double, std::milli> ms_double = t2 - t1;
 
+	std::cout << "BVH build time: " << buildMs.count() << "ms\n";
 	std::cout <<"Rendering time: " << ms_int.count() << "ms\n";
 
 	std::cout << "Rendered to test.ppm\n";